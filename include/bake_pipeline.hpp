@@ -0,0 +1,197 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_BAKE_PIPELINE
+#define INCLUDED_GLSLMATH_BAKE_PIPELINE
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "math.hpp"
+#include "mesh.hpp"
+#include "marching_cubes.hpp"
+#include "brick_mesher.hpp"
+#include "mesh_optimizer.hpp"
+#include "parallel.hpp"
+
+namespace glslmath {
+
+/// Bake a lattice to multi_mesh binary as a pipeline over chunks of the lattice.
+///
+/// Each chunk goes through three stages, each a task on a task_pool: generate (marching cubes with
+/// normals and optionally optimize_mesh), split into submeshes that fit 16 bit indices, and serialize.
+/// While one chunk is meshed the chunks before it are being split and serialized, so the stages
+/// overlap instead of each running over the whole lattice in turn.
+///
+/// At most max_in_flight chunks hold intermediate meshes at once. A chunk is only started when an
+/// earlier one has handed its bytes to the sink, which happens in chunk order.
+class bake_pipeline : public serial {
+public:
+  // chunk_bricks as for brick_mesher; max_in_flight zero for two chunks per thread.
+  explicit bake_pipeline(size_t num_threads=0, int chunk_bricks=8, size_t max_in_flight=0)
+  : pool_(num_threads), grid_(chunk_bricks * mc_brick_index::brick_size), max_submesh_(65500),
+    gradient_normals_(false), optimize_(false), next_emit_(0), emitting_(false), in_flight_(0), peak_in_flight_(0) {
+    if (chunk_bricks < 1) throw(std::range_error("bake_pipeline: expected at least one brick per chunk"));
+    if (max_in_flight == 0) max_in_flight = pool_.size() * 2;
+    slots_.resize(max_in_flight);
+    free_.reset(new bounded_queue<size_t>(max_in_flight));
+  }
+
+  // Largest vertex count of a submesh.
+  void set_max_submesh(size_t max_vertices) {
+    max_submesh_ = max_vertices;
+  }
+
+  // As marching_cubes::set_gradient_normals.
+  void set_gradient_normals(bool enable) {
+    gradient_normals_ = enable;
+  }
+
+  // Run optimize_mesh on each chunk before it is split.
+  void set_optimize(bool enable) {
+    optimize_ = enable;
+  }
+
+  // Bake a lattice with the arguments of marching_cubes::generate, calling
+  // sink(size_t chunk, const multi_mesh &parts, const std::vector<std::uint8_t> &bytes) for each
+  // non-empty chunk. bytes are the write_binary() of each part in turn, without a multi_mesh chunk.
+  // The sink is called in chunk order, one call at a time, from any thread of the pool.
+  template <class Sink>
+  void run(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours, Sink sink) {
+    grid_.reset(x0, y0, z0, xdim, ydim, zdim, grid_spacing, mc_values, mc_colours);
+    size_t total = grid_.chunk_count();
+
+    done_.assign(total, (size_t)none);
+    next_emit_ = 0;
+    emitting_ = false;
+    peak_in_flight_ = 0;
+    for (size_t s = 0; s != slots_.size(); ++s) free_->push(s);
+
+    Sink *sp = &sink;
+    for (size_t c = 0; c != total; ++c) {
+      // wait for a free slot, helping with the stages of earlier chunks meanwhile.
+      size_t s = 0;
+      while (!free_->try_pop(s)) {
+        if (!pool_.run_one()) {
+          free_->pop(s);
+          break;
+        }
+      }
+      size_t n = ++in_flight_;
+      peak_in_flight_ = std::max(peak_in_flight_, n);
+      pool_.spawn([this, s, c, sp]() {
+        GLSLMATH_STATS_SCOPE("bake_pipeline.generate");
+        if (!generate_chunk(slots_[s], c)) {
+          finish(s, c, *sp);
+          return;
+        }
+        pool_.spawn([this, s, c, sp]() {
+          GLSLMATH_STATS_SCOPE("bake_pipeline.split");
+          slot &sl = slots_[s];
+          sl.parts = multi_mesh::split(sl.msh, max_submesh_, 2, 1);
+          pool_.spawn([this, s, c, sp]() {
+            GLSLMATH_STATS_SCOPE("bake_pipeline.serialize");
+            serialize_chunk(slots_[s]);
+            finish(s, c, *sp);
+          });
+        });
+      });
+    }
+    pool_.wait();
+
+    for (size_t s = 0; free_->try_pop(s); ) {}
+  }
+
+  // The bytes of the multi_mesh whose submeshes are the parts of every chunk in order.
+  std::vector<std::uint8_t> bake(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours) {
+    size_t header = txt_size("MLT");
+    std::vector<std::uint8_t> result(header + 4);
+    wr32(wrtxt(result.data(), "MLT"), 0);
+    run(x0, y0, z0, xdim, ydim, zdim, grid_spacing, mc_values, mc_colours, [&](size_t, const multi_mesh &, const std::vector<std::uint8_t> &bytes) {
+      result.insert(result.end(), bytes.begin(), bytes.end());
+    });
+    wr32(result.data() + header, result.size() - header);
+    return result;
+  }
+
+  size_t num_threads() const { return pool_.size(); }
+  size_t max_in_flight() const { return slots_.size(); }
+
+  // Most chunks that held intermediates at once during the last run().
+  size_t peak_in_flight() const { return peak_in_flight_; }
+
+private:
+  static const size_t none = ~(size_t)0;
+
+  // Scratch for a chunk in flight: a copy of its lattice points and its mesh at each stage.
+  struct slot {
+    mc_chunks::scratch scratch;
+    mesh msh;
+    multi_mesh parts;
+    std::vector<std::uint8_t> bytes;
+  };
+
+  // Mesh a chunk into its slot, the same mesh as brick_mesher::chunk_mesh. False if it is empty.
+  bool generate_chunk(slot &sl, size_t c) {
+    sl.parts = multi_mesh();
+    sl.bytes.clear();
+    if (!grid_.generate(sl.scratch, c, gradient_normals_, sl.msh)) return false;
+    if (optimize_) optimize_mesh(sl.msh);
+    return true;
+  }
+
+  void serialize_chunk(slot &sl) {
+    size_t size = 0;
+    for (auto &m : sl.parts.submeshes()) size += m.binary_size();
+    sl.bytes.resize(size);
+    std::uint8_t *p = sl.bytes.data();
+    for (auto &m : sl.parts.submeshes()) p = m.write_binary(p);
+  }
+
+  // Mark a chunk done and, unless another thread is already doing so, pass every chunk that is
+  // now next in order to the sink and free its slot.
+  template <class Sink>
+  void finish(size_t s, size_t c, Sink &sink) {
+    std::unique_lock<std::mutex> lock(emit_mutex_);
+    done_[c] = s;
+    if (emitting_) return;
+    emitting_ = true;
+    while (next_emit_ != done_.size() && done_[next_emit_] != none) {
+      slot &sl = slots_[done_[next_emit_]];
+      lock.unlock();
+      if (!sl.bytes.empty()) sink(next_emit_, sl.parts, sl.bytes);
+      sl.msh = mesh();
+      sl.parts = multi_mesh();
+      sl.bytes.clear();
+      lock.lock();
+      --in_flight_;
+      free_->push(done_[next_emit_++]);
+    }
+    emitting_ = false;
+  }
+
+  task_pool pool_;
+  mc_chunks grid_;
+  size_t max_submesh_;
+  bool gradient_normals_;
+  bool optimize_;
+  std::vector<slot> slots_;
+  std::unique_ptr<bounded_queue<size_t>> free_;
+  std::vector<size_t> done_;
+  size_t next_emit_;
+  bool emitting_;
+  std::mutex emit_mutex_;
+  std::atomic<size_t> in_flight_;
+  size_t peak_in_flight_;
+};
+
+}
+
+#endif
@@ -0,0 +1,290 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_BRICK_MESHER
+#define INCLUDED_GLSLMATH_BRICK_MESHER
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include "math.hpp"
+#include "mesh.hpp"
+#include "marching_cubes.hpp"
+#include "parallel.hpp"
+
+namespace glslmath {
+
+/// A lattice divided into chunks of whole bricks, and the mesh of one chunk made from a copy of its points.
+/// brick_mesher and bake_pipeline both mesh their chunks through this so that they are the same.
+class mc_chunks {
+public:
+  // Scratch for meshing chunks on one thread: a single threaded mesher and a copy of the chunk's lattice points.
+  struct scratch {
+    scratch() : mc(1) {}
+    marching_cubes mc;
+    std::vector<float> values;
+    std::vector<vec4> colours;
+  };
+
+  explicit mc_chunks(int chunk_cubes)
+  : chunk_cubes_(chunk_cubes), x0_(0), y0_(0), z0_(0), xdim_(0), ydim_(0), zdim_(0), grid_spacing_(1), values_(nullptr), colours_(nullptr),
+    xchunks_(0), ychunks_(0), zchunks_(0) {
+  }
+
+  // The lattice, with the arguments of marching_cubes::generate.
+  void reset(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours) {
+    x0_ = x0; y0_ = y0; z0_ = z0;
+    xdim_ = xdim; ydim_ = ydim; zdim_ = zdim;
+    grid_spacing_ = grid_spacing;
+    values_ = mc_values;
+    colours_ = mc_colours;
+    xchunks_ = num_chunks(xdim);
+    ychunks_ = num_chunks(ydim);
+    zchunks_ = num_chunks(zdim);
+  }
+
+  int chunk_cubes() const { return chunk_cubes_; }
+  int x0() const { return x0_; }
+  int y0() const { return y0_; }
+  int z0() const { return z0_; }
+  int xdim() const { return xdim_; }
+  int ydim() const { return ydim_; }
+  int zdim() const { return zdim_; }
+  float grid_spacing() const { return grid_spacing_; }
+  const float *values() const { return values_; }
+  int xchunks() const { return xchunks_; }
+  int ychunks() const { return ychunks_; }
+  int zchunks() const { return zchunks_; }
+  size_t chunk_count() const { return (size_t)xchunks_ * ychunks_ * zchunks_; }
+  size_t chunk_index(int i, int j, int k) const { return ((size_t)k * ychunks_ + j) * xchunks_ + i; }
+
+  // Mesh chunk c into dest as "mesh.<c>", with 16 bit indices if they fit. Gradient normals are
+  // taken from the whole lattice, so they match across chunk faces.
+  // Returns false, leaving dest empty, if the surface does not pass through the chunk.
+  bool generate(scratch &sc, size_t c, bool gradient_normals, mesh &dest) const {
+    dest = mesh();
+    int ci = (int)(c % xchunks_), cj = (int)(c / xchunks_ % ychunks_), ck = (int)(c / ((size_t)xchunks_ * ychunks_));
+    int i0 = ci * chunk_cubes_, j0 = cj * chunk_cubes_, k0 = ck * chunk_cubes_;
+    int nx = std::min(chunk_cubes_, xdim_ - 1 - i0) + 1;
+    int ny = std::min(chunk_cubes_, ydim_ - 1 - j0) + 1;
+    int nz = std::min(chunk_cubes_, zdim_ - 1 - k0) + 1;
+
+    // copy the chunk's points, noting whether the surface passes through them at all.
+    sc.values.resize((size_t)nx * ny * nz);
+    if (colours_) sc.colours.resize(sc.values.size());
+    float lo = values_[((size_t)k0 * ydim_ + j0) * xdim_ + i0], hi = lo;
+    size_t d = 0;
+    for (int k = 0; k != nz; ++k) {
+      for (int j = 0; j != ny; ++j, d += nx) {
+        size_t src = ((size_t)(k0 + k) * ydim_ + j0 + j) * xdim_ + i0;
+        for (int i = 0; i != nx; ++i) {
+          lo = std::min(lo, values_[src + i]);
+          hi = std::max(hi, values_[src + i]);
+        }
+        std::copy(values_ + src, values_ + src + nx, sc.values.data() + d);
+        if (colours_) std::copy(colours_ + src, colours_ + src + nx, sc.colours.data() + d);
+      }
+    }
+    if (!(lo < 0 && hi >= 0)) return false;
+
+    sc.mc.set_gradient_normals(gradient_normals);
+    sc.mc.generate(x0_ + i0, y0_ + j0, z0_ + k0, nx, ny, nz, grid_spacing_, sc.values.data(), colours_ ? sc.colours.data() : nullptr);
+    const mesh &src = sc.mc.get_mesh();
+    if (src.indices().empty()) return false;
+
+    std::stringstream ns;
+    ns << "mesh." << c;
+    dest = mesh(ns.str(), src.vertex_count() <= 0x10000 ? 2 : 4);
+    for (auto &a : src.attributes()) {
+      dest[dest.add_attribute(a)].data() = a.data();
+    }
+    dest.indices() = src.indices();
+
+    // the chunk's own gradient is one-sided on its faces, so recompute from the whole lattice.
+    if (gradient_normals) {
+      const attribute &pos = dest[dest.find_attribute("pos")];
+      attribute &normal = dest[dest.find_attribute("normal")];
+      vec3 origin((float)x0_, (float)y0_, (float)z0_);
+      float rgs = 1.0f / grid_spacing_;
+      for (size_t i = 0; i != pos.vertex_count(); ++i) {
+        vec3 g = marching_cubes::gradient_at(values_, xdim_, ydim_, zdim_, pos[i].xyz() * rgs - origin);
+        float len2 = dot(g, g);
+        normal.set(i, vec4(len2 > 0 ? vec3(g * (-1.0f / std::sqrt(len2))) : vec3(1, 0, 0), 1));
+      }
+    }
+    return true;
+  }
+
+private:
+  // chunks along an axis of dim points, dim - 1 cubes.
+  int num_chunks(int dim) const {
+    return dim < 2 ? 0 : (dim - 2) / chunk_cubes_ + 1;
+  }
+
+  int chunk_cubes_;
+  int x0_, y0_, z0_;
+  int xdim_, ydim_, zdim_;
+  float grid_spacing_;
+  const float *values_;
+  const vec4 *colours_;
+  int xchunks_, ychunks_, zchunks_;
+};
+
+/// Marching cubes over a lattice divided into chunks of whole bricks, one submesh per chunk.
+///
+/// After values are edited in place, update() with the box of changed lattice points regenerates
+/// only the chunks whose cubes (or, with gradient normals, whose vertex normals) depend on them.
+/// Every other chunk keeps its mesh and serialized bytes untouched, so the cost of an edit
+/// follows the size of the edit rather than the volume.
+///
+/// Each chunk is meshed from a copy of its own lattice points, so its vertices are the same as
+/// marching_cubes over the whole lattice but vertices on chunk faces are duplicated in both chunks.
+/// The lattice stays owned by the caller and must outlive the mesher.
+class brick_mesher : public serial {
+public:
+  // chunk_bricks is the edge of a chunk in mc_brick_index bricks; 4 gives 32x32x32 cubes per submesh.
+  // num_threads as for marching_cubes (zero for one per core).
+  explicit brick_mesher(size_t num_threads=1, int chunk_bricks=4)
+  : grid_(chunk_bricks * mc_brick_index::brick_size), gradient_normals_(false), next_gradient_normals_(false) {
+    if (chunk_bricks < 1) throw(std::range_error("brick_mesher: expected at least one brick per chunk"));
+    set_num_threads(num_threads);
+  }
+
+  void set_num_threads(size_t num_threads) {
+    if (num_threads == 0) num_threads = default_num_threads();
+    pool_.reset(num_threads > 1 ? new thread_pool(num_threads) : nullptr);
+    lanes_.resize(num_threads);
+  }
+
+  // Take normals from the gradient of the whole lattice so that they match across chunk faces.
+  // Otherwise each chunk sums its own face normals and shading may show a seam at chunk faces.
+  // Takes effect at the next reset(), so that every chunk of a lattice has the same kind of normals.
+  void set_gradient_normals(bool enable) {
+    next_gradient_normals_ = enable;
+  }
+
+  // Mesh a whole lattice, with the arguments of marching_cubes::generate.
+  // values and colours are read again by update() so edit them in place.
+  void reset(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours) {
+    grid_.reset(x0, y0, z0, xdim, ydim, zdim, grid_spacing, mc_values, mc_colours);
+    gradient_normals_ = next_gradient_normals_;
+    chunks_.clear();
+    chunks_.resize(grid_.chunk_count());
+    dirty_.resize(chunks_.size());
+    for (size_t c = 0; c != dirty_.size(); ++c) dirty_[c] = c;
+    regenerate();
+  }
+
+  // Regenerate the chunks affected by a change to the lattice points in [lo, hi).
+  // Returns the indices of the regenerated chunks in increasing order; all others are unchanged.
+  const std::vector<size_t> &update(ivec3 lo, ivec3 hi) {
+    // a cube reads its eight corners; a gradient normal reads two more points beyond its edge.
+    int pad = gradient_normals_ ? 4 : 1;
+    int c0[3], c1[3];
+    int counts[3] = { grid_.xchunks(), grid_.ychunks(), grid_.zchunks() };
+    int chunk_cubes = grid_.chunk_cubes();
+    for (int a = 0; a != 3; ++a) {
+      c0[a] = std::max(lo[a] - pad, 0) / chunk_cubes;
+      c1[a] = std::min(std::max(hi[a] + pad - 1, 0) / chunk_cubes + 1, counts[a]);
+    }
+    dirty_.clear();
+    for (int k = c0[2]; k < c1[2]; ++k) {
+      for (int j = c0[1]; j < c1[1]; ++j) {
+        for (int i = c0[0]; i < c1[0]; ++i) dirty_.push_back(chunk_index(i, j, k));
+      }
+    }
+    regenerate();
+    return dirty_;
+  }
+
+  int xchunks() const { return grid_.xchunks(); }
+  int ychunks() const { return grid_.ychunks(); }
+  int zchunks() const { return grid_.zchunks(); }
+  size_t chunk_count() const { return chunks_.size(); }
+  size_t chunk_index(int i, int j, int k) const { return grid_.chunk_index(i, j, k); }
+
+  // The submesh of a chunk, with no triangles if the surface does not pass through it.
+  const mesh &chunk_mesh(size_t c) const { return chunks_[c].msh; }
+  bool chunk_empty(size_t c) const { return chunks_[c].msh.indices().empty(); }
+
+  // mesh::to_binary() of a non-empty chunk, kept until the chunk is regenerated. Empty for empty chunks.
+  const std::vector<std::uint8_t> &chunk_binary(size_t c) const { return chunks_[c].binary; }
+
+  // The non-empty chunks as submeshes, in chunk order.
+  multi_mesh to_multi_mesh() const {
+    multi_mesh res;
+    for (auto &c : chunks_) {
+      if (!c.msh.indices().empty()) res.submeshes().push_back(c.msh);
+    }
+    return res;
+  }
+
+  // Same bytes as to_multi_mesh().write_binary() from the cached chunk binaries.
+  template <class Iter>
+  Iter write_binary(Iter p) const {
+    {
+      chunk<Iter> MLT(p, "MLT");
+      for (auto &c : chunks_) {
+        p = wrbytes(p, c.binary.data(), c.binary.size());
+      }
+    }
+    return p;
+  }
+
+  // size of write_binary() without writing anything.
+  size_t binary_size() const {
+    size_t content = 0;
+    for (auto &c : chunks_) content += c.binary.size();
+    return chunk_size("MLT", content);
+  }
+
+  std::vector<std::uint8_t> to_binary() const {
+    std::vector<std::uint8_t> result(binary_size());
+    write_binary(result.data());
+    return result;
+  }
+
+private:
+  struct chunk_data {
+    mesh msh;
+    std::vector<std::uint8_t> binary;
+  };
+
+  // Regenerate the chunks in dirty_, lane l taking every lanes'th one.
+  void regenerate() {
+    size_t num_lanes = std::max(std::min(lanes_.size(), dirty_.size()), (size_t)1);
+    auto fn = [&](size_t l) {
+      for (size_t d = l; d < dirty_.size(); d += num_lanes) generate_chunk(lanes_[l], dirty_[d]);
+    };
+    if (pool_) {
+      parallel_for(num_lanes, *pool_, fn);
+    } else {
+      for (size_t l = 0; l != num_lanes; ++l) fn(l);
+    }
+  }
+
+  void generate_chunk(mc_chunks::scratch &sc, size_t c) {
+    chunk_data &dest = chunks_[c];
+    dest.binary.clear();
+    if (!grid_.generate(sc, c, gradient_normals_, dest.msh)) return;
+    dest.binary = dest.msh.to_binary();
+  }
+
+  mc_chunks grid_;
+  bool gradient_normals_;
+  bool next_gradient_normals_;
+  std::vector<chunk_data> chunks_;
+  std::vector<size_t> dirty_;
+  std::unique_ptr<thread_pool> pool_;
+  std::vector<mc_chunks::scratch> lanes_;
+};
+
+}
+
+#endif
@@ -0,0 +1,583 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_BVH
+#define INCLUDED_GLSLMATH_BVH
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "math.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+
+namespace glslmath {
+
+/// Axis aligned box. The default box is empty, with lo above hi, so that extending it by anything works.
+struct aabb {
+  vec3 lo;
+  vec3 hi;
+
+  aabb() : lo(std::numeric_limits<float>::infinity()), hi(-std::numeric_limits<float>::infinity()) {
+  }
+
+  aabb(const vec3 &lo, const vec3 &hi) : lo(lo), hi(hi) {
+  }
+
+  bool empty() const { return !(lo.x() <= hi.x() && lo.y() <= hi.y() && lo.z() <= hi.z()); }
+
+  void extend(const vec3 &p) {
+    lo = min(lo, p);
+    hi = max(hi, p);
+  }
+
+  void extend(const aabb &b) {
+    lo = min(lo, b.lo);
+    hi = max(hi, b.hi);
+  }
+
+  vec3 center() const { return (lo + hi) * 0.5f; }
+  vec3 extent() const { return hi - lo; }
+
+  float surface_area() const {
+    if (empty()) return 0;
+    vec3 e = extent();
+    return 2 * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+  }
+
+  // squared distance from p to the box, zero inside.
+  float distance2(const vec3 &p) const {
+    vec3 d = max(max(lo - p, p - hi), vec3(0.0f));
+    return dot(d, d);
+  }
+};
+
+struct bounding_sphere {
+  vec3 center;
+  float radius;
+};
+
+/// Bounds of the xyz of every vertex; float3 data is scanned eight vertices per float8 packet.
+inline aabb compute_bounds(const attribute &pos) {
+  aabb result;
+  size_t n = pos.vertex_count(), i = 0;
+  if (pos.is_float() && pos.scalar_size() == 4 && pos.vector_elems() == 3 && n >= 8) {
+    const float *p = pos.elements<float>();
+    float8 lo[3], hi[3];
+    for (size_t c = 0; c != 3; ++c) {
+      lo[c] = float8(std::numeric_limits<float>::infinity());
+      hi[c] = float8(-std::numeric_limits<float>::infinity());
+    }
+    float lanes[3][8];
+    for (; i + 8 <= n; i += 8) {
+      for (size_t j = 0; j != 8; ++j) {
+        for (size_t c = 0; c != 3; ++c) lanes[c][j] = p[(i + j) * 3 + c];
+      }
+      for (size_t c = 0; c != 3; ++c) {
+        float8 v = float8::load(lanes[c]);
+        lo[c] = min(lo[c], v);
+        hi[c] = max(hi[c], v);
+      }
+    }
+    for (size_t c = 0; c != 3; ++c) {
+      float l = lo[c][0], h = hi[c][0];
+      for (size_t j = 1; j != 8; ++j) {
+        l = std::min(l, lo[c][j]);
+        h = std::max(h, hi[c][j]);
+      }
+      result.lo.set_elem(c, l);
+      result.hi.set_elem(c, h);
+    }
+  }
+  for (; i != n; ++i) result.extend(pos[i].xyz());
+  return result;
+}
+
+inline const attribute &position_attribute(const mesh &msh) {
+  size_t pos = msh.find_attribute("pos");
+  if (pos == mesh::bad_attr) throw(std::range_error("bounds: mesh has no pos attribute"));
+  return msh[pos];
+}
+
+inline aabb compute_bounds(const mesh &msh) {
+  return compute_bounds(position_attribute(msh));
+}
+
+/// One box per submesh.
+inline std::vector<aabb> compute_bounds(const multi_mesh &mm) {
+  std::vector<aabb> result;
+  result.reserve(mm.submeshes().size());
+  for (auto &m : mm.submeshes()) result.push_back(compute_bounds(m));
+  return result;
+}
+
+/// Sphere about the centre of the box; within a factor of sqrt(3) of the smallest.
+inline bounding_sphere compute_bounding_sphere(const mesh &msh) {
+  const attribute &pos = position_attribute(msh);
+  bounding_sphere result = { compute_bounds(pos).center(), 0.0f };
+  float r2 = 0;
+  for (size_t i = 0; i != pos.vertex_count(); ++i) {
+    vec3 d = pos[i].xyz() - result.center;
+    r2 = std::max(r2, dot(d, d));
+  }
+  result.radius = std::sqrt(r2);
+  return result;
+}
+
+/// Bounding volume hierarchy over the triangles of a mesh for ray and closest point queries.
+///
+/// Built top down with a binned surface area heuristic. Nodes are 32 bytes and siblings are adjacent.
+/// Subtrees below 4096 triangles are built in parallel; the result does not depend on the thread count.
+/// Triangle positions are copied in leaf order so that the mesh need not outlive the tree.
+class mesh_bvh {
+public:
+  struct node {
+    float lo[3];
+    std::uint32_t first; // first triangle slot of a leaf, or the left child; the right child follows it.
+    float hi[3];
+    std::uint32_t count; // triangles in a leaf, zero for an interior node.
+  };
+
+  static const std::uint32_t no_triangle = ~(std::uint32_t)0;
+
+  struct ray_hit {
+    float t;                 // distance along the ray in units of dir.
+    float u, v;              // barycentrics of corners 1 and 2.
+    std::uint32_t triangle;  // face index in the mesh, no_triangle for a miss.
+  };
+
+  struct closest_hit {
+    vec3 point;
+    float distance2;
+    std::uint32_t triangle;
+  };
+
+  mesh_bvh() {
+  }
+
+  explicit mesh_bvh(const mesh &src, size_t max_leaf=4, size_t num_threads=0) {
+    build(src, max_leaf, num_threads);
+  }
+
+  template <class Threads>
+  void build(const mesh &src, size_t max_leaf, Threads &&threads) {
+    const size_t block = 4096;
+    const attribute &pos = position_attribute(src);
+    const std::vector<mesh::index_type> &indices = src.indices();
+    size_t num_faces = indices.size() / 3;
+    for (auto i : indices) {
+      if (i >= pos.vertex_count()) throw(std::range_error("mesh_bvh: index out of range"));
+    }
+    max_leaf_ = std::max(max_leaf, (size_t)1);
+    nodes_.clear();
+    slots_.resize(num_faces);
+    prims_.resize(num_faces);
+    if (!num_faces) return;
+
+    parallel_for((num_faces + block - 1) / block, threads, [&](size_t b) {
+      for (size_t f = b * block, e = std::min(f + block, num_faces); f != e; ++f) {
+        prim &p = prims_[f];
+        p.box.clear();
+        for (size_t c = 0; c != 3; ++c) p.box.extend(pos[indices[f * 3 + c]]);
+        for (size_t k = 0; k != 3; ++k) p.centroid[k] = (p.box.lo[k] + p.box.hi[k]) * 0.5f;
+        p.face = (std::uint32_t)f;
+      }
+    });
+
+    // split the top of the tree here, leaving the small subtrees for the threads.
+    nodes_.push_back(node());
+    std::vector<task> stack(1, task{ 0, 0, (std::uint32_t)num_faces, 0 }), subtrees;
+    while (!stack.empty()) {
+      task t = stack.back();
+      stack.pop_back();
+      if (t.count <= block) {
+        subtrees.push_back(t);
+        continue;
+      }
+      split(t, nodes_, stack);
+    }
+
+    std::vector<std::vector<node>> local(subtrees.size());
+    parallel_for(subtrees.size(), threads, [&](size_t s) {
+      std::vector<node> &nodes = local[s];
+      std::vector<task> todo(1, task{ 0, subtrees[s].first, subtrees[s].count, subtrees[s].depth });
+      nodes.push_back(node());
+      while (!todo.empty()) {
+        task t = todo.back();
+        todo.pop_back();
+        split(t, nodes, todo);
+      }
+    });
+
+    // append each subtree, renumbering the children, and put its root in place.
+    for (size_t s = 0; s != subtrees.size(); ++s) {
+      std::uint32_t base = (std::uint32_t)nodes_.size() - 1;
+      for (size_t i = 0; i != local[s].size(); ++i) {
+        node n = local[s][i];
+        if (!n.count) n.first += base;
+        if (i == 0) {
+          nodes_[subtrees[s].node] = n;
+        } else {
+          nodes_.push_back(n);
+        }
+      }
+    }
+
+    verts_.resize(num_faces * 9);
+    parallel_for((num_faces + block - 1) / block, threads, [&](size_t b) {
+      for (size_t s = b * block, e = std::min(s + block, num_faces); s != e; ++s) {
+        slots_[s] = prims_[s].face;
+        for (size_t c = 0; c != 3; ++c) {
+          vec4 p = pos[indices[slots_[s] * 3 + c]];
+          for (size_t k = 0; k != 3; ++k) verts_[s * 9 + c * 3 + k] = p[k];
+        }
+      }
+    });
+    std::vector<prim>().swap(prims_);
+  }
+
+  const std::vector<node> &nodes() const { return nodes_; }
+
+  // face index in the mesh of each triangle slot.
+  const std::vector<std::uint32_t> &triangles() const { return slots_; }
+
+  aabb bounds() const {
+    if (nodes_.empty()) return aabb();
+    const node &n = nodes_[0];
+    return aabb(vec3(n.lo[0], n.lo[1], n.lo[2]), vec3(n.hi[0], n.hi[1], n.hi[2]));
+  }
+
+  /// Nearest triangle hit by origin + dir * t for 0 <= t < tmax, either side facing.
+  bool intersect(const vec3 &origin, const vec3 &dir, float tmax, ray_hit &hit) const {
+    hit.t = tmax;
+    hit.u = hit.v = 0;
+    hit.triangle = no_triangle;
+    float o[3] = { origin.x(), origin.y(), origin.z() };
+    float inv[3] = { 1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z() };
+    float tnear;
+    if (nodes_.empty() || !slab(nodes_[0], o, inv, hit.t, tnear)) return false;
+
+    entry stack[max_depth];
+    size_t sp = 0;
+    std::uint32_t ni = 0;
+    for (;;) {
+      const node &n = nodes_[ni];
+      if (n.count) {
+        for (std::uint32_t s = n.first; s != n.first + n.count; ++s) intersect_triangle(s, origin, dir, hit);
+      } else {
+        std::uint32_t near_child = n.first, far_child = n.first + 1;
+        float tn, tf;
+        bool hn = slab(nodes_[near_child], o, inv, hit.t, tn), hf = slab(nodes_[far_child], o, inv, hit.t, tf);
+        if (hn && hf) {
+          if (tf < tn) {
+            std::swap(near_child, far_child);
+            std::swap(tn, tf);
+          }
+          stack[sp++] = entry{ far_child, tf };
+          ni = near_child;
+          continue;
+        } else if (hn || hf) {
+          ni = hn ? near_child : far_child;
+          continue;
+        }
+      }
+      // skip boxes beyond a hit found since they were pushed.
+      while (sp && stack[sp - 1].key > hit.t) --sp;
+      if (!sp) break;
+      ni = stack[--sp].node;
+    }
+    return hit.triangle != no_triangle;
+  }
+
+  /// Closest point on any triangle to p within max_distance.
+  bool closest_point(const vec3 &p, float max_distance, closest_hit &hit) const {
+    hit.point = p;
+    hit.distance2 = max_distance * max_distance;
+    hit.triangle = no_triangle;
+    if (nodes_.empty() || box_distance2(nodes_[0], p) > hit.distance2) return false;
+
+    entry stack[max_depth];
+    size_t sp = 0;
+    std::uint32_t ni = 0;
+    for (;;) {
+      const node &n = nodes_[ni];
+      if (n.count) {
+        for (std::uint32_t s = n.first; s != n.first + n.count; ++s) {
+          const float *v = &verts_[s * 9];
+          vec3 q = closest_on_triangle(p, vec3(v[0], v[1], v[2]), vec3(v[3], v[4], v[5]), vec3(v[6], v[7], v[8]));
+          vec3 d = q - p;
+          float d2 = dot(d, d);
+          if (d2 < hit.distance2 || (d2 == hit.distance2 && hit.triangle == no_triangle)) {
+            hit.point = q;
+            hit.distance2 = d2;
+            hit.triangle = slots_[s];
+          }
+        }
+      } else {
+        std::uint32_t near_child = n.first, far_child = n.first + 1;
+        float dn = box_distance2(nodes_[near_child], p), df = box_distance2(nodes_[far_child], p);
+        if (df < dn) {
+          std::swap(near_child, far_child);
+          std::swap(dn, df);
+        }
+        if (dn <= hit.distance2) {
+          if (df <= hit.distance2) stack[sp++] = entry{ far_child, df };
+          ni = near_child;
+          continue;
+        }
+      }
+      while (sp && stack[sp - 1].key > hit.distance2) --sp;
+      if (!sp) break;
+      ni = stack[--sp].node;
+    }
+    return hit.triangle != no_triangle;
+  }
+
+private:
+  static const size_t num_bins = 16;
+  // beyond this depth nodes are halved, which bounds the tree depth for the query stacks.
+  static const std::uint32_t sah_depth = 48;
+  static const size_t max_depth = 128;
+
+  struct task {
+    std::uint32_t node;
+    std::uint32_t first;
+    std::uint32_t count;
+    std::uint32_t depth;
+  };
+
+  struct entry {
+    std::uint32_t node;
+    float key;
+  };
+
+  // plain float box for the build, cheaper than aabb in the inner loops.
+  struct box3 {
+    float lo[3];
+    float hi[3];
+
+    void clear() {
+      for (size_t c = 0; c != 3; ++c) {
+        lo[c] = std::numeric_limits<float>::infinity();
+        hi[c] = -std::numeric_limits<float>::infinity();
+      }
+    }
+
+    template <class V>
+    void extend(const V &p) {
+      for (size_t c = 0; c != 3; ++c) {
+        lo[c] = p[c] < lo[c] ? p[c] : lo[c];
+        hi[c] = p[c] > hi[c] ? p[c] : hi[c];
+      }
+    }
+
+    void extend(const box3 &b) {
+      for (size_t c = 0; c != 3; ++c) {
+        lo[c] = b.lo[c] < lo[c] ? b.lo[c] : lo[c];
+        hi[c] = b.hi[c] > hi[c] ? b.hi[c] : hi[c];
+      }
+    }
+
+    float surface_area() const {
+      float x = hi[0] - lo[0], y = hi[1] - lo[1], z = hi[2] - lo[2];
+      return x >= 0 ? 2 * (x * y + y * z + z * x) : 0;
+    }
+  };
+
+  // a triangle during the build, partitioned in place with its bounds.
+  struct prim {
+    box3 box;
+    float centroid[3];
+    std::uint32_t face;
+  };
+
+  // make t.node a leaf, or split its triangles in two and queue the children.
+  void split(const task &t, std::vector<node> &nodes, std::vector<task> &todo) {
+    prim *prims = prims_.data() + t.first;
+    box3 box, cbox;
+    box.clear();
+    cbox.clear();
+    for (std::uint32_t i = 0; i != t.count; ++i) {
+      box.extend(prims[i].box);
+      cbox.extend(prims[i].centroid);
+    }
+    node n;
+    for (size_t c = 0; c != 3; ++c) {
+      n.lo[c] = box.lo[c];
+      n.hi[c] = box.hi[c];
+    }
+    n.first = t.first;
+    n.count = t.count;
+
+    std::uint32_t mid = 0;
+    if (t.count > max_leaf_) {
+      // bin all three axes in one pass, with fewer bins for small nodes.
+      size_t nb = t.count < 64 ? num_bins / 2 : num_bins;
+      float scale[3];
+      box3 bins[3][num_bins];
+      std::uint32_t counts[3][num_bins] = {};
+      for (size_t a = 0; a != 3; ++a) {
+        float extent = cbox.hi[a] - cbox.lo[a];
+        scale[a] = extent > 0 ? nb / extent : 0;
+        for (size_t b = 0; b != nb; ++b) bins[a][b].clear();
+      }
+      if (t.depth < sah_depth) {
+        for (std::uint32_t i = 0; i != t.count; ++i) {
+          for (size_t a = 0; a != 3; ++a) {
+            size_t b = bin(prims[i].centroid[a], cbox.lo[a], scale[a], nb);
+            ++counts[a][b];
+            bins[a][b].extend(prims[i].box);
+          }
+        }
+      }
+
+      // cost of splitting before bin b is area(left) * count(left) + area(right) * count(right).
+      int axis = -1;
+      size_t best_bin = 0;
+      float best_cost = std::numeric_limits<float>::infinity();
+      for (int a = 0; a != 3 && t.depth < sah_depth; ++a) {
+        if (!(scale[a] > 0)) continue;
+        float right_cost[num_bins];
+        box3 right;
+        right.clear();
+        std::uint32_t right_count = 0;
+        for (size_t b = nb - 1; b != 0; --b) {
+          right.extend(bins[a][b]);
+          right_count += counts[a][b];
+          right_cost[b] = right.surface_area() * right_count;
+        }
+        box3 left;
+        left.clear();
+        std::uint32_t left_count = 0;
+        for (size_t b = 1; b != nb; ++b) {
+          left.extend(bins[a][b - 1]);
+          left_count += counts[a][b - 1];
+          if (!left_count || left_count == t.count) continue;
+          float cost = left.surface_area() * left_count + right_cost[b];
+          if (cost < best_cost) {
+            best_cost = cost;
+            axis = a;
+            best_bin = b;
+          }
+        }
+      }
+
+      // traversal costs about as much as one triangle test.
+      float area = box.surface_area();
+      bool worth_it = axis >= 0 && area + best_cost < area * t.count;
+      if (axis >= 0 && (worth_it || t.count > 4 * max_leaf_)) {
+        float lo = cbox.lo[axis], s = scale[axis];
+        mid = (std::uint32_t)(std::partition(prims, prims + t.count, [&](const prim &p) {
+          return bin(p.centroid[axis], lo, s, nb) < best_bin;
+        }) - prims);
+      } else if (t.count > 4 * max_leaf_ || (t.depth >= sah_depth && t.count > max_leaf_)) {
+        // no useful split: halve so that leaves stay small.
+        mid = t.count / 2;
+      }
+    }
+
+    if (mid) {
+      n.first = (std::uint32_t)nodes.size();
+      n.count = 0;
+      nodes.push_back(node());
+      nodes.push_back(node());
+      todo.push_back(task{ n.first + 1, t.first + mid, t.count - mid, t.depth + 1 });
+      todo.push_back(task{ n.first, t.first, mid, t.depth + 1 });
+    }
+    nodes[t.node] = n;
+  }
+
+  static size_t bin(float x, float lo, float scale, size_t nb) {
+    float b = (x - lo) * scale;
+    return b <= 0 ? 0 : std::min((size_t)b, nb - 1);
+  }
+
+  // entry distance of the ray into the box, if it is before tmax.
+  static bool slab(const node &n, const float *o, const float *inv, float tmax, float &tnear) {
+    float t0 = 0, t1 = tmax;
+    for (size_t c = 0; c != 3; ++c) {
+      float a = (n.lo[c] - o[c]) * inv[c], b = (n.hi[c] - o[c]) * inv[c];
+      if (a > b) std::swap(a, b);
+      t0 = a > t0 ? a : t0;
+      t1 = b < t1 ? b : t1;
+    }
+    tnear = t0;
+    return t0 <= t1;
+  }
+
+  static float box_distance2(const node &n, const vec3 &p) {
+    float d2 = 0;
+    for (size_t c = 0; c != 3; ++c) {
+      float d = std::max(std::max(n.lo[c] - p[c], p[c] - n.hi[c]), 0.0f);
+      d2 += d * d;
+    }
+    return d2;
+  }
+
+  // Moller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection", 1997.
+  void intersect_triangle(std::uint32_t s, const vec3 &origin, const vec3 &dir, ray_hit &hit) const {
+    const float *v = &verts_[s * 9];
+    vec3 a(v[0], v[1], v[2]);
+    vec3 e1 = vec3(v[3], v[4], v[5]) - a, e2 = vec3(v[6], v[7], v[8]) - a;
+    vec3 pv = cross(dir, e2);
+    float det = dot(e1, pv);
+    if (det == 0) return;
+    float rdet = 1.0f / det;
+    vec3 tv = origin - a;
+    float u = dot(tv, pv) * rdet;
+    if (u < 0 || u > 1) return;
+    vec3 qv = cross(tv, e1);
+    float w = dot(dir, qv) * rdet;
+    if (w < 0 || u + w > 1) return;
+    float t = dot(e2, qv) * rdet;
+    if (t >= 0 && t < hit.t) {
+      hit.t = t;
+      hit.u = u;
+      hit.v = w;
+      hit.triangle = slots_[s];
+    }
+  }
+
+  // Ericson, "Real-Time Collision Detection", 5.1.5. Degenerate triangles give a point on an edge.
+  static vec3 closest_on_triangle(const vec3 &p, const vec3 &a, const vec3 &b, const vec3 &c) {
+    vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) return a;
+    vec3 bp = p - b;
+    float d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) return b;
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 > d3 ? d1 / (d1 - d3) : 0.0f);
+    vec3 cp = p - c;
+    float d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) return c;
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 > d6 ? d2 / (d2 - d6) : 0.0f);
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+      float den = (d4 - d3) + (d5 - d6);
+      return b + (c - b) * (den > 0 ? (d4 - d3) / den : 0.0f);
+    }
+    float sum = va + vb + vc;
+    if (!(sum > 0)) return a;
+    return a + ab * (vb / sum) + ac * (vc / sum);
+  }
+
+  size_t max_leaf_ = 4;
+  std::vector<node> nodes_;
+  std::vector<std::uint32_t> slots_;
+  std::vector<float> verts_;
+  std::vector<prim> prims_;
+};
+
+}
+
+#endif
@@ -0,0 +1,490 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_LOD_MESHER
+#define INCLUDED_GLSLMATH_LOD_MESHER
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <vector>
+#include "math.hpp"
+#include "mesh.hpp"
+#include "marching_cubes.hpp"
+#include "parallel.hpp"
+
+namespace glslmath {
+
+/// One chunk of a lod_mesher octree: chunk_cubes cubes on each side at a spacing of 2^lod lattice points.
+struct lod_chunk {
+  ivec3 origin;
+  int lod;
+
+  // "pos" and "normal", empty if the surface misses the chunk. The last transition_indices
+  // indices are the transition triangles that join this chunk to finer neighbours.
+  mesh msh;
+  size_t transition_indices;
+};
+
+/// Multi-resolution marching cubes for large volumes.
+///
+/// The lattice is covered by an octree of chunks. Chunks nearer the focus than lod_distance times
+/// their width are split, down to lod 0 at the lattice resolution, so that far chunks are meshed at
+/// 2x, 4x and 8x the grid spacing and the triangle count follows the distance rather than the volume.
+/// The tree is balanced so that face neighbours differ by at most one lod.
+///
+/// Where a chunk meets finer neighbours, transition cells on its face join the two meshes without
+/// cracks, in the manner of Lengyel's Transvoxel. Each cell traces the fine contour through the 3x3
+/// fine samples and the coarse contour through the four corners with marching squares, links them
+/// along the sides of the cell into loops and fans the loops into triangles. Unlike Transvoxel the
+/// loops are traced rather than looked up in tables and the cells have no width: the coarse chunk is
+/// not shrunk, so the transition triangles lie in the chunk face.
+///
+/// Positions of shared vertices are computed the same way on both sides, so they match exactly.
+/// Normals come from the gradient of the full resolution lattice and match across chunks and lods.
+/// The lattice is assumed to have 2^max_lod * chunk_cubes + 1 points on a side, or a multiple of
+/// that; otherwise coarse chunks on the far faces of the lattice stop short of their fine neighbours.
+class lod_mesher {
+public:
+  // chunk_cubes is the edge of a chunk in cubes at its own lod and must be even.
+  // num_threads as for marching_cubes (zero for one per core).
+  explicit lod_mesher(size_t num_threads=1, int chunk_cubes=16)
+  : chunk_cubes_(chunk_cubes), x0_(0), y0_(0), z0_(0), grid_spacing_(1), values_(nullptr), max_lod_(0) {
+    if (chunk_cubes < 2 || (chunk_cubes & 1)) throw(std::range_error("lod_mesher: expected an even chunk size"));
+    dims_[0] = dims_[1] = dims_[2] = 0;
+    set_num_threads(num_threads);
+  }
+
+  void set_num_threads(size_t num_threads) {
+    if (num_threads == 0) num_threads = default_num_threads();
+    pool_.reset(num_threads > 1 ? new thread_pool(num_threads) : nullptr);
+    lanes_.resize(num_threads);
+  }
+
+  // Mesh a lattice as marching_cubes::generate would, with levels of detail around focus.
+  // focus is in the same units as the positions, ie. (x0 + i) * grid_spacing.
+  void generate(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, vec3 focus, int max_lod=3, float lod_distance=1.5f) {
+    x0_ = x0; y0_ = y0; z0_ = z0;
+    dims_[0] = xdim; dims_[1] = ydim; dims_[2] = zdim;
+    grid_spacing_ = grid_spacing;
+    values_ = mc_values;
+    max_lod_ = max_lod;
+    leaves_.clear();
+    interior_.clear();
+    chunks_.clear();
+    if (xdim < 2 || ydim < 2 || zdim < 2) return;
+
+    int root = chunk_cubes_ << max_lod;
+    for (int k = 0; k <= (zdim - 2) / root; ++k) {
+      for (int j = 0; j <= (ydim - 2) / root; ++j) {
+        for (int i = 0; i <= (xdim - 2) / root; ++i) {
+          build_node(node_key{{ max_lod, i, j, k }}, focus, lod_distance);
+        }
+      }
+    }
+    balance();
+
+    chunks_.resize(leaves_.size());
+    size_t c = 0;
+    for (auto &n : leaves_) {
+      int size = chunk_cubes_ << n[0];
+      chunks_[c].origin = ivec3(n[1] * size, n[2] * size, n[3] * size);
+      chunks_[c].lod = n[0];
+      chunks_[c].transition_indices = 0;
+      ++c;
+    }
+
+    size_t num_lanes = std::max(std::min(lanes_.size(), chunks_.size()), (size_t)1);
+    auto fn = [&](size_t l) {
+      for (size_t i = l; i < chunks_.size(); i += num_lanes) generate_chunk(lanes_[l], chunks_[i]);
+    };
+    if (pool_) {
+      parallel_for(num_lanes, *pool_, fn);
+    } else {
+      for (size_t l = 0; l != num_lanes; ++l) fn(l);
+    }
+  }
+
+  // All chunks in order of lod, then x, y and z, including empty ones.
+  const std::vector<lod_chunk> &chunks() const { return chunks_; }
+
+  // The non-empty chunks as submeshes named "lod<l>.<i>.<j>.<k>".
+  multi_mesh to_multi_mesh() const {
+    multi_mesh res;
+    for (auto &c : chunks_) {
+      if (!c.msh.indices().empty()) res.submeshes().push_back(c.msh);
+    }
+    return res;
+  }
+
+private:
+  // lod and position of an octree node in units of its own size.
+  typedef std::array<int, 4> node_key;
+
+  // Scratch for one worker.
+  struct lane {
+    lane() : mc(1) {}
+    marching_cubes mc;
+    std::vector<float> values;
+    std::vector<vec3> vertices;
+    std::vector<mesh::index_type> indices;
+    // transition vertices by lower lattice point, axis and step.
+    std::map<std::array<int, 5>, mesh::index_type> edge_vertices;
+  };
+
+  float value(const int *p) const {
+    return values_[((size_t)p[2] * dims_[1] + p[1]) * dims_[0] + p[0]];
+  }
+
+  float lod_spacing(int lod) const { return grid_spacing_ * (float)(1 << lod); }
+
+  vec3 chunk_offset(const int *origin) const {
+    return vec3((float)(x0_ + origin[0]), (float)(y0_ + origin[1]), (float)(z0_ + origin[2])) * grid_spacing_;
+  }
+
+  // points along axis a of a chunk at lod with this origin, as marching_cubes sees it.
+  int chunk_points(const int *origin, int lod, int a) const {
+    return std::min(chunk_cubes_, (dims_[a] - 1 - origin[a]) >> lod) + 1;
+  }
+
+  void build_node(node_key n, vec3 focus, float lod_distance) {
+    int size = chunk_cubes_ << n[0];
+    vec3 lo = vec3((float)(x0_ + n[1] * size), (float)(y0_ + n[2] * size), (float)(z0_ + n[3] * size)) * grid_spacing_;
+    vec3 hi = lo + vec3(size * grid_spacing_);
+    vec3 d = max(max(lo - focus, focus - hi), vec3(0));
+    if (n[0] == 0 || dot(d, d) >= sqr(lod_distance * size * grid_spacing_)) {
+      leaves_.insert(n);
+      return;
+    }
+    interior_.insert(n);
+    for (int c = 0; c != 8; ++c) {
+      node_key child = child_key(n, c);
+      if (inside(child)) build_node(child, focus, lod_distance);
+    }
+  }
+
+  static float sqr(float x) { return x * x; }
+
+  static node_key child_key(const node_key &n, int c) {
+    return node_key{{ n[0] - 1, n[1] * 2 + (c & 1), n[2] * 2 + ((c >> 1) & 1), n[3] * 2 + (c >> 2) }};
+  }
+
+  // true if the node has at least one cube of the lattice.
+  bool inside(const node_key &n) const {
+    int size = chunk_cubes_ << n[0];
+    return n[1] * size < dims_[0] - 1 && n[2] * size < dims_[1] - 1 && n[3] * size < dims_[2] - 1;
+  }
+
+  // the leaf containing a cube, or lod -1 if none.
+  node_key find_leaf(const int *cube) const {
+    for (int lod = 0; lod <= max_lod_; ++lod) {
+      int size = chunk_cubes_ << lod;
+      node_key n{{ lod, cube[0] / size, cube[1] / size, cube[2] / size }};
+      if (leaves_.count(n)) return n;
+    }
+    return node_key{{ -1, 0, 0, 0 }};
+  }
+
+  // Split leaves until no leaf has a face neighbour more than one lod coarser.
+  void balance() {
+    std::vector<node_key> queue(leaves_.begin(), leaves_.end());
+    while (!queue.empty()) {
+      node_key n = queue.back();
+      queue.pop_back();
+      if (!leaves_.count(n)) continue;
+      int size = chunk_cubes_ << n[0];
+      for (int f = 0; f != 6; ++f) {
+        int a = f >> 1;
+        int q[3] = { n[1] * size, n[2] * size, n[3] * size };
+        q[a] = (f & 1) ? q[a] + size : q[a] - 1;
+        if (q[a] < 0 || q[a] >= dims_[a] - 1) continue;
+        node_key m = find_leaf(q);
+        if (m[0] <= n[0] + 1) continue;
+        leaves_.erase(m);
+        interior_.insert(m);
+        for (int c = 0; c != 8; ++c) {
+          node_key child = child_key(m, c);
+          if (!inside(child)) continue;
+          leaves_.insert(child);
+          queue.push_back(child);
+        }
+        queue.push_back(n);
+      }
+    }
+  }
+
+  void generate_chunk(lane &ln, lod_chunk &ch) {
+    int o[3] = { ch.origin[0], ch.origin[1], ch.origin[2] };
+    int lod = ch.lod, step = 1 << lod;
+    int n[3] = { chunk_points(o, lod, 0), chunk_points(o, lod, 1), chunk_points(o, lod, 2) };
+    ln.vertices.clear();
+    ln.indices.clear();
+
+    // every step'th lattice point, noting whether the surface passes through them at all.
+    ln.values.resize((size_t)n[0] * n[1] * n[2]);
+    float lo = value(o), hi = lo;
+    float *v = ln.values.data();
+    for (int k = 0; k != n[2]; ++k) {
+      for (int j = 0; j != n[1]; ++j) {
+        int p[3] = { o[0], o[1] + j * step, o[2] + k * step };
+        const float *src = values_ + ((size_t)p[2] * dims_[1] + p[1]) * dims_[0] + p[0];
+        for (int i = 0; i != n[0]; ++i, src += step) {
+          *v++ = *src;
+          lo = std::min(lo, *src);
+          hi = std::max(hi, *src);
+        }
+      }
+    }
+    if (lo < 0 && hi >= 0) {
+      // gradient normals skip the face normal pass; they are replaced below.
+      ln.mc.set_gradient_normals(true);
+      ln.mc.generate(0, 0, 0, n[0], n[1], n[2], lod_spacing(lod), ln.values.data(), nullptr);
+      const mesh &src = ln.mc.get_mesh();
+      const attribute &pos = src[src.find_attribute("pos")];
+      vec3 offset = chunk_offset(o);
+      for (size_t i = 0; i != pos.vertex_count(); ++i) ln.vertices.push_back(pos[i].xyz() + offset);
+      ln.indices = src.indices();
+    }
+    size_t num_regular = ln.indices.size();
+
+    // transition cells where the neighbour across a face is split.
+    ln.edge_vertices.clear();
+    for (int f = 0; lod != 0 && f != 6; ++f) {
+      int a = f >> 1, side = f & 1;
+      int size = chunk_cubes_ << lod;
+      int q[3] = { o[0], o[1], o[2] };
+      q[a] = side ? o[a] + size : o[a] - 1;
+      if (q[a] < 0 || q[a] >= dims_[a] - 1) continue;
+      if (!interior_.count(node_key{{ lod, q[0] / size, q[1] / size, q[2] / size }})) continue;
+      add_transitions(ln, o, lod, a, side);
+    }
+    ch.transition_indices = ln.indices.size() - num_regular;
+
+    std::stringstream ns;
+    ns << "lod" << lod << "." << o[0] / (chunk_cubes_ << lod) << "." << o[1] / (chunk_cubes_ << lod) << "." << o[2] / (chunk_cubes_ << lod);
+    ch.msh = mesh(ns.str(), ln.vertices.size() <= 0x10000 ? 2 : 4);
+    if (ln.indices.empty()) return;
+    size_t pos_idx = ch.msh.add_attribute("pos"), normal_idx = ch.msh.add_attribute("normal");
+    attribute &pos = ch.msh[pos_idx];
+    attribute &normal = ch.msh[normal_idx];
+    pos.resize(ln.vertices.size());
+    normal.resize(ln.vertices.size());
+    vec3 origin((float)x0_, (float)y0_, (float)z0_);
+    for (size_t i = 0; i != ln.vertices.size(); ++i) {
+      vec3 p = ln.vertices[i];
+      vec3 g = marching_cubes::gradient_at(values_, dims_[0], dims_[1], dims_[2], p * (1.0f / grid_spacing_) - origin);
+      float len2 = dot(g, g);
+      pos.set(i, vec4(p, 1));
+      normal.set(i, vec4(len2 > 0 ? vec3(g * (-1.0f / std::sqrt(len2))) : vec3(1, 0, 0), 1));
+    }
+    ch.msh.indices() = ln.indices;
+  }
+
+  // Vertex on the lattice edge from point p along axis by step points, positioned exactly as
+  // marching_cubes places it in the chunk with this origin and lod.
+  mesh::index_type edge_vertex(lane &ln, const int *p, int axis, int step, const int *origin, int lod) {
+    std::array<int, 5> key{{ p[0], p[1], p[2], axis, step }};
+    auto it = ln.edge_vertices.find(key);
+    if (it != ln.edge_vertices.end()) return it->second;
+    int p1[3] = { p[0], p[1], p[2] };
+    p1[axis] += step;
+    float v0 = value(p), v1 = value(p1);
+    float lambda = v0 / (v0 - v1);
+    float local[3];
+    for (int a = 0; a != 3; ++a) {
+      int i = (p[a] - origin[a]) >> lod;
+      local[a] = a == axis ? i + lambda : (float)i;
+    }
+    mesh::index_type idx = (mesh::index_type)ln.vertices.size();
+    ln.vertices.push_back(vec3(local[0], local[1], local[2]) * lod_spacing(lod) + chunk_offset(origin));
+    ln.edge_vertices[key] = idx;
+    return idx;
+  }
+
+  // Transition cells on face (a, side) of a chunk whose neighbours across it are one lod finer.
+  void add_transitions(lane &ln, const int *o, int lod, int a, int side) {
+    int coarse = 1 << lod, fine = coarse >> 1;
+    int t1 = (a + 1) % 3, t2 = (a + 2) % 3;
+    int plane = side ? o[a] + (chunk_cubes_ << lod) : o[a];
+    int fine_size = chunk_cubes_ << (lod - 1);
+    int nu = chunk_points(o, lod, t1) - 1, nv = chunk_points(o, lod, t2) - 1;
+
+    // crossing ids 0-5 are the fine edges along t1 (row * 2 + column), 6-11 the fine edges along t2
+    // (column * 2 + row) and 12-15 the coarse edges at v = 0, v = 2, u = 0 and u = 2.
+    static const int lower[16][2] = {
+      {0, 0}, {1, 0}, {0, 1}, {1, 1}, {0, 2}, {1, 2},
+      {0, 0}, {0, 1}, {1, 0}, {1, 1}, {2, 0}, {2, 1},
+      {0, 0}, {0, 2}, {0, 0}, {2, 0},
+    };
+    // the fine squares then the coarse one, by lower corner.
+    static const int square_corners[5][2] = { {0, 0}, {1, 0}, {0, 1}, {1, 1}, {0, 0} };
+    // corners of a marching cubes cube and the lower corner and axis of each edge.
+    static const int cube_corners[8][3] = { {0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1} };
+    static const int edge_lower[12] = { 0, 1, 3, 0, 4, 5, 7, 4, 0, 1, 2, 3 };
+    static const int edge_axis[12] = { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 };
+    const char *triangles = marching_cubes::mc_triangles();
+    // sides of the cell: three samples and the fine, fine and coarse crossings along them.
+    static const int sides[4][6] = {
+      {0, 0, 1, 0, 0, 1}, {0, 2, 1, 0, 4, 5}, {0, 0, 0, 1, 6, 7}, {2, 0, 0, 1, 10, 11},
+    };
+    static const int side_coarse[4] = { 12, 13, 14, 15 };
+
+    for (int cv = 0; cv < nv; ++cv) {
+      for (int cu = 0; cu < nu; ++cu) {
+        int base[3];
+        base[a] = plane;
+        base[t1] = o[t1] + cu * coarse;
+        base[t2] = o[t2] + cv * coarse;
+
+        // the fine chunk on the other side, which must hold all nine samples.
+        int q[3] = { base[0], base[1], base[2] };
+        if (!side) q[a] = plane - 1;
+        int fo[3] = { q[0] / fine_size * fine_size, q[1] / fine_size * fine_size, q[2] / fine_size * fine_size };
+        if ((plane - fo[a]) / fine > chunk_points(fo, lod - 1, a) - 1) continue;
+        if ((base[t1] + 2 * fine - fo[t1]) / fine > chunk_points(fo, lod - 1, t1) - 1) continue;
+        if ((base[t2] + 2 * fine - fo[t2]) / fine > chunk_points(fo, lod - 1, t2) - 1) continue;
+
+        auto sample_point = [&](int u, int v, int *p) {
+          p[a] = plane;
+          p[t1] = base[t1] + u * fine;
+          p[t2] = base[t2] + v * fine;
+        };
+        float f[3][3];
+        int num_outside = 0;
+        for (int v = 0; v != 3; ++v) {
+          for (int u = 0; u != 3; ++u) {
+            int p[3];
+            sample_point(u, v, p);
+            f[v][u] = value(p);
+            num_outside += f[v][u] < 0;
+          }
+        }
+        if (num_outside == 0 || num_outside == 9) continue;
+        auto outside = [&](int u, int v) { return f[v][u] < 0; };
+
+        // the contour on the face is the edges of the triangles that marching cubes makes in the
+        // fine cubes and the coarse cube beside each square, so it matches both meshes exactly.
+        // Each segment runs against its triangle's edge.
+        int next[16], prev[16];
+        std::fill(next, next + 16, -1);
+        std::fill(prev, prev + 16, -1);
+        for (int s = 0; s != 5; ++s) {
+          int step = s == 4 ? coarse : fine;
+          int cube[3];
+          cube[a] = (s == 4) == (side == 1) ? plane - step : plane;
+          cube[t1] = base[t1] + square_corners[s][0] * fine;
+          cube[t2] = base[t2] + square_corners[s][1] * fine;
+          float cv8[8];
+          int cube_case = 0;
+          for (int c = 0; c != 8; ++c) {
+            int p[3] = { cube[0] + cube_corners[c][0] * step, cube[1] + cube_corners[c][1] * step, cube[2] + cube_corners[c][2] * step };
+            cv8[c] = value(p);
+            cube_case |= (cv8[c] < 0) << c;
+          }
+          auto crossing = [&](int e) {
+            if (edge_axis[e] == a || cube[a] + cube_corners[edge_lower[e]][a] * step != plane) return -1;
+            int u = (cube[t1] + cube_corners[edge_lower[e]][t1] * step - base[t1]) / fine;
+            int v = (cube[t2] + cube_corners[edge_lower[e]][t2] * step - base[t2]) / fine;
+            if (s != 4) return edge_axis[e] == t1 ? v * 2 + u : 6 + u * 2 + v;
+            return edge_axis[e] == t1 ? (v == 0 ? 12 : 13) : (u == 0 ? 14 : 15);
+          };
+          auto has_vertex = [&](int e) {
+            int c0 = edge_lower[e], c1 = c0;
+            for (int c = 0; c != 8; ++c) {
+              bool same = true;
+              for (int x = 0; x != 3; ++x) same = same && cube_corners[c][x] == cube_corners[c0][x] + (x == edge_axis[e]);
+              if (same) c1 = c;
+            }
+            return cv8[c0] * cv8[c1] < 0;
+          };
+          for (int off = cube_case * 16; triangles[off] != -1; off += 3) {
+            // marching cubes drops triangles with a missing vertex, as when a value is exactly zero.
+            if (!has_vertex(triangles[off]) || !has_vertex(triangles[off + 1]) || !has_vertex(triangles[off + 2])) continue;
+            for (int t = 0; t != 3; ++t) {
+              int from = crossing(triangles[off + t]), to = crossing(triangles[off + (t + 1) % 3]);
+              if (from < 0 || to < 0) continue;
+              next[to] = from;
+              prev[from] = to;
+            }
+          }
+        }
+
+        // join the fine and coarse crossings along the sides of the cell.
+        bool consistent = true;
+        for (int s = 0; s != 4; ++s) {
+          const int *sd = sides[s];
+          bool o0 = outside(sd[0], sd[1]), o1 = outside(sd[0] + sd[2], sd[1] + sd[3]), o2 = outside(sd[0] + 2 * sd[2], sd[1] + 2 * sd[3]);
+          int p = -1, r = -1;
+          if (o0 != o2) {
+            p = o0 != o1 ? sd[4] : sd[5];
+            r = side_coarse[s];
+          } else if (o0 != o1) {
+            p = sd[4];
+            r = sd[5];
+          } else {
+            continue;
+          }
+          if (next[p] == -1 && prev[r] == -1) {
+            next[p] = r;
+            prev[r] = p;
+          } else if (next[r] == -1 && prev[p] == -1) {
+            next[r] = p;
+            prev[p] = r;
+          } else {
+            consistent = false;
+          }
+        }
+        if (!consistent) continue;
+
+        // fan each loop from its first vertex.
+        bool visited[16] = {};
+        for (int start = 0; start != 16; ++start) {
+          if (next[start] == -1 || visited[start]) continue;
+          mesh::index_type loop[16];
+          int len = 0;
+          bool closed = false;
+          for (int c = start; c != -1 && !visited[c]; c = next[c]) {
+            visited[c] = true;
+            int p[3];
+            sample_point(lower[c][0], lower[c][1], p);
+            bool is_coarse = c >= 12;
+            int axis = c < 6 || c == 12 || c == 13 ? t1 : t2;
+            loop[len++] = is_coarse ? edge_vertex(ln, p, axis, coarse, o, lod) : edge_vertex(ln, p, axis, fine, fo, lod - 1);
+            closed = next[c] == start;
+          }
+          if (!closed) continue;
+          for (int i = 1; i + 1 < len; ++i) {
+            if (loop[0] == loop[i] || loop[i] == loop[i + 1] || loop[0] == loop[i + 1]) continue;
+            ln.indices.push_back(loop[0]);
+            ln.indices.push_back(loop[i]);
+            ln.indices.push_back(loop[i + 1]);
+          }
+        }
+      }
+    }
+  }
+
+  int chunk_cubes_;
+  int x0_, y0_, z0_;
+  int dims_[3];
+  float grid_spacing_;
+  const float *values_;
+  int max_lod_;
+  std::set<node_key> leaves_;
+  std::set<node_key> interior_;
+  std::vector<lod_chunk> chunks_;
+  std::unique_ptr<thread_pool> pool_;
+  std::vector<lane> lanes_;
+};
+
+}
+
+#endif
@@ -11,22 +11,202 @@
 
 #include "math.hpp"
 #include "mesh.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace glslmath {
 
+template <class Sink> class marching_cubes_stream;
+class lod_mesher;
+
+/// Min and max of the lattice values in each 8x8x8 brick, including the face shared with the next brick.
+/// A brick whose values are all negative or all non-negative generates no vertices or triangles,
+/// so marching_cubes skips it and the cost follows the surface rather than the volume.
+class mc_brick_index {
+public:
+  static const int shift = 3;
+  static const int brick_size = 1 << shift;
+
+  mc_brick_index() : xbricks_(0), ybricks_(0), zbricks_(0) {
+  }
+
+  mc_brick_index(int xdim, int ydim, int zdim, const float *values, size_t num_threads=1) {
+    build(xdim, ydim, zdim, values, num_threads);
+  }
+
+  void build(int xdim, int ydim, int zdim, const float *values, size_t num_threads=1) {
+    resize(xdim, ydim, zdim);
+    parallel_for((size_t)zbricks_, num_threads, [&](size_t bz) {
+      build_layer((int)bz, xdim, ydim, zdim, values);
+    });
+  }
+
+  // As above using the threads of an existing pool.
+  void build(int xdim, int ydim, int zdim, const float *values, thread_pool &pool) {
+    resize(xdim, ydim, zdim);
+    parallel_for((size_t)zbricks_, pool, [&](size_t bz) {
+      build_layer((int)bz, xdim, ydim, zdim, values);
+    });
+  }
+
+  int xbricks() const { return xbricks_; }
+  int ybricks() const { return ybricks_; }
+  int zbricks() const { return zbricks_; }
+
+  size_t index(int bx, int by, int bz) const { return ((size_t)bz * ybricks_ + by) * xbricks_ + bx; }
+  float min_value(int bx, int by, int bz) const { return min_[index(bx, by, bz)]; }
+  float max_value(int bx, int by, int bz) const { return max_[index(bx, by, bz)]; }
+  bool active(int bx, int by, int bz) const { return active_[index(bx, by, bz)] != 0; }
+
+  // active flags for the bricks along x and whether any of them is active.
+  const std::uint8_t *row(int by, int bz) const { return &active_[index(0, by, bz)]; }
+  bool row_active(int by, int bz) const { return row_active_[(size_t)bz * ybricks_ + by] != 0; }
+
+  size_t active_count() const { return (size_t)std::count(active_.begin(), active_.end(), 1); }
+private:
+  void resize(int xdim, int ydim, int zdim) {
+    xbricks_ = (xdim + brick_size - 1) >> shift;
+    ybricks_ = (ydim + brick_size - 1) >> shift;
+    zbricks_ = (zdim + brick_size - 1) >> shift;
+    size_t num_bricks = (size_t)xbricks_ * ybricks_ * zbricks_;
+    min_.resize(num_bricks);
+    max_.resize(num_bricks);
+    active_.resize(num_bricks);
+    row_active_.resize((size_t)ybricks_ * zbricks_);
+  }
+
+  // Min/max of the bricks in one z layer of bricks.
+  void build_layer(int bz, int xdim, int ydim, int zdim, const float *values) {
+    for (int by = 0; by != ybricks_; ++by) {
+      bool any = false;
+      for (int bx = 0; bx != xbricks_; ++bx) {
+        int i0 = bx << shift, j0 = by << shift, k0 = bz << shift;
+        int i1 = std::min(i0 + brick_size, xdim - 1);
+        int j1 = std::min(j0 + brick_size, ydim - 1);
+        int k1 = std::min(k0 + brick_size, zdim - 1);
+        float lo = values[(k0 * ydim + j0) * xdim + i0];
+        float hi = lo;
+        for (int k = k0; k <= k1; ++k) {
+          for (int j = j0; j <= j1; ++j) {
+            const float *row = values + (k * ydim + j) * xdim;
+            for (int i = i0; i <= i1; ++i) {
+              lo = std::min(lo, row[i]);
+              hi = std::max(hi, row[i]);
+            }
+          }
+        }
+        size_t b = index(bx, by, bz);
+        min_[b] = lo;
+        max_[b] = hi;
+        active_[b] = lo < 0 && hi >= 0;
+        any = any || active_[b];
+      }
+      row_active_[(size_t)bz * ybricks_ + by] = any;
+    }
+  }
+
+  int xbricks_, ybricks_, zbricks_;
+  std::vector<float> min_;
+  std::vector<float> max_;
+  std::vector<std::uint8_t> active_;
+  std::vector<std::uint8_t> row_active_;
+};
+
+/// Whole-row kernels for the marching cubes passes.
+/// Each is a plain loop over contiguous rows so that the compiler turns it into SIMD code,
+/// and the skip functions test eight cells per step so that empty runs cost little.
+struct mc_rows {
+  // s[i] = 1 if v[i] is outside the surface.
+  static void signs(const float *v, std::uint8_t *s, int n) {
+    for (int i = 0; i < n; ++i) s[i] = v[i] < 0;
+  }
+
+  // Case index of the n cubes along a row from the signs of four rows of corners:
+  // s00 (j, k), s01 (j+1, k), s10 (j, k+1), s11 (j+1, k+1), each n+1 long.
+  static void cases(const std::uint8_t *s00, const std::uint8_t *s01, const std::uint8_t *s10, const std::uint8_t *s11, std::uint8_t *c, int n) {
+    for (int i = 0; i < n; ++i) {
+      c[i] = (std::uint8_t)(
+        s00[i] | s00[i+1] << 1 | s01[i+1] << 2 | s01[i] << 3 |
+        s10[i] << 4 | s10[i+1] << 5 | s11[i+1] << 6 | s11[i] << 7
+      );
+    }
+  }
+
+  // c[i] |= bit where a[i] and b[i] have opposite signs, using the same a * b < 0 test as the scalar code.
+  static void crossings(const float *a, const float *b, std::uint8_t bit, std::uint8_t *c, int n) {
+    for (int i = 0; i < n; ++i) c[i] |= a[i] * b[i] < 0 ? bit : 0;
+  }
+
+  // First i >= from with c[i] not 0 (and not 0xff if skip_full), or n.
+  static int next(const std::uint8_t *c, int from, int n, bool skip_full) {
+    int i = from;
+    for (;;) {
+      for (; i + 8 <= n; i += 8) {
+        std::uint64_t w;
+        memcpy(&w, c + i, 8);
+        if (w != 0 && !(skip_full && w == ~(std::uint64_t)0)) break;
+      }
+      if (i >= n) return n;
+      if (c[i] != 0 && !(skip_full && c[i] == 0xff)) return i;
+      ++i;
+    }
+  }
+};
+
 /// Helper to construct marching cubes meshes.
+/// A marching_cubes object can be kept and generate() called again for each new volume.
+/// The scratch buffers, the worker threads and the mesh keep their capacity between calls,
+/// so remeshing volumes of a similar size does no heap allocation once it has warmed up.
 class marching_cubes {
 public:
-
+  // An empty mesher for use with generate(). num_threads as for the constructor below.
+  explicit marching_cubes(size_t num_threads=1) : gradient_normals_(false) {
+    set_num_threads(num_threads);
+  }
 
   // Given a 3D lattice of values (mc_values) generate triangles where values transition from positive to negative.
-  marching_cubes(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours) {
+  // With num_threads != 1 the lattice is split into z-slabs that are processed in parallel (zero for one thread per core).
+  // The slabs are merged in lattice order so the mesh is identical whatever the thread count.
+  marching_cubes(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours, size_t num_threads=1) : gradient_normals_(false) {
+    set_num_threads(num_threads);
+    generate(x0, y0, z0, xdim, ydim, zdim, grid_spacing, mc_values, mc_colours);
+  }
+
+  void set_num_threads(size_t num_threads) {
+    if (num_threads == 0) num_threads = default_num_threads();
+    num_threads_ = num_threads;
+    pool_.reset(num_threads > 1 ? new thread_pool(num_threads) : nullptr);
+  }
+
+  // Take vertex normals from the central-difference gradient of mc_values as each vertex is created
+  // instead of summing face normals over the finished triangles. These are smoother and cost no extra pass.
+  void set_gradient_normals(bool enable) {
+    gradient_normals_ = enable;
+  }
+
+  // Replace the mesh with the surface of a new lattice, reusing all buffers.
+  // If mc_colours is not null the mesh gets a "colour" attribute interpolated from the lattice colours.
+  void generate(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours) {
     using namespace glslmath;
+    GLSLMATH_STATS_SCOPE("marching_cubes.generate");
 
-    size_t pos_idx = msh_.add_attribute("pos", 3, sizeof(float), true, false);
+    // Attributes are pos, normal and optionally colour, in that order.
+    if ((msh_.find_attribute("colour") != mesh::bad_attr) != (mc_colours != nullptr)) msh_ = mesh();
+    size_t pos_idx = msh_.find_attribute("pos");
+    if (pos_idx == mesh::bad_attr) pos_idx = msh_.add_attribute("pos", 3, sizeof(float), true, false);
+    size_t normal_idx = msh_.find_attribute("normal");
+    if (normal_idx == mesh::bad_attr) normal_idx = msh_.add_attribute("normal");
+    size_t colour_idx = mesh::bad_attr;
+    if (mc_colours) {
+      colour_idx = msh_.find_attribute("colour");
+      if (colour_idx == mesh::bad_attr) colour_idx = msh_.add_attribute("colour", 4);
+    }
+    msh_.clear();
     attribute &pos = msh_.attributes()[pos_idx];
-    size_t pos_size = 0;
+    attribute &normal = msh_.attributes()[normal_idx];
     
     //float rgs = 1.0f / grid_spacing;
 
@@ -40,8 +220,221 @@ public:
 
     // Now build the marching cubes triangles.
     // Each cube owns three edges 0->1 0->3 0->4
-    std::vector<int> edge_indices(xdim*ydim*zdim*3);
+    std::vector<int> &edge_indices = edge_indices_;
+    edge_indices.assign((size_t)xdim*ydim*zdim*3, -1);
+
+    size_t num_slabs = std::min((size_t)zdim, num_threads_ == 1 ? 1 : num_threads_ * 4);
+    std::vector<slab> &slabs = slabs_;
+    if (slabs.size() < num_slabs) slabs.resize(num_slabs);
+    for (size_t s = 0; s != num_slabs; ++s) {
+      slabs[s].k0 = (int)(s * zdim / num_slabs);
+      slabs[s].k1 = (int)((s + 1) * zdim / num_slabs);
+      slabs[s].vertices.clear();
+      slabs[s].normals.clear();
+      slabs[s].colours.clear();
+      slabs[s].indices.clear();
+    }
+
+    // Bricks with no sign change are skipped in both passes.
+    if (pool_) {
+      bricks_.build(xdim, ydim, zdim, mc_values, *pool_);
+    } else {
+      bricks_.build(xdim, ydim, zdim, mc_values, 1);
+    }
+
+    // Vertices for each slab with slab-local indices in edge_indices.
+    run(num_slabs, [&](size_t s) {
+      edge_pass(slabs[s], x0, y0, z0, xdim, ydim, zdim, grid_spacing, mc_values, mc_colours, gradient_normals_, bricks_, edge_indices.data());
+    });
+
+    // Prefix sum of the vertex counts gives each slab its first vertex.
+    size_t num_vertices = 0;
+    for (size_t s = 0; s != num_slabs; ++s) {
+      slabs[s].first_vertex = num_vertices;
+      num_vertices += slabs[s].vertices.size();
+    }
+    pos.resize(num_vertices);
+    if (gradient_normals_) normal.resize(num_vertices);
+    if (mc_colours) msh_.attributes()[colour_idx].resize(num_vertices);
+
+    run(num_slabs, [&](size_t s) {
+      const slab &sl = slabs[s];
+      int *e = edge_indices.data() + (size_t)sl.k0 * xdim * ydim * 3;
+      int *end = edge_indices.data() + (size_t)sl.k1 * xdim * ydim * 3;
+      for (; e != end; ++e) {
+        if (*e >= 0) *e += (int)sl.first_vertex;
+      }
+      for (size_t i = 0; i != sl.vertices.size(); ++i) {
+        pos.set(sl.first_vertex + i, vec4(sl.vertices[i], 1));
+      }
+      for (size_t i = 0; i != sl.normals.size(); ++i) {
+        normal.set(sl.first_vertex + i, vec4(sl.normals[i], 1));
+      }
+      for (size_t i = 0; i != sl.colours.size(); ++i) {
+        msh_.attributes()[colour_idx].set(sl.first_vertex + i, sl.colours[i]);
+      }
+    });
+
+    // Triangles for each cube layer below the top of the lattice.
+    run(num_slabs, [&](size_t s) {
+      triangle_pass(slabs[s], xdim, ydim, zdim, mc_values, bricks_, edge_indices.data());
+    });
+
+    size_t num_indices = 0;
+    for (size_t s = 0; s != num_slabs; ++s) num_indices += slabs[s].indices.size();
+    std::vector<mesh::index_type> &indices = msh_.indices();
+    indices.reserve(num_indices);
+    for (size_t s = 0; s != num_slabs; ++s) {
+      indices.insert(indices.end(), slabs[s].indices.begin(), slabs[s].indices.end());
+    }
+    GLSLMATH_STATS_COUNT(vertices, num_vertices);
+    GLSLMATH_STATS_COUNT(triangles, num_indices / 3);
+
+    if (!gradient_normals_) {
+      if (pool_) {
+        msh_.compute_normals(normal_idx, normals_, mesh::area_weighted, *pool_);
+      } else {
+        msh_.compute_normals(normal_idx, normals_, mesh::area_weighted, 1);
+      }
+    }
+  }
+  
+  const mesh &get_mesh() const { return msh_; }
+
+  // Trilinear blend of the lattice gradients around a point in lattice coordinates, for normals that
+  // do not depend on how the lattice was divided. On a lattice edge this is the mix of the two end
+  // gradients that generate() uses for gradient normals.
+  static vec3 gradient_at(const float *mc_values, int xdim, int ydim, int zdim, vec3 p) {
+    int lat[3];
+    float t[3];
+    int dims[3] = { xdim, ydim, zdim };
+    for (int a = 0; a != 3; ++a) {
+      float f = std::floor(p[a]);
+      lat[a] = std::min(std::max((int)f, 0), dims[a] - 2);
+      t[a] = std::min(std::max(p[a] - lat[a], 0.0f), 1.0f);
+    }
+    vec3 g(0);
+    for (int corner = 0; corner != 8; ++corner) {
+      int dx = corner & 1, dy = (corner >> 1) & 1, dz = corner >> 2;
+      float w = (dx ? t[0] : 1 - t[0]) * (dy ? t[1] : 1 - t[1]) * (dz ? t[2] : 1 - t[2]);
+      if (w != 0) g = g + gradient(mc_values, xdim, ydim, zdim, lat[0] + dx, lat[1] + dy, lat[2] + dz) * w;
+    }
+    return g;
+  }
+
+private:
+  template <class Sink> friend class marching_cubes_stream;
+  friend class lod_mesher;
+
+  mesh msh_;
+
+  // A range of z layers [k0, k1) of the lattice and the vertices and triangles it generated.
+  // The row buffers are scratch space for the passes.
+  struct slab {
+    int k0;
+    int k1;
+    size_t first_vertex;
+    std::vector<vec3> vertices;
+    std::vector<vec3> normals;
+    std::vector<vec4> colours;
+    std::vector<mesh::index_type> indices;
+    std::vector<std::uint8_t> flags;
+    std::vector<std::uint8_t> signs[4];
+    std::vector<std::uint8_t> cases;
+  };
+
+  template <class F>
+  void run(size_t count, F fn) {
+    if (pool_) {
+      parallel_for(count, *pool_, fn);
+    } else {
+      for (size_t i = 0; i != count; ++i) fn(i);
+    }
+  }
+
+  size_t num_threads_;
+  std::unique_ptr<thread_pool> pool_;
+  std::vector<int> edge_indices_;
+  std::vector<slab> slabs_;
+  mc_brick_index bricks_;
+  mesh::normal_scratch normals_;
+  bool gradient_normals_;
+
+  // Generate the vertices on the three edges owned by each lattice point in the slab.
+  static void edge_pass(slab &sl, int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, const float *mc_values, const vec4 *mc_colours, bool gradient_normals, const mc_brick_index &bricks, int *edge_indices) {
+    const int shift = mc_brick_index::shift;
+    const int last = mc_brick_index::brick_size - 1;
+    // Normal and colour of a vertex a fraction lambda along the edge from point idx to idx1 at (i1, j1, k1).
+    auto interpolate = [&](int i, int j, int k, int idx, int i1, int j1, int k1, int idx1, float lambda) {
+      if (gradient_normals) {
+        vec3 g = mix(gradient(mc_values, xdim, ydim, zdim, i, j, k), gradient(mc_values, xdim, ydim, zdim, i1, j1, k1), lambda);
+        // values are positive inside so the outward normal points down the gradient.
+        float len2 = dot(g, g);
+        sl.normals.push_back(len2 > 0 ? vec3(g * (-1.0f / std::sqrt(len2))) : vec3(1, 0, 0));
+      }
+      if (mc_colours) {
+        sl.colours.push_back(mix(mc_colours[idx], mc_colours[idx1], lambda));
+      }
+    };
+    // bit 0, 1, 2 set for points with a crossing on their x, y, z edge.
+    std::vector<std::uint8_t> &flags = sl.flags;
+    flags.resize(xdim);
+    for (int k = sl.k0; k != sl.k1; ++k) {
+      for (int j = 0; j != ydim; ++j) {
+        if (!bricks.row_active(j >> shift, k >> shift)) { j = std::min(j | last, ydim - 1); continue; }
+        int row = (k * ydim + j) * xdim;
+        const float *v = mc_values + row;
+        std::fill(flags.begin(), flags.end(), 0);
+        mc_rows::crossings(v, v + 1, 1, flags.data(), xdim - 1);
+        if (j != ydim-1) mc_rows::crossings(v, v + xdim, 2, flags.data(), xdim);
+        if (k != zdim-1) mc_rows::crossings(v, v + xdim*ydim, 4, flags.data(), xdim);
+
+        for (int i = mc_rows::next(flags.data(), 0, xdim, false); i != xdim; i = mc_rows::next(flags.data(), i + 1, xdim, false)) {
+          int idx = row + i;
+          float v0 = mc_values [idx];
+          // x edges
+          if (flags[i] & 1) {
+            float v1 = mc_values [idx + 1];
+            float lambda = v0 / (v0 - v1);
+            edge_indices[idx*3+0] = (int)sl.vertices.size();
+            sl.vertices.push_back(vec3(float(x0 + i + lambda), float(y0 + j), float(z0 + k)) * grid_spacing);
+            interpolate(i, j, k, idx, i + 1, j, k, idx + 1, lambda);
+          }
+
+          // y edges
+          if (flags[i] & 2) {
+            float v1 = mc_values [idx + xdim];
+            float lambda = v0 / (v0 - v1);
+            edge_indices[idx*3+1] = (int)sl.vertices.size();
+            sl.vertices.push_back(vec3(float(x0 + i), float(y0 + j + lambda), float(z0 + k)) * grid_spacing);
+            interpolate(i, j, k, idx, i, j + 1, k, idx + xdim, lambda);
+          }
+
+          // z edges
+          if (flags[i] & 4) {
+            float v1 = mc_values [idx + xdim*ydim];
+            float lambda = v0 / (v0 - v1);
+            edge_indices[idx*3+2] = (int)sl.vertices.size();
+            sl.vertices.push_back(vec3(x0 + i, y0 + j, z0 + k + lambda) * grid_spacing);
+            interpolate(i, j, k, idx, i, j, k + 1, idx + xdim*ydim, lambda);
+          }
+        }
+      }
+    }
+  }
 
+  // Central-difference gradient of the lattice at a point, one-sided on the faces of the lattice.
+  static vec3 gradient(const float *mc_values, int xdim, int ydim, int zdim, int i, int j, int k) {
+    size_t sx = 1, sy = xdim, sz = (size_t)xdim * ydim;
+    const float *p = mc_values + k * sz + j * sy + i;
+    float gx = ((i != xdim-1 ? p[sx] : p[0]) - (i != 0 ? p[-(ptrdiff_t)sx] : p[0])) / float(std::max((i != xdim-1) + (i != 0), 1));
+    float gy = ((j != ydim-1 ? p[sy] : p[0]) - (j != 0 ? p[-(ptrdiff_t)sy] : p[0])) / float(std::max((j != ydim-1) + (j != 0), 1));
+    float gz = ((k != zdim-1 ? p[sz] : p[0]) - (k != 0 ? p[-(ptrdiff_t)sz] : p[0])) / float(std::max((k != zdim-1) + (k != 0), 1));
+    return vec3(gx, gy, gz);
+  }
+
+  // Emit the triangles of the cubes whose lower corner is in the slab.
+  static void triangle_pass(slab &sl, int xdim, int ydim, int zdim, const float *mc_values, const mc_brick_index &bricks, const int *edge_indices) {
     // We store three indices per cube for the edges closest to vertex 0
     // All other indices can be derived from adjacent cubes.
     // This gives a single index offset value for each edge.
@@ -63,106 +456,66 @@ public:
       1*dx+1*dy+0*dz+2,  // 2,6,
       0*dx+1*dy+0*dz+2,  // 3,7
     };
-        
-    // two passes for vertices (pass = 0 sizes the array)
-    for (size_t i = 0; i != edge_indices.size(); ++i) {
-      edge_indices [i] = -1;
-    }
-
-    for (int k = 0; k != zdim; ++k) {
-      for (int j = 0; j != ydim; ++j) {
-        for (int i = 0; i != xdim; ++i) {
-          int idx = (k * ydim + j) * xdim + i;
-          float v0 = mc_values [idx];
-          // x edges
-          if (i != xdim-1) {
-            float v1 = mc_values [idx + 1];
-            if (v0 * v1 < 0) {
-              float lambda = v0 / (v0 - v1);
-              edge_indices[idx*3+0] = (int)pos_size++;
-              pos.push(vec3(float(x0 + i + lambda), float(y0 + j), float(z0 + k)) * grid_spacing);
-              //vertices.push_back(vec3(float(x0 + i + lambda), float(y0 + j), float(z0 + k)) * grid_spacing);
-              //normals.push_back(vec3::lerp (mc_normals[idx], mc_normals[idx+1], lambda).normalised());
-              //colours.push_back(mix (mc_colours[idx], mc_colours[idx+1], lambda));
-            }
-          }
-
-          // y edges
-          if (j != ydim-1) {
-            float v1 = mc_values [idx + xdim];
-            if (v0 * v1 < 0) {
-              float lambda = v0 / (v0 - v1);
-              edge_indices[idx*3+1] = (int)pos_size++;
-              pos.push(vec3(float(x0 + i), float(y0 + j + lambda), float(z0 + k)) * grid_spacing);
-              //vertices.push_back(vec3(float(x0 + i), float(y0 + j + lambda), float(z0 + k)) * grid_spacing);
-              //normals.push_back(vec3::lerp (mc_normals[idx], mc_normals[idx+xdim], lambda).normalised());
-              //colours.push_back(mix (mc_colours[idx], mc_colours[idx+xdim], lambda));
-            }
-          }
 
-          // z edges
-          if (k != zdim-1) {
-            float v1 = mc_values [idx + xdim*ydim];
-            if (v0 * v1 < 0) {
-              float lambda = v0 / (v0 - v1);
-              edge_indices[idx*3+2] = (int)pos_size++;
-              pos.push(vec3(x0 + i, y0 + j, z0 + k + lambda) * grid_spacing);
-              //vertices.push_back(vec3(x0 + i, y0 + j, z0 + k + lambda) * grid_spacing);
-              //normals.push_back(vec3::lerp (mc_normals[idx], mc_normals[idx+xdim*ydim], lambda).normalised());
-              //colours.push_back(mix (mc_colours[idx], mc_colours[idx+xdim*ydim], lambda));
-            }
-          }
-        }
-      }
-    }
+    // Signs of the corner rows at (j, k), (j+1, k), (j, k+1) and (j+1, k+1).
+    // Moving to the next j reuses the j+1 rows so each value is classified about twice rather than eight times.
+    std::vector<std::uint8_t> *signs = sl.signs;
+    for (int s = 0; s != 4; ++s) signs[s].resize(xdim);
+    std::vector<std::uint8_t> &cases = sl.cases;
+    cases.resize(xdim);
 
     // loop over all cubes
-    for (int k = 0; k != zdim-1; ++k) {
+    int k1 = std::min(sl.k1, zdim-1);
+    const int shift = mc_brick_index::shift;
+    const int last = mc_brick_index::brick_size - 1;
+    const char *triangles = mc_triangles();
+    std::uint64_t visited = 0, active = 0;
+    for (int k = sl.k0; k < k1; ++k) {
+      int signs_j = -2;
       for (int j = 0; j != ydim-1; ++j) {
-        for (int i = 0; i != xdim-1; ++i) {
-          int idx = (k * ydim + j) * xdim + i;
-          //vec3 pos0 = new vec3 (x0 + i, y0 + j, z0 + k);
-
-          // Mask of vertices outside the isosurface (values are negative)
-          // Example:
-          //   00000001 means only vertex 0 is outside the surface.
-          //   10000000 means only vertex 7 is outside the surface.
-          //   11111111 all vertices are outside the surface.
-          int mask =
-            (mc_values [idx] < 0 ? 1 << 0 : 0) |
-            (mc_values [idx + 1] < 0 ? 1 << 1 : 0) |
-            (mc_values [idx + 1 + xdim] < 0 ? 1 << 2 : 0) |
-            (mc_values [idx + xdim] < 0 ? 1 << 3 : 0) |
-          
-            (mc_values [idx + xdim * ydim] < 0 ? 1 << 4 : 0) |
-            (mc_values [idx + 1 + xdim * ydim] < 0 ? 1 << 5 : 0) |
-            (mc_values [idx + 1 + xdim + xdim * ydim] < 0 ? 1 << 6 : 0) |
-            (mc_values [idx + xdim + xdim * ydim] < 0 ? 1 << 7 : 0
-          );
-
-          int off = mask * 16;
-          const char *triangles = mc_triangles();
+        if (!bricks.row_active(j >> shift, k >> shift)) { j = std::min(j | last, ydim - 2); continue; }
+        int row = (k * ydim + j) * xdim;
+        if (signs_j == j - 1) {
+          signs[0].swap(signs[1]);
+          signs[2].swap(signs[3]);
+        } else {
+          mc_rows::signs(mc_values + row, signs[0].data(), xdim);
+          mc_rows::signs(mc_values + row + xdim * ydim, signs[2].data(), xdim);
+        }
+        mc_rows::signs(mc_values + row + xdim, signs[1].data(), xdim);
+        mc_rows::signs(mc_values + row + xdim + xdim * ydim, signs[3].data(), xdim);
+        signs_j = j;
+
+        // Mask of vertices outside the isosurface (values are negative)
+        // Example:
+        //   00000001 means only vertex 0 is outside the surface.
+        //   10000000 means only vertex 7 is outside the surface.
+        //   11111111 all vertices are outside the surface.
+        mc_rows::cases(signs[0].data(), signs[1].data(), signs[2].data(), signs[3].data(), cases.data(), xdim - 1);
+        visited += xdim - 1;
+
+        // cases 0 and 255 have no triangles.
+        for (int i = mc_rows::next(cases.data(), 0, xdim - 1, true); i != xdim - 1; i = mc_rows::next(cases.data(), i + 1, xdim - 1, true)) {
+          int idx = row + i;
+          int off = cases[i] * 16;
+          ++active;
           while (triangles[off] != -1) {
             int i0 = edge_indices [idx*3 + edge_offsets [(int)triangles [off + 0]]];
             int i1 = edge_indices [idx*3 + edge_offsets [(int)triangles [off + 1]]];
             int i2 = edge_indices [idx*3 + edge_offsets [(int)triangles [off + 2]]];
             if (i0 >= 0 && i1 >= 0 && i2 >= 0) {
-              msh_.push_index(i0);
-              msh_.push_index(i1);
-              msh_.push_index(i2);
+              sl.indices.push_back(i0);
+              sl.indices.push_back(i1);
+              sl.indices.push_back(i2);
             }
             off += 3;
           }
         }
       }
     }
-    msh_.generate_normals();
+    GLSLMATH_STATS_COUNT(cells_visited, visited);
+    GLSLMATH_STATS_COUNT(active_cells, active);
   }
-  
-  const mesh &get_mesh() const { return msh_; }
-
-private:
-  mesh msh_;
 
   static const char *mc_triangles() {
     // marching cubes edge lists
@@ -429,6 +782,197 @@ private:
   }
 };
 
+/// Sink for marching_cubes_stream that appends to a mesh with a "pos" attribute.
+class mesh_sink {
+public:
+  mesh_sink(mesh &msh) : msh_(msh) {
+    pos_attr_ = msh_.find_attribute("pos");
+    if (pos_attr_ == mesh::bad_attr) pos_attr_ = msh_.add_attribute("pos", 3, sizeof(float), true, false);
+  }
+
+  void vertex(const vec3 &pos) { msh_[pos_attr_].push(pos); }
+
+  void triangle(mesh::index_type i0, mesh::index_type i1, mesh::index_type i2) {
+    msh_.push_index(i0);
+    msh_.push_index(i1);
+    msh_.push_index(i2);
+  }
+private:
+  mesh &msh_;
+  size_t pos_attr_;
+};
+
+/// Marching cubes over a volume that arrives one z slice at a time.
+/// Only two slices of values and edge indices are kept, so memory is O(xdim*ydim).
+/// Sink needs vertex(const vec3 &) and triangle(index, index, index); vertices are numbered in the order they are sent.
+/// The vertices and triangles are the same, in the same order, as marching_cubes over the whole volume.
+template <class Sink>
+class marching_cubes_stream {
+public:
+  marching_cubes_stream(Sink &sink, int x0, int y0, int z0, int xdim, int ydim, float grid_spacing)
+  : sink_(sink), x0_(x0), y0_(y0), z0_(z0), xdim_(xdim), ydim_(ydim), grid_spacing_(grid_spacing), num_slices_(0), num_vertices_(0) {
+    size_t slice_size = (size_t)xdim * ydim;
+    for (int s = 0; s != 2; ++s) {
+      values_[s].resize(slice_size);
+      edges_[s].resize(slice_size * 3);
+      signs_[s].resize(slice_size);
+    }
+    masks_.resize(slice_size);
+    flags_.resize(xdim);
+  }
+
+  // Add the next z slice of xdim*ydim values, x varying fastest.
+  void push_slice(const float *values) {
+    int k = num_slices_++;
+    std::vector<float> &cur = values_[k & 1];
+    std::copy(values, values + cur.size(), cur.begin());
+    if (k >= 1) {
+      edge_slice(k - 1, &values_[(k - 1) & 1][0], &cur[0]);
+      if (k >= 2) triangle_layer(k - 2);
+      mask_layer(&values_[(k - 1) & 1][0], &cur[0]);
+    }
+  }
+
+  // Call once after the last slice to flush the final layer.
+  void finish() {
+    int k = num_slices_;
+    if (k >= 1) edge_slice(k - 1, &values_[(k - 1) & 1][0], nullptr);
+    if (k >= 2) triangle_layer(k - 2);
+  }
+
+  // Pull slices from a callback returning a pointer to slice k, or null at the end.
+  template <class GetSlice>
+  void run(GetSlice get_slice) {
+    for (int k = 0; ; ++k) {
+      const float *values = get_slice(k);
+      if (!values) break;
+      push_slice(values);
+    }
+    finish();
+  }
+
+  size_t vertex_count() const { return num_vertices_; }
+
+private:
+  static const mesh::index_type no_vertex = ~(mesh::index_type)0;
+
+  // Vertices on the edges owned by the lattice points of slice k, in the same order as marching_cubes.
+  // above is the slice k+1 or null if k is the last slice.
+  void edge_slice(int k, const float *values, const float *above) {
+    int xdim = xdim_, ydim = ydim_;
+    mesh::index_type *edges = &edges_[k & 1][0];
+    const mesh::index_type none = no_vertex;
+    std::fill(edges, edges + (size_t)xdim * ydim * 3, none);
+    std::uint8_t *flags = &flags_[0];
+    for (int j = 0; j != ydim; ++j) {
+      const float *v = values + j * xdim;
+      std::fill(flags, flags + xdim, 0);
+      mc_rows::crossings(v, v + 1, 1, flags, xdim - 1);
+      if (j != ydim-1) mc_rows::crossings(v, v + xdim, 2, flags, xdim);
+      if (above) mc_rows::crossings(v, above + j * xdim, 4, flags, xdim);
+
+      for (int i = mc_rows::next(flags, 0, xdim, false); i != xdim; i = mc_rows::next(flags, i + 1, xdim, false)) {
+        int idx = j * xdim + i;
+        float v0 = values[idx];
+        // x edges
+        if (flags[i] & 1) {
+          float v1 = values[idx + 1];
+          float lambda = v0 / (v0 - v1);
+          edges[idx*3+0] = vertex(vec3(float(x0_ + i + lambda), float(y0_ + j), float(z0_ + k)));
+        }
+
+        // y edges
+        if (flags[i] & 2) {
+          float v1 = values[idx + xdim];
+          float lambda = v0 / (v0 - v1);
+          edges[idx*3+1] = vertex(vec3(float(x0_ + i), float(y0_ + j + lambda), float(z0_ + k)));
+        }
+
+        // z edges
+        if (flags[i] & 4) {
+          float v1 = above[idx];
+          float lambda = v0 / (v0 - v1);
+          edges[idx*3+2] = vertex(vec3(x0_ + i, y0_ + j, z0_ + k + lambda));
+        }
+      }
+    }
+  }
+
+  mesh::index_type vertex(const vec3 &pos) {
+    sink_.vertex(pos * grid_spacing_);
+    return (mesh::index_type)num_vertices_++;
+  }
+
+  // Case index of each cube between two slices, see marching_cubes for the bit order.
+  void mask_layer(const float *lo, const float *hi) {
+    int xdim = xdim_, ydim = ydim_;
+    size_t slice_size = (size_t)xdim * ydim;
+    mc_rows::signs(lo, &signs_[0][0], (int)slice_size);
+    mc_rows::signs(hi, &signs_[1][0], (int)slice_size);
+    for (int j = 0; j != ydim-1; ++j) {
+      const std::uint8_t *s0 = &signs_[0][j * xdim];
+      const std::uint8_t *s1 = &signs_[1][j * xdim];
+      mc_rows::cases(s0, s0 + xdim, s1, s1 + xdim, &masks_[j * xdim], xdim - 1);
+    }
+  }
+
+  // Triangles for the cubes between slices k and k+1 from the masks computed when k+1 arrived.
+  void triangle_layer(int k) {
+    int xdim = xdim_, ydim = ydim_;
+    const mesh::index_type *lo = &edges_[k & 1][0];
+    const mesh::index_type *hi = &edges_[(k + 1) & 1][0];
+    int dx = 3;
+    int dy = xdim * 3;
+    // slice (0 lower, 1 upper) and offset of each of the twelve cube edges.
+    static const int edge_slices[] = { 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0 };
+    int edge_offsets[] = {
+      0*dx+0*dy+0,  // 0,1,
+      1*dx+0*dy+1,  // 1,2,
+      0*dx+1*dy+0,  // 2,3,
+      0*dx+0*dy+1,  // 3,0,
+      0*dx+0*dy+0,  // 4,5,
+      1*dx+0*dy+1,  // 5,6,
+      0*dx+1*dy+0,  // 6,7,
+      0*dx+0*dy+1,  // 7,4,
+      0*dx+0*dy+2,  // 0,4,
+      1*dx+0*dy+2,  // 1,5,
+      1*dx+1*dy+2,  // 2,6,
+      0*dx+1*dy+2,  // 3,7
+    };
+    const char *triangles = marching_cubes::mc_triangles();
+    for (int j = 0; j != ydim-1; ++j) {
+      const std::uint8_t *masks = &masks_[j * xdim];
+      for (int i = mc_rows::next(masks, 0, xdim - 1, true); i != xdim - 1; i = mc_rows::next(masks, i + 1, xdim - 1, true)) {
+        int idx = j * xdim + i;
+        int off = masks_[idx] * 16;
+        while (triangles[off] != -1) {
+          mesh::index_type v[3];
+          for (int t = 0; t != 3; ++t) {
+            int e = triangles[off + t];
+            v[t] = (edge_slices[e] ? hi : lo)[idx*3 + edge_offsets[e]];
+          }
+          if (v[0] != no_vertex && v[1] != no_vertex && v[2] != no_vertex) {
+            sink_.triangle(v[0], v[1], v[2]);
+          }
+          off += 3;
+        }
+      }
+    }
+  }
+
+  Sink &sink_;
+  int x0_, y0_, z0_;
+  int xdim_, ydim_;
+  float grid_spacing_;
+  int num_slices_;
+  size_t num_vertices_;
+  std::vector<float> values_[2];
+  std::vector<mesh::index_type> edges_[2];
+  std::vector<std::uint8_t> masks_;
+  std::vector<std::uint8_t> signs_[2];
+  std::vector<std::uint8_t> flags_;
+};
+
 }
 
 #endif
@@ -11,10 +11,167 @@
 
 #include <ostream>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include <stdio.h>
 
+// Use SSE or NEON registers for vec4 unless GLSLMATH_NO_SIMD is defined.
+#if !defined(GLSLMATH_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+    #define GLSLMATH_SSE 1
+    #include <xmmintrin.h>
+#elif !defined(GLSLMATH_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+    #define GLSLMATH_NEON 1
+    #include <arm_neon.h>
+#endif
+
+#if !defined(GLSLMATH_NO_SIMD) && defined(__AVX__)
+    #define GLSLMATH_AVX 1
+    #include <immintrin.h>
+#endif
+
+// Hardware half conversion for the bulk converters; needs -mf16c (or -march=native) with gcc and clang.
+#if !defined(GLSLMATH_NO_SIMD) && defined(__F16C__)
+    #define GLSLMATH_F16C 1
+    #include <immintrin.h>
+#endif
+
+// constexpr for bodies that need C++14 relaxed constexpr (loops, assignments and non-const members).
+// With C++11 these are ordinary inline functions and only the plain accessors are constexpr.
+#if defined(__cpp_constexpr) && __cpp_constexpr >= 201304
+    #define GLSLMATH_CONSTEXPR14 constexpr
+#else
+    #define GLSLMATH_CONSTEXPR14
+#endif
 
 namespace glslmath {
+    #if defined(GLSLMATH_SSE) || defined(GLSLMATH_NEON)
+        // Storage for four floats in a single SIMD register.
+        // Behaves like float[4] so that it can be used as the Impl of basic_vec.
+        class simd_float4 {
+        public:
+            #if defined(GLSLMATH_SSE)
+                typedef __m128 native_t;
+            #else
+                typedef float32x4_t native_t;
+            #endif
+
+            simd_float4() {
+            }
+
+            simd_float4(native_t v) : v(v) {
+            }
+
+            GLSLMATH_CONSTEXPR14 float &operator[](size_t i) { return f[i]; }
+            constexpr const float &operator[](size_t i) const { return f[i]; }
+
+            native_t native() const { return v; }
+        private:
+            union {
+                native_t v;
+                float f[4];
+            };
+        };
+
+        typedef simd_float4 vec4_impl_t;
+        // register storage can not be built at compile time.
+        #define GLSLMATH_VEC4_CONSTEXPR
+    #else
+        typedef float vec4_impl_t[4];
+        #define GLSLMATH_VEC4_CONSTEXPR GLSLMATH_CONSTEXPR14
+    #endif
+
+    // Eight floats, one per lane, for structure-of-arrays packets such as vec3x8.
+    // With AVX each operation is a single instruction, otherwise the fixed length
+    // loops are left to the auto-vectorizer.
+    class float8 {
+    public:
+        static constexpr size_t size() { return 8; }
+
+        float8() {
+        }
+
+        float8(float a) {
+            #if defined(GLSLMATH_AVX)
+                v = _mm256_set1_ps(a);
+            #else
+                for (size_t i = 0; i != 8; ++i) f[i] = a;
+            #endif
+        }
+
+        // load eight consecutive floats.
+        static float8 load(const float *p) {
+            float8 res;
+            #if defined(GLSLMATH_AVX)
+                res.v = _mm256_loadu_ps(p);
+            #else
+                for (size_t i = 0; i != 8; ++i) res.f[i] = p[i];
+            #endif
+            return res;
+        }
+
+        // store eight consecutive floats.
+        void store(float *p) const {
+            #if defined(GLSLMATH_AVX)
+                _mm256_storeu_ps(p, v);
+            #else
+                for (size_t i = 0; i != 8; ++i) p[i] = f[i];
+            #endif
+        }
+
+        template <class F>
+        float8 map(const float8 &b, F fn) const {
+            float8 res;
+            for (size_t i = 0; i != 8; ++i) res.f[i] = fn(f[i], b.f[i]);
+            return res;
+        }
+
+        float operator[](size_t i) const { return f[i]; }
+        void set_elem(size_t i, float a) { f[i] = a; }
+
+        #if defined(GLSLMATH_AVX)
+            float8(__m256 v) : v(v) {
+            }
+
+            __m256 native() const { return v; }
+        #endif
+
+        float8 &operator+=(const float8 &b);
+        float8 &operator-=(const float8 &b);
+        float8 &operator*=(const float8 &b);
+        float8 &operator/=(const float8 &b);
+    private:
+        union {
+            #if defined(GLSLMATH_AVX)
+                __m256 v;
+            #endif
+            float f[8];
+        };
+    };
+
+    #if defined(GLSLMATH_AVX)
+        inline float8 operator+(const float8 &a, const float8 &b) { return _mm256_add_ps(a.native(), b.native()); }
+        inline float8 operator-(const float8 &a, const float8 &b) { return _mm256_sub_ps(a.native(), b.native()); }
+        inline float8 operator*(const float8 &a, const float8 &b) { return _mm256_mul_ps(a.native(), b.native()); }
+        inline float8 operator/(const float8 &a, const float8 &b) { return _mm256_div_ps(a.native(), b.native()); }
+        inline float8 min(const float8 &a, const float8 &b) { return _mm256_min_ps(a.native(), b.native()); }
+        inline float8 max(const float8 &a, const float8 &b) { return _mm256_max_ps(a.native(), b.native()); }
+        inline float8 sqrt(const float8 &a) { return _mm256_sqrt_ps(a.native()); }
+    #else
+        inline float8 operator+(const float8 &a, const float8 &b) { return a.map(b, [](float a, float b){ return a + b; }); }
+        inline float8 operator-(const float8 &a, const float8 &b) { return a.map(b, [](float a, float b){ return a - b; }); }
+        inline float8 operator*(const float8 &a, const float8 &b) { return a.map(b, [](float a, float b){ return a * b; }); }
+        inline float8 operator/(const float8 &a, const float8 &b) { return a.map(b, [](float a, float b){ return a / b; }); }
+        inline float8 min(const float8 &a, const float8 &b) { return a.map(b, [](float a, float b){ return a < b ? a : b; }); }
+        inline float8 max(const float8 &a, const float8 &b) { return a.map(b, [](float a, float b){ return a > b ? a : b; }); }
+        inline float8 sqrt(const float8 &a) { return a.map(a, [](float a, float){ return std::sqrt(a); }); }
+    #endif
+
+    inline float8 &float8::operator+=(const float8 &b) { return *this = *this + b; }
+    inline float8 &float8::operator-=(const float8 &b) { return *this = *this - b; }
+    inline float8 &float8::operator*=(const float8 &b) { return *this = *this * b; }
+    inline float8 &float8::operator/=(const float8 &b) { return *this = *this / b; }
+
     template <class Impl, class Scalar, size_t N> class basic_vec {
         static_assert(N >= 2 && N <= 4, "expected N in range 1..4");
     public:
@@ -23,19 +180,18 @@ namespace glslmath {
         typedef Impl impl_t;
         static constexpr size_t size() { return N; }
         
-        basic_vec() {
-        }
+        basic_vec() = default;
 
-        basic_vec(Scalar a) {
+        GLSLMATH_CONSTEXPR14 basic_vec(Scalar a) : impl() {
             for (size_t i = 0; i != N; ++i) {
                 impl[i] = a;
             }
         }
         
-        Scalar x() const { return impl[0]; }
-        Scalar y() const { return N >= 1 ? impl[1] : 0; }
-        Scalar z() const { return N >= 2 ? impl[2] : 0; }
-        Scalar w() const { return N >= 3 ? impl[3] : 1; }
+        constexpr Scalar x() const { return impl[0]; }
+        constexpr Scalar y() const { return N > 1 ? impl[1] : Scalar(0); }
+        constexpr Scalar z() const { return N > 2 ? impl[2] : Scalar(0); }
+        constexpr Scalar w() const { return N > 3 ? impl[3] : Scalar(1); }
         
         template <class F>
         basic_vec map(F f) const {
@@ -59,7 +215,7 @@ namespace glslmath {
         basic_vec map(const basic_vec &b, const basic_vec &c, F f) const {
             basic_vec res;
             for (size_t i = 0; i != N; ++i) {
-                res.impl[i] = f(impl[i], b.impl[i]);
+                res.impl[i] = f(impl[i], b.impl[i], c.impl[i]);
             }
             return res;
         }
@@ -72,14 +228,29 @@ namespace glslmath {
             return acc;
         }
         
-        Scalar operator[](size_t i) const {
+        constexpr const Scalar &operator[](size_t i) const {
             return impl[i];
         }
 
-        void set_elem(size_t i, scalar_t v) {
+        GLSLMATH_CONSTEXPR14 void set_elem(size_t i, scalar_t v) {
             impl[i] = v;
         }
+
+        // Access to the underlying storage for specialized operators.
+        constexpr const Impl &get_impl() const { return impl; }
+        GLSLMATH_CONSTEXPR14 Impl &get_impl() { return impl; }
         
+    protected:
+        // element by element construction for the derived constructors; the unused trailing elements are ignored.
+        struct elems_t {};
+
+        GLSLMATH_CONSTEXPR14 basic_vec(elems_t, Scalar a, Scalar b, Scalar c=Scalar(), Scalar d=Scalar()) : impl() {
+            impl[0] = a;
+            impl[1] = b;
+            if (N > 2) impl[2 % N] = c;
+            if (N > 3) impl[3 % N] = d;
+        }
+
     private:
         Impl impl;
     };
@@ -117,6 +288,9 @@ namespace glslmath {
     template <class T, class Scalar, size_t N>
     basic_vec<T, Scalar, N> mix(const basic_vec<T, Scalar, N> &a, const basic_vec<T, Scalar, N> &b, const basic_vec<T, Scalar, N> &c) { return a.map(b, c, [](Scalar a, Scalar b, Scalar c){ return a * (1 - c) + b * c; }); }
 
+    template <class T, class Scalar, size_t N>
+    basic_vec<T, Scalar, N> mix(const basic_vec<T, Scalar, N> &a, const basic_vec<T, Scalar, N> &b, Scalar c) { return a.map(b, [c](Scalar a, Scalar b){ return a * (1 - c) + b * c; }); }
+
     template <class T, class Scalar, size_t N>
     bool operator==(const basic_vec<T, Scalar, N> &a, const basic_vec<T, Scalar, N> &b) { return a.sum(b, [](Scalar a, Scalar b){ return a == b; }, 0) == N; }
 
@@ -135,6 +309,225 @@ namespace glslmath {
         return a * rlen;
     }
 
+    template <class T, class Scalar, size_t N>
+    Scalar length(const basic_vec<T, Scalar, N> &a) { return std::sqrt(dot(a, a)); }
+
+    // Lane-wise versions for float8 packets where a scalar compare or sqrt would not compile.
+    template <class T, size_t N>
+    basic_vec<T, float8, N> min(const basic_vec<T, float8, N> &a, const basic_vec<T, float8, N> &b) { return a.map(b, [](float8 a, float8 b){ return min(a, b); }); }
+
+    template <class T, size_t N>
+    basic_vec<T, float8, N> max(const basic_vec<T, float8, N> &a, const basic_vec<T, float8, N> &b) { return a.map(b, [](float8 a, float8 b){ return max(a, b); }); }
+
+    template <class T, size_t N>
+    basic_vec<T, float8, N> abs(const basic_vec<T, float8, N> &a) { return a.map([](float8 a){ return max(a, float8(0) - a); }); }
+
+    template <class T, size_t N>
+    basic_vec<T, float8, N> normalized(const basic_vec<T, float8, N> &a) {
+        float8 rlen = float8(1) / sqrt(dot(a, a));
+        return a * rlen;
+    }
+
+    // IEEE 754 half precision conversion, round to nearest even.
+    inline std::uint16_t half_from_float(float value) {
+        std::uint32_t f;
+        memcpy(&f, &value, sizeof(f));
+        std::uint32_t sign = (f >> 16) & 0x8000;
+        std::uint32_t absf = f & 0x7fffffff;
+        if (absf >= 0x7f800000) {
+            // inf or nan
+            return (std::uint16_t)(sign | 0x7c00 | (absf > 0x7f800000 ? 0x200 : 0));
+        }
+        if (absf >= 0x477ff000) {
+            // overflow to inf
+            return (std::uint16_t)(sign | 0x7c00);
+        }
+        if (absf < 0x38800000) {
+            // denormal or zero: shift the mantissa (with implicit one) into place.
+            if (absf < 0x33000000) return (std::uint16_t)sign;
+            std::uint32_t exp = absf >> 23;
+            std::uint32_t mant = (absf & 0x7fffff) | 0x800000;
+            std::uint32_t shift = 126 - exp;
+            std::uint32_t res = mant >> shift;
+            std::uint32_t rem = mant & ((1u << shift) - 1);
+            std::uint32_t halfway = 1u << (shift - 1);
+            if (rem > halfway || (rem == halfway && (res & 1))) ++res;
+            return (std::uint16_t)(sign | res);
+        }
+        std::uint32_t res = absf - 0x38000000;
+        res += 0xfff + ((res >> 13) & 1);
+        return (std::uint16_t)(sign | (res >> 13));
+    }
+
+    inline float float_from_half(std::uint16_t h) {
+        std::uint32_t sign = (std::uint32_t)(h & 0x8000) << 16;
+        std::uint32_t exp = (h >> 10) & 0x1f;
+        std::uint32_t mant = h & 0x3ff;
+        std::uint32_t f;
+        if (exp == 0x1f) {
+            f = sign | 0x7f800000 | (mant << 13);
+        } else if (exp != 0) {
+            f = sign | ((exp + 112) << 23) | (mant << 13);
+        } else if (mant != 0) {
+            // normalize a denormal.
+            exp = 113;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                --exp;
+            }
+            f = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        } else {
+            f = sign;
+        }
+        float value;
+        memcpy(&value, &f, sizeof(value));
+        return value;
+    }
+
+    // Bulk versions for vertex arrays, four at a time with F16C or NEON.
+    inline void half_from_float(const float *src, std::uint16_t *dest, size_t count) {
+        size_t i = 0;
+        #if defined(GLSLMATH_F16C)
+            for (; i + 4 <= count; i += 4) {
+                _mm_storel_epi64((__m128i*)(dest + i), _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+            }
+        #elif defined(GLSLMATH_NEON)
+            for (; i + 4 <= count; i += 4) {
+                vst1_u16(dest + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+            }
+        #endif
+        for (; i != count; ++i) dest[i] = half_from_float(src[i]);
+    }
+
+    inline void float_from_half(const std::uint16_t *src, float *dest, size_t count) {
+        size_t i = 0;
+        #if defined(GLSLMATH_F16C)
+            for (; i + 4 <= count; i += 4) {
+                _mm_storeu_ps(dest + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + i))));
+            }
+        #elif defined(GLSLMATH_NEON)
+            for (; i + 4 <= count; i += 4) {
+                vst1q_f32(dest + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+            }
+        #endif
+        for (; i != count; ++i) dest[i] = float_from_half(src[i]);
+    }
+
+    // Storage scalars for the compact vector types. Each converts to and from float,
+    // so arithmetic happens in float and the result is rounded back on assignment.
+
+    // IEEE half precision.
+    class half {
+    public:
+        half() = default;
+        half(float value) : bits_(half_from_float(value)) {}
+        operator float() const { return float_from_half(bits_); }
+
+        static half from_bits(std::uint16_t bits) { half res; res.bits_ = bits; return res; }
+        std::uint16_t bits() const { return bits_; }
+    private:
+        std::uint16_t bits_;
+    };
+
+    // [0, 1] in eight bits, as used by "a4Bn" colours; out of range values clamp.
+    class unorm8 {
+    public:
+        unorm8() = default;
+        unorm8(float value) : bits_((std::uint8_t)std::floor((value > 0 ? (value < 1 ? value : 1) : 0) * 255 + 0.5f)) {}
+        operator float() const { return bits_ / 255.0f; }
+
+        static unorm8 from_bits(std::uint8_t bits) { unorm8 res; res.bits_ = bits; return res; }
+        std::uint8_t bits() const { return bits_; }
+    private:
+        std::uint8_t bits_;
+    };
+
+    // [-1, 1] in sixteen bits, as used by "a3sn" normals. Both -32767 and -32768 decode to -1.
+    class snorm16 {
+    public:
+        snorm16() = default;
+        snorm16(float value) : bits_((std::int16_t)std::floor((value > -1 ? (value < 1 ? value : 1) : -1) * 32767 + 0.5f)) {}
+        operator float() const { float v = bits_ / 32767.0f; return v < -1 ? -1.0f : v; }
+
+        static snorm16 from_bits(std::int16_t bits) { snorm16 res; res.bits_ = bits; return res; }
+        std::int16_t bits() const { return bits_; }
+    private:
+        std::int16_t bits_;
+    };
+
+    #if defined(GLSLMATH_SSE) || defined(GLSLMATH_NEON)
+        // Register versions of the common vec4 operators.
+        // These are more specialized than the templates above so overload resolution prefers them.
+        typedef basic_vec<simd_float4, float, 4> simd_vec4_t;
+
+        inline simd_vec4_t simd_vec4(simd_float4::native_t v) {
+            simd_vec4_t res;
+            res.get_impl() = simd_float4(v);
+            return res;
+        }
+
+        #if defined(GLSLMATH_SSE)
+            inline simd_float4::native_t simd_splat(float b) { return _mm_set1_ps(b); }
+            inline simd_float4::native_t simd_add(simd_float4::native_t a, simd_float4::native_t b) { return _mm_add_ps(a, b); }
+            inline simd_float4::native_t simd_sub(simd_float4::native_t a, simd_float4::native_t b) { return _mm_sub_ps(a, b); }
+            inline simd_float4::native_t simd_mul(simd_float4::native_t a, simd_float4::native_t b) { return _mm_mul_ps(a, b); }
+            inline simd_float4::native_t simd_div(simd_float4::native_t a, simd_float4::native_t b) { return _mm_div_ps(a, b); }
+            inline simd_float4::native_t simd_min(simd_float4::native_t a, simd_float4::native_t b) { return _mm_min_ps(a, b); }
+            inline simd_float4::native_t simd_max(simd_float4::native_t a, simd_float4::native_t b) { return _mm_max_ps(a, b); }
+
+            // horizontal sum of a * b broadcast to all four lanes.
+            inline simd_float4::native_t simd_dot(simd_float4::native_t a, simd_float4::native_t b) {
+                __m128 m = _mm_mul_ps(a, b);
+                __m128 s = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+            }
+
+            template <int Lane>
+            inline simd_float4::native_t simd_lane(simd_float4::native_t a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(Lane, Lane, Lane, Lane)); }
+
+            inline float simd_first(simd_float4::native_t a) { return _mm_cvtss_f32(a); }
+        #else
+            inline simd_float4::native_t simd_splat(float b) { return vdupq_n_f32(b); }
+            inline simd_float4::native_t simd_add(simd_float4::native_t a, simd_float4::native_t b) { return vaddq_f32(a, b); }
+            inline simd_float4::native_t simd_sub(simd_float4::native_t a, simd_float4::native_t b) { return vsubq_f32(a, b); }
+            inline simd_float4::native_t simd_mul(simd_float4::native_t a, simd_float4::native_t b) { return vmulq_f32(a, b); }
+            inline simd_float4::native_t simd_div(simd_float4::native_t a, simd_float4::native_t b) { return vdivq_f32(a, b); }
+            inline simd_float4::native_t simd_min(simd_float4::native_t a, simd_float4::native_t b) { return vbslq_f32(vcltq_f32(a, b), a, b); }
+            inline simd_float4::native_t simd_max(simd_float4::native_t a, simd_float4::native_t b) { return vbslq_f32(vcgtq_f32(a, b), a, b); }
+
+            inline simd_float4::native_t simd_dot(simd_float4::native_t a, simd_float4::native_t b) {
+                return vdupq_n_f32(vaddvq_f32(vmulq_f32(a, b)));
+            }
+
+            template <int Lane>
+            inline simd_float4::native_t simd_lane(simd_float4::native_t a) { return vdupq_laneq_f32(a, Lane); }
+
+            inline float simd_first(simd_float4::native_t a) { return vgetq_lane_f32(a, 0); }
+        #endif
+
+        inline simd_vec4_t operator+(const simd_vec4_t &a, const simd_vec4_t &b) { return simd_vec4(simd_add(a.get_impl().native(), b.get_impl().native())); }
+        inline simd_vec4_t operator-(const simd_vec4_t &a, const simd_vec4_t &b) { return simd_vec4(simd_sub(a.get_impl().native(), b.get_impl().native())); }
+        inline simd_vec4_t operator*(const simd_vec4_t &a, const simd_vec4_t &b) { return simd_vec4(simd_mul(a.get_impl().native(), b.get_impl().native())); }
+        inline simd_vec4_t operator/(const simd_vec4_t &a, const simd_vec4_t &b) { return simd_vec4(simd_div(a.get_impl().native(), b.get_impl().native())); }
+        inline simd_vec4_t operator+(const simd_vec4_t &a, float b) { return simd_vec4(simd_add(a.get_impl().native(), simd_splat(b))); }
+        inline simd_vec4_t operator-(const simd_vec4_t &a, float b) { return simd_vec4(simd_sub(a.get_impl().native(), simd_splat(b))); }
+        inline simd_vec4_t operator*(const simd_vec4_t &a, float b) { return simd_vec4(simd_mul(a.get_impl().native(), simd_splat(b))); }
+        inline simd_vec4_t operator/(const simd_vec4_t &a, float b) { return simd_vec4(simd_div(a.get_impl().native(), simd_splat(b))); }
+        inline simd_vec4_t min(const simd_vec4_t &a, const simd_vec4_t &b) { return simd_vec4(simd_min(a.get_impl().native(), b.get_impl().native())); }
+        inline simd_vec4_t max(const simd_vec4_t &a, const simd_vec4_t &b) { return simd_vec4(simd_max(a.get_impl().native(), b.get_impl().native())); }
+        inline float dot(const simd_vec4_t &a, const simd_vec4_t &b) { return simd_first(simd_dot(a.get_impl().native(), b.get_impl().native())); }
+
+        inline simd_vec4_t normalized(const simd_vec4_t &a) {
+            simd_float4::native_t v = a.get_impl().native();
+            simd_float4::native_t len2 = simd_dot(v, v);
+            #if defined(GLSLMATH_SSE)
+                return simd_vec4(_mm_div_ps(v, _mm_sqrt_ps(len2)));
+            #else
+                return simd_vec4(vdivq_f32(v, vsqrtq_f32(len2)));
+            #endif
+        }
+    #endif
+
     template <class Column, size_t M>
     class basic_mat : public basic_vec<Column[M], Column, M> {
     public:
@@ -144,23 +537,32 @@ namespace glslmath {
         static constexpr size_t num_rows() { return column_t::size(); }
         static constexpr size_t num_cols() { return M; }
 
-        basic_mat() {
-        }
+        basic_mat() = default;
 
-        basic_mat(scalar_t value) {
-            for (size_t i = 0; i != M; ++i) {
-                set_elem(i, column_t(value));
+        // value times the identity, as in GLSL.
+        GLSLMATH_CONSTEXPR14 explicit basic_mat(scalar_t value) : vec_t(column_t(scalar_t(0))) {
+            for (size_t i = 0; i != M && i != num_rows(); ++i) {
+                column_t col(scalar_t(0));
+                col.set_elem(i, value);
+                this->set_elem(i, col);
             }
         }
 
-        basic_mat(column_t *cols) {
+        basic_mat(const column_t *cols) {
             for (size_t i = 0; i != M; ++i) {
-                set_elem(i, cols[i]);
+                this->set_elem(i, cols[i]);
             }
         }
         
-        void set_col(size_t i, column_t c) {
-            set_elem(i, c);
+        GLSLMATH_CONSTEXPR14 void set_col(size_t i, column_t c) {
+            this->set_elem(i, c);
+        }
+
+    protected:
+        typedef basic_vec<Column[M], Column, M> vec_t;
+        typedef typename vec_t::elems_t elems_t;
+
+        GLSLMATH_CONSTEXPR14 basic_mat(elems_t e, Column a, Column b, Column c=Column(), Column d=Column()) : vec_t(e, a, b, c, d) {
         }
     };
 
@@ -177,11 +579,11 @@ namespace glslmath {
         return result;
     }
     
+    // The copies are left to the compiler so that the types stay trivially copyable.
     #define MATH_VEC_BOILERPLATE(C) \
         typedef C this_t; \
-        C() {} \
-        C(const base_t &b) : base_t(b) {} \
-        C(const this_t &b) : base_t(b) {} \
+        C() = default; \
+        constexpr C(const base_t &b) : base_t(b) {} \
         C &operator+=(C b) { return (*this) = (*this) + b; } \
         C &operator-=(C b) { return (*this) = (*this) - b; } \
         C &operator*=(C b) { return (*this) = (*this) * b; } \
@@ -192,9 +594,7 @@ namespace glslmath {
     public:
         MATH_VEC_BOILERPLATE(vec2)
 
-        vec2(float x, float y) {
-            set_elem(0, x);
-            set_elem(1, y);
+        GLSLMATH_CONSTEXPR14 vec2(float x, float y) : base_t(elems_t(), x, y) {
         }
     };
     
@@ -202,61 +602,38 @@ namespace glslmath {
     public:
         MATH_VEC_BOILERPLATE(vec3)
 
-        vec3(float x, float y, float z) {
-            set_elem(0, x);
-            set_elem(1, y);
-            set_elem(2, z);
+        GLSLMATH_CONSTEXPR14 vec3(float x, float y, float z) : base_t(elems_t(), x, y, z) {
         }
         
-        vec3(vec2 a, scalar_t b) {
-            set_elem(0, a[0]);
-            set_elem(1, a[1]);
-            set_elem(2, b);
+        GLSLMATH_CONSTEXPR14 vec3(vec2 a, scalar_t b) : base_t(elems_t(), a[0], a[1], b) {
         }
 
-        vec3(float a, vec2 b) {
-            set_elem(0, a);
-            set_elem(1, b[0]);
-            set_elem(2, b[1]);
+        GLSLMATH_CONSTEXPR14 vec3(float a, vec2 b) : base_t(elems_t(), a, b[0], b[1]) {
         }
     };
     
-    class vec4 : public basic_vec<float[4], float, 4> {
+    class vec4 : public basic_vec<vec4_impl_t, float, 4> {
     public:
         MATH_VEC_BOILERPLATE(vec4)
 
-        vec4(float x, float y, float z, float w) {
-            set_elem(0, x);
-            set_elem(1, y);
-            set_elem(2, z);
-            set_elem(3, w);
+        GLSLMATH_VEC4_CONSTEXPR vec4(float x, float y, float z, float w) : base_t(elems_t(), x, y, z, w) {
         }
         
-        vec4(vec3 xyz, float w) {
-            set_elem(0, xyz.x());
-            set_elem(1, xyz.y());
-            set_elem(2, xyz.z());
-            set_elem(3, w);
+        GLSLMATH_VEC4_CONSTEXPR vec4(vec3 xyz, float w) : base_t(elems_t(), xyz.x(), xyz.y(), xyz.z(), w) {
         }
         
-        vec4(vec2 xy, float z, float w) {
-            set_elem(0, xy.x());
-            set_elem(1, xy.y());
-            set_elem(2, z);
-            set_elem(3, w);
+        GLSLMATH_VEC4_CONSTEXPR vec4(vec2 xy, float z, float w) : base_t(elems_t(), xy.x(), xy.y(), z, w) {
         }
         
-        vec3 xyz() const { return vec3(x(), y(), z()); }
-        vec2 xy() const { return vec2(x(), y()); }
+        GLSLMATH_VEC4_CONSTEXPR vec3 xyz() const { return vec3(x(), y(), z()); }
+        GLSLMATH_VEC4_CONSTEXPR vec2 xy() const { return vec2(x(), y()); }
     };
     
     class ivec2 : public basic_vec<int[2], int, 2> {
     public:
         MATH_VEC_BOILERPLATE(ivec2)
 
-        ivec2(int x, int y) {
-            set_elem(0, x);
-            set_elem(1, y);
+        GLSLMATH_CONSTEXPR14 ivec2(int x, int y) : base_t(elems_t(), x, y) {
         }
     };
     
@@ -264,10 +641,7 @@ namespace glslmath {
     public:
         MATH_VEC_BOILERPLATE(ivec3)
 
-        ivec3(int x, int y, int z) {
-            set_elem(0, x);
-            set_elem(1, y);
-            set_elem(2, z);
+        GLSLMATH_CONSTEXPR14 ivec3(int x, int y, int z) : base_t(elems_t(), x, y, z) {
         }
     };
     
@@ -275,34 +649,132 @@ namespace glslmath {
     public:
         MATH_VEC_BOILERPLATE(ivec4)
 
-        ivec4(int x, int y, int z, int w) {
+        GLSLMATH_CONSTEXPR14 ivec4(int x, int y, int z, int w) : base_t(elems_t(), x, y, z, w) {
+        }
+    };
+    
+    // Eight vec3s in structure-of-arrays form: x(), y() and z() each hold eight lanes.
+    class vec3x8 : public basic_vec<float8[3], float8, 3> {
+    public:
+        MATH_VEC_BOILERPLATE(vec3x8)
+
+        vec3x8(float8 x, float8 y, float8 z) {
+            set_elem(0, x);
+            set_elem(1, y);
+            set_elem(2, z);
+        }
+
+        vec3 lane(size_t i) const { return vec3(x()[i], y()[i], z()[i]); }
+    };
+
+    // Eight vec4s in structure-of-arrays form.
+    class vec4x8 : public basic_vec<float8[4], float8, 4> {
+    public:
+        MATH_VEC_BOILERPLATE(vec4x8)
+
+        vec4x8(float8 x, float8 y, float8 z, float8 w) {
             set_elem(0, x);
             set_elem(1, y);
             set_elem(2, z);
             set_elem(3, w);
         }
+
+        vec4x8(vec3x8 xyz, float8 w) {
+            set_elem(0, xyz.x());
+            set_elem(1, xyz.y());
+            set_elem(2, xyz.z());
+            set_elem(3, w);
+        }
+
+        vec3x8 xyz() const { return vec3x8(x(), y(), z()); }
+        vec4 lane(size_t i) const { return vec4(x()[i], y()[i], z()[i], w()[i]); }
     };
-    
+
+    // Compact vectors for vertex storage. Elements read and write as float;
+    // convert to vec2, vec3 or vec4 for anything more than the basic operators.
+    class hvec2 : public basic_vec<half[2], half, 2> {
+    public:
+        MATH_VEC_BOILERPLATE(hvec2)
+
+        hvec2(float x, float y) : base_t(elems_t(), x, y) {
+        }
+
+        explicit hvec2(vec2 v) : base_t(elems_t(), v.x(), v.y()) {
+        }
+
+        vec2 to_vec2() const { return vec2(x(), y()); }
+    };
+
+    class hvec3 : public basic_vec<half[3], half, 3> {
+    public:
+        MATH_VEC_BOILERPLATE(hvec3)
+
+        hvec3(float x, float y, float z) : base_t(elems_t(), x, y, z) {
+        }
+
+        explicit hvec3(vec3 v) : base_t(elems_t(), v.x(), v.y(), v.z()) {
+        }
+
+        vec3 to_vec3() const { return vec3(x(), y(), z()); }
+    };
+
+    class hvec4 : public basic_vec<half[4], half, 4> {
+    public:
+        MATH_VEC_BOILERPLATE(hvec4)
+
+        hvec4(float x, float y, float z, float w) : base_t(elems_t(), x, y, z, w) {
+        }
+
+        explicit hvec4(vec4 v) : base_t(elems_t(), v.x(), v.y(), v.z(), v.w()) {
+        }
+
+        vec4 to_vec4() const { return vec4(x(), y(), z(), w()); }
+    };
+
+    // Normalized colour, one byte per channel.
+    class u8vec4 : public basic_vec<unorm8[4], unorm8, 4> {
+    public:
+        MATH_VEC_BOILERPLATE(u8vec4)
+
+        u8vec4(float x, float y, float z, float w) : base_t(elems_t(), x, y, z, w) {
+        }
+
+        explicit u8vec4(vec4 v) : base_t(elems_t(), v.x(), v.y(), v.z(), v.w()) {
+        }
+
+        vec4 to_vec4() const { return vec4(x(), y(), z(), w()); }
+    };
+
+    // Normalized direction, sixteen bits per element.
+    class i16vec3 : public basic_vec<snorm16[3], snorm16, 3> {
+    public:
+        MATH_VEC_BOILERPLATE(i16vec3)
+
+        i16vec3(float x, float y, float z) : base_t(elems_t(), x, y, z) {
+        }
+
+        explicit i16vec3(vec3 v) : base_t(elems_t(), v.x(), v.y(), v.z()) {
+        }
+
+        vec3 to_vec3() const { return vec3(x(), y(), z()); }
+    };
+
     #undef MATH_VEC_BOILERPLATE
 
     #define MATH_MAT_BOILERPLATE(C) \
         typedef C this_t; \
-        C() {} \
-        C(const base_t &b) : base_t(b) {} \
-        C(const this_t &b) : base_t(b) {}
+        C() = default; \
+        constexpr C(const base_t &b) : base_t(b) {} \
+        GLSLMATH_CONSTEXPR14 explicit C(scalar_t value) : base_t(value) {}
 
     class mat2 : public basic_mat<vec2, 2> {
     public:
         MATH_MAT_BOILERPLATE(mat2)
 
-        mat2(column_t x, column_t y) {
-            set_elem(0, x);
-            set_elem(1, y);
+        GLSLMATH_CONSTEXPR14 mat2(column_t x, column_t y) : base_t(elems_t(), x, y) {
         }
 
-        mat2(float xx, float xy, float yx, float yy) {
-            set_elem(0, vec2(xx, xy));
-            set_elem(1, vec2(yx, yy));
+        GLSLMATH_CONSTEXPR14 mat2(float xx, float xy, float yx, float yy) : base_t(elems_t(), vec2(xx, xy), vec2(yx, yy)) {
         }
     };
     
@@ -310,10 +782,7 @@ namespace glslmath {
     public:
         MATH_MAT_BOILERPLATE(mat3)
 
-        mat3(column_t x, column_t y, column_t z) {
-            set_elem(0, x);
-            set_elem(1, y);
-            set_elem(2, z);
+        GLSLMATH_CONSTEXPR14 mat3(column_t x, column_t y, column_t z) : base_t(elems_t(), x, y, z) {
         }
     };
     
@@ -321,58 +790,315 @@ namespace glslmath {
     public:
         MATH_MAT_BOILERPLATE(mat4)
 
-        mat4(column_t x, column_t y, column_t z, column_t w) {
-            set_elem(0, x);
-            set_elem(1, y);
-            set_elem(2, z);
-            set_elem(3, w);
+        GLSLMATH_VEC4_CONSTEXPR mat4(column_t x, column_t y, column_t z, column_t w) : base_t(elems_t(), x, y, z, w) {
         }
     };
     
     
     #undef MATH_MAT_BOILERPLATE
 
-    vec3 cross(vec3 a, vec3 b) {
+    // Transform eight vectors at once.
+    inline vec4x8 operator*(const basic_mat<vec4, 4> &m, const vec4x8 &v) {
+        float8 res[4];
+        for (size_t r = 0; r != 4; ++r) {
+            res[r] = float8(m[0][r]) * v.x() + float8(m[1][r]) * v.y() + float8(m[2][r]) * v.z() + float8(m[3][r]) * v.w();
+        }
+        return vec4x8(res[0], res[1], res[2], res[3]);
+    }
+
+    // Unrolled matrix times column vector; the generic operator* would scale the columns.
+    inline GLSLMATH_CONSTEXPR14 vec2 operator*(const basic_mat<vec2, 2> &m, const vec2 &v) {
+        return vec2(m[0][0] * v[0] + m[1][0] * v[1], m[0][1] * v[0] + m[1][1] * v[1]);
+    }
+
+    inline GLSLMATH_CONSTEXPR14 vec3 operator*(const basic_mat<vec3, 3> &m, const vec3 &v) {
+        return vec3(
+            m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+            m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+            m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]
+        );
+    }
+
+    inline GLSLMATH_CONSTEXPR14 basic_mat<vec2, 2> operator*(const basic_mat<vec2, 2> &a, const basic_mat<vec2, 2> &b) {
+        return mat2(a * b[0], a * b[1]);
+    }
+
+    inline GLSLMATH_CONSTEXPR14 basic_mat<vec3, 3> operator*(const basic_mat<vec3, 3> &a, const basic_mat<vec3, 3> &b) {
+        return mat3(a * b[0], a * b[1], a * b[2]);
+    }
+
+    #if defined(GLSLMATH_SSE) || defined(GLSLMATH_NEON)
+        inline vec4 operator*(const basic_mat<vec4, 4> &m, const vec4 &v) {
+            simd_float4::native_t vn = v.get_impl().native();
+            simd_float4::native_t sum = simd_mul(m.get_impl()[0].get_impl().native(), simd_lane<0>(vn));
+            sum = simd_add(sum, simd_mul(m.get_impl()[1].get_impl().native(), simd_lane<1>(vn)));
+            sum = simd_add(sum, simd_mul(m.get_impl()[2].get_impl().native(), simd_lane<2>(vn)));
+            sum = simd_add(sum, simd_mul(m.get_impl()[3].get_impl().native(), simd_lane<3>(vn)));
+            return simd_vec4(sum);
+        }
+
+        // mat4 multiply as sixteen broadcast multiply-adds.
+        inline basic_mat<vec4, 4> operator*(const basic_mat<vec4, 4> &a, const basic_mat<vec4, 4> &b) {
+            simd_float4::native_t a0 = a.get_impl()[0].get_impl().native();
+            simd_float4::native_t a1 = a.get_impl()[1].get_impl().native();
+            simd_float4::native_t a2 = a.get_impl()[2].get_impl().native();
+            simd_float4::native_t a3 = a.get_impl()[3].get_impl().native();
+            basic_mat<vec4, 4> result;
+            for (size_t c = 0; c != 4; ++c) {
+                simd_float4::native_t bc = b.get_impl()[c].get_impl().native();
+                simd_float4::native_t sum = simd_mul(a0, simd_lane<0>(bc));
+                sum = simd_add(sum, simd_mul(a1, simd_lane<1>(bc)));
+                sum = simd_add(sum, simd_mul(a2, simd_lane<2>(bc)));
+                sum = simd_add(sum, simd_mul(a3, simd_lane<3>(bc)));
+                result.set_elem(c, simd_vec4(sum));
+            }
+            return result;
+        }
+    #else
+        inline GLSLMATH_CONSTEXPR14 vec4 operator*(const basic_mat<vec4, 4> &m, const vec4 &v) {
+            return vec4(
+                m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2] + m[3][0] * v[3],
+                m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2] + m[3][1] * v[3],
+                m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2] + m[3][2] * v[3],
+                m[0][3] * v[0] + m[1][3] * v[1] + m[2][3] * v[2] + m[3][3] * v[3]
+            );
+        }
+
+        inline GLSLMATH_CONSTEXPR14 basic_mat<vec4, 4> operator*(const basic_mat<vec4, 4> &a, const basic_mat<vec4, 4> &b) {
+            return mat4(a * b[0], a * b[1], a * b[2], a * b[3]);
+        }
+    #endif
+
+    inline GLSLMATH_CONSTEXPR14 vec3 cross(vec3 a, vec3 b) {
         return vec3(a.y() * b.z() - a.z() * b.y(), a.z() * b.x() - a.x() * b.z(), a.x() * b.y() - a.y() * b.x());
     }
     
-    vec3 cwoss(vec4 a, vec4 b) {
+    inline vec3 cwoss(vec4 a, vec4 b) {
         return vec3(a.y() * b.w() - a.w() * b.y(), a.w() * b.x() - a.x() * b.w(), a.x() * b.y() - a.y() * b.x());
     }
     
-    vec3 persp(vec4 a) {
+    inline vec3 persp(vec4 a) {
         float rw = 1.0f / a.w();
         return vec3(a.x() * rw, a.y() * rw, a.z() * rw);
     }
+
+    inline GLSLMATH_CONSTEXPR14 mat2 transpose(const basic_mat<vec2, 2> &m) {
+        return mat2(m[0][0], m[1][0], m[0][1], m[1][1]);
+    }
+
+    inline GLSLMATH_CONSTEXPR14 mat3 transpose(const basic_mat<vec3, 3> &m) {
+        return mat3(vec3(m[0][0], m[1][0], m[2][0]), vec3(m[0][1], m[1][1], m[2][1]), vec3(m[0][2], m[1][2], m[2][2]));
+    }
+
+    #if defined(GLSLMATH_SSE) || defined(GLSLMATH_NEON)
+        inline mat4 transpose(const basic_mat<vec4, 4> &m) {
+            simd_float4::native_t c0 = m.get_impl()[0].get_impl().native();
+            simd_float4::native_t c1 = m.get_impl()[1].get_impl().native();
+            simd_float4::native_t c2 = m.get_impl()[2].get_impl().native();
+            simd_float4::native_t c3 = m.get_impl()[3].get_impl().native();
+            #if defined(GLSLMATH_SSE)
+                _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+                return mat4(simd_vec4(c0), simd_vec4(c1), simd_vec4(c2), simd_vec4(c3));
+            #else
+                float32x4x2_t lo = vzipq_f32(c0, c2), hi = vzipq_f32(c1, c3);
+                float32x4x2_t r01 = vzipq_f32(lo.val[0], hi.val[0]), r23 = vzipq_f32(lo.val[1], hi.val[1]);
+                return mat4(simd_vec4(r01.val[0]), simd_vec4(r01.val[1]), simd_vec4(r23.val[0]), simd_vec4(r23.val[1]));
+            #endif
+        }
+    #else
+        inline GLSLMATH_CONSTEXPR14 mat4 transpose(const basic_mat<vec4, 4> &m) {
+            return mat4(
+                vec4(m[0][0], m[1][0], m[2][0], m[3][0]), vec4(m[0][1], m[1][1], m[2][1], m[3][1]),
+                vec4(m[0][2], m[1][2], m[2][2], m[3][2]), vec4(m[0][3], m[1][3], m[2][3], m[3][3])
+            );
+        }
+    #endif
+
+    constexpr float determinant(const basic_mat<vec2, 2> &m) {
+        return m[0][0] * m[1][1] - m[1][0] * m[0][1];
+    }
+
+    constexpr float determinant(const basic_mat<vec3, 3> &m) {
+        return m[0][0] * (m[1][1] * m[2][2] - m[2][1] * m[1][2]) + m[1][0] * (m[2][1] * m[0][2] - m[0][1] * m[2][2]) + m[2][0] * (m[0][1] * m[1][2] - m[1][1] * m[0][2]);
+    }
+
+    // 4x4 determinant and inverse from cross products of the upper 3x3 columns
+    // (Lengyel, "Foundations of Game Engine Development", volume 1).
+    inline float determinant(const basic_mat<vec4, 4> &m) {
+        vec3 a = m[0].xyz(), b = m[1].xyz(), c = m[2].xyz(), d = m[3].xyz();
+        vec3 s = cross(a, b), t = cross(c, d);
+        vec3 u = a * m[1][3] - b * m[0][3], v = c * m[3][3] - d * m[2][3];
+        return dot(s, v) + dot(t, u);
+    }
+
+    // Singular matrices give infinities or NaNs, as in GLSL.
+    inline mat2 inverse(const basic_mat<vec2, 2> &m) {
+        float rdet = 1.0f / determinant(m);
+        return mat2(m[1][1] * rdet, -m[0][1] * rdet, -m[1][0] * rdet, m[0][0] * rdet);
+    }
+
+    inline mat3 inverse(const basic_mat<vec3, 3> &m) {
+        vec3 r0 = cross(m[1], m[2]), r1 = cross(m[2], m[0]), r2 = cross(m[0], m[1]);
+        float rdet = 1.0f / dot(m[0], r0);
+        return transpose(mat3(r0 * rdet, r1 * rdet, r2 * rdet));
+    }
+
+    #if defined(GLSLMATH_SSE)
+        inline simd_float4::native_t simd_cross(simd_float4::native_t a, simd_float4::native_t b) {
+            __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+            return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+        }
+
+        // The same in registers: the bottom row rides in the w lanes and the cross products clear them.
+        inline mat4 inverse(const basic_mat<vec4, 4> &m) {
+            __m128 a = m.get_impl()[0].get_impl().native(), b = m.get_impl()[1].get_impl().native();
+            __m128 c = m.get_impl()[2].get_impl().native(), d = m.get_impl()[3].get_impl().native();
+            __m128 x = simd_lane<3>(a), y = simd_lane<3>(b), z = simd_lane<3>(c), w = simd_lane<3>(d);
+            __m128 s = simd_cross(a, b), t = simd_cross(c, d);
+            __m128 u = _mm_sub_ps(_mm_mul_ps(a, y), _mm_mul_ps(b, x)), v = _mm_sub_ps(_mm_mul_ps(c, w), _mm_mul_ps(d, z));
+            __m128 rdet = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(simd_dot(s, v), simd_dot(t, u)));
+            s = _mm_mul_ps(s, rdet);
+            t = _mm_mul_ps(t, rdet);
+            u = _mm_mul_ps(u, rdet);
+            v = _mm_mul_ps(v, rdet);
+            __m128 r0 = _mm_add_ps(simd_cross(b, v), _mm_mul_ps(t, y));
+            __m128 r1 = _mm_sub_ps(simd_cross(v, a), _mm_mul_ps(t, x));
+            __m128 r2 = _mm_add_ps(simd_cross(d, u), _mm_mul_ps(s, w));
+            __m128 r3 = _mm_sub_ps(simd_cross(u, c), _mm_mul_ps(s, z));
+            // last column: -dot(b, t), dot(a, t), -dot(d, s), dot(c, s), summing the x, y and z rows of the transposed products.
+            __m128 px = _mm_mul_ps(b, t), py = _mm_mul_ps(a, t), pz = _mm_mul_ps(d, s), pw = _mm_mul_ps(c, s);
+            _MM_TRANSPOSE4_PS(px, py, pz, pw);
+            __m128 last = _mm_mul_ps(_mm_add_ps(_mm_add_ps(px, py), pz), _mm_setr_ps(-1, 1, -1, 1));
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            return mat4(simd_vec4(r0), simd_vec4(r1), simd_vec4(r2), simd_vec4(last));
+        }
+    #else
+        inline mat4 inverse(const basic_mat<vec4, 4> &m) {
+            vec3 a = m[0].xyz(), b = m[1].xyz(), c = m[2].xyz(), d = m[3].xyz();
+            float x = m[0][3], y = m[1][3], z = m[2][3], w = m[3][3];
+            vec3 s = cross(a, b), t = cross(c, d);
+            vec3 u = a * y - b * x, v = c * w - d * z;
+            float rdet = 1.0f / (dot(s, v) + dot(t, u));
+            s = s * rdet;
+            t = t * rdet;
+            u = u * rdet;
+            v = v * rdet;
+            vec3 r0 = cross(b, v) + t * y;
+            vec3 r1 = cross(v, a) - t * x;
+            vec3 r2 = cross(d, u) + s * w;
+            vec3 r3 = cross(u, c) - s * z;
+            return transpose(mat4(vec4(r0, -dot(b, t)), vec4(r1, dot(a, t)), vec4(r2, -dot(d, s)), vec4(r3, dot(c, s))));
+        }
+    #endif
+
+    // Inverse of a mat4 whose bottom row is (0, 0, 0, 1): a 3x3 inverse and a translation.
+    inline mat4 affine_inverse(const basic_mat<vec4, 4> &m) {
+        mat3 li = inverse(mat3(m[0].xyz(), m[1].xyz(), m[2].xyz()));
+        vec3 t = li * m[3].xyz();
+        return mat4(vec4(li[0], 0), vec4(li[1], 0), vec4(li[2], 0), vec4(-t.x(), -t.y(), -t.z(), 1));
+    }
+
+    // The top three rows of a mat4 with an implicit (0, 0, 0, 1) bottom row: a linear part then a translation.
+    // Composing costs 36 multiplies to the mat4's 64 and inverting needs only a 3x3 inverse.
+    class affine3x4 {
+    public:
+        affine3x4() = default;
+
+        constexpr affine3x4(const mat3 &linear, const vec3 &translation) : linear_(linear), translation_(translation) {
+        }
+
+        // drops the bottom row of m.
+        explicit affine3x4(const basic_mat<vec4, 4> &m) :
+            linear_(m[0].xyz(), m[1].xyz(), m[2].xyz()), translation_(m[3].xyz()) {
+        }
+
+        static GLSLMATH_CONSTEXPR14 affine3x4 identity() {
+            return affine3x4(mat3(1.0f), vec3(0.0f));
+        }
+
+        constexpr const mat3 &linear() const { return linear_; }
+        constexpr const vec3 &translation() const { return translation_; }
+
+        vec3 transform_point(const vec3 &p) const { return linear_ * p + translation_; }
+        GLSLMATH_CONSTEXPR14 vec3 transform_vector(const vec3 &v) const { return linear_ * v; }
+
+        mat4 to_mat4() const {
+            return mat4(vec4(linear_[0], 0), vec4(linear_[1], 0), vec4(linear_[2], 0), vec4(translation_, 1));
+        }
+
+    private:
+        mat3 linear_;
+        vec3 translation_;
+    };
+
+    // apply b then a.
+    inline affine3x4 operator*(const affine3x4 &a, const affine3x4 &b) {
+        return affine3x4(a.linear() * b.linear(), a.transform_point(b.translation()));
+    }
+
+    inline affine3x4 inverse(const affine3x4 &a) {
+        mat3 li = inverse(a.linear());
+        return affine3x4(li, vec3(0.0f) - li * a.translation());
+    }
+
+    // Inverse of a rotation and translation: transpose the rotation instead of inverting it.
+    inline affine3x4 rigid_inverse(const affine3x4 &a) {
+        mat3 lt = transpose(a.linear());
+        return affine3x4(lt, vec3(0.0f) - lt * a.translation());
+    }
     
-    std::ostream &operator << (std::ostream &os, vec2 v) {
+    inline std::ostream &operator << (std::ostream &os, vec2 v) {
         char tmp[64];
         snprintf(tmp, sizeof(tmp), "vec2(%g, %g)", v.x(), v.y());
         os << tmp;
         return os;
     }
     
-    std::ostream &operator << (std::ostream &os, vec3 v) {
+    inline std::ostream &operator << (std::ostream &os, vec3 v) {
         char tmp[64];
         snprintf(tmp, sizeof(tmp), "vec3(%g, %g, %g)", v.x(), v.y(), v.z());
         os << tmp;
         return os;
     }
     
-    std::ostream &operator << (std::ostream &os, vec4 v) {
+    inline std::ostream &operator << (std::ostream &os, vec4 v) {
         char tmp[64];
         snprintf(tmp, sizeof(tmp), "vec4(%g, %g, %g, %g)", v.x(), v.y(), v.z(), v.w());
         os << tmp;
         return os;
     }
     
-    std::ostream &operator << (std::ostream &os, mat2 v) {
+    inline std::ostream &operator << (std::ostream &os, mat2 v) {
         char tmp[64];
         snprintf(tmp, sizeof(tmp), "mat2(%g, %g, %g, %g)", v[0][0], v[0][1], v[1][0], v[1][1]);
         os << tmp;
         return os;
     }
-    
+
+    // Plain values: safe to memcpy, and arrays of them can be written directly to vertex buffers.
+    static_assert(std::is_trivially_copyable<vec2>::value && std::is_trivially_copyable<vec3>::value && std::is_trivially_copyable<vec4>::value, "vectors should be trivially copyable");
+    static_assert(std::is_trivially_copyable<mat2>::value && std::is_trivially_copyable<mat3>::value && std::is_trivially_copyable<mat4>::value, "matrices should be trivially copyable");
+
+    // The compact types are packed arrays of their bits, so arrays of them can be converted in bulk.
+    static_assert(sizeof(vec2) == 8 && sizeof(vec3) == 12 && sizeof(vec4) == 16, "float vectors should be packed");
+    static_assert(sizeof(hvec2) == 4 && sizeof(hvec3) == 6 && sizeof(hvec4) == 8, "half vectors should be packed");
+    static_assert(sizeof(u8vec4) == 4 && sizeof(i16vec3) == 6, "normalized vectors should be packed");
+    static_assert(std::is_trivially_copyable<hvec4>::value && std::is_trivially_copyable<u8vec4>::value && std::is_trivially_copyable<i16vec3>::value, "compact vectors should be trivially copyable");
+
+    // Array conversions between the compact and float types.
+    inline void convert(const hvec2 *src, vec2 *dest, size_t count) { float_from_half((const std::uint16_t*)src, (float*)dest, count * 2); }
+    inline void convert(const hvec3 *src, vec3 *dest, size_t count) { float_from_half((const std::uint16_t*)src, (float*)dest, count * 3); }
+    inline void convert(const hvec4 *src, vec4 *dest, size_t count) { float_from_half((const std::uint16_t*)src, (float*)dest, count * 4); }
+    inline void convert(const vec2 *src, hvec2 *dest, size_t count) { half_from_float((const float*)src, (std::uint16_t*)dest, count * 2); }
+    inline void convert(const vec3 *src, hvec3 *dest, size_t count) { half_from_float((const float*)src, (std::uint16_t*)dest, count * 3); }
+    inline void convert(const vec4 *src, hvec4 *dest, size_t count) { half_from_float((const float*)src, (std::uint16_t*)dest, count * 4); }
+
+    inline void convert(const u8vec4 *src, vec4 *dest, size_t count) { for (size_t i = 0; i != count; ++i) dest[i] = src[i].to_vec4(); }
+    inline void convert(const vec4 *src, u8vec4 *dest, size_t count) { for (size_t i = 0; i != count; ++i) dest[i] = u8vec4(src[i]); }
+    inline void convert(const i16vec3 *src, vec3 *dest, size_t count) { for (size_t i = 0; i != count; ++i) dest[i] = src[i].to_vec3(); }
+    inline void convert(const vec3 *src, i16vec3 *dest, size_t count) { for (size_t i = 0; i != count; ++i) dest[i] = i16vec3(src[i]); }
 }
 
 #endif
@@ -11,8 +11,15 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include <sstream>
+#include <stdexcept>
+#include <vector>
 #include "math.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
 
 namespace glslmath {
 
@@ -30,6 +37,7 @@ public:
   std::uint8_t &operator*() { return sink; }
   sizer &operator++(int) { size_++; return *this; }
   sizer &operator++() { size_++; return *this; }
+  sizer &operator+=(size_t n) { size_ += n; return *this; }
   std::ptrdiff_t operator-(const sizer &rhs) { return size_ - rhs.size_; }
 private:
   size_t size_;
@@ -65,6 +73,259 @@ struct serial {
   template <class Iter>
   static Iter wr(Iter p, const char *text) {
     while (*text) *p++ = *text++;
+    return p;
+  }
+
+  // shortest decimal digits * 10^exponent that reads back as value, nearest to it on a tie (Ryu).
+  // value must be finite and non-zero.
+  static void float_digits(float value, std::uint32_t &digits, int &exponent) {
+    static const std::uint64_t pow5_inv_split[31] = {
+        0x0800000000000001ull, 0x0666666666666667ull, 0x051eb851eb851eb9ull,
+        0x04189374bc6a7efaull, 0x068db8bac710cb2aull, 0x053e2d6238da3c22ull,
+        0x0431bde82d7b634eull, 0x06b5fca6af2bd216ull, 0x055e63b88c230e78ull,
+        0x044b82fa09b5a52dull, 0x06df37f675ef6eaeull, 0x057f5ff85e592558ull,
+        0x0465e6604b7a8447ull, 0x0709709a125da071ull, 0x05a126e1a84ae6c1ull,
+        0x0480ebe7b9d58567ull, 0x0734aca5f6226f0bull, 0x05c3bd5191b525a3ull,
+        0x049c97747490eae9ull, 0x0760f253edb4ab0eull, 0x05e72843249088d8ull,
+        0x04b8ed0283a6d3e0ull, 0x078e480405d7b966ull, 0x060b6cd004ac9452ull,
+        0x04d5f0a66a23a9dbull, 0x07bcb43d769f762bull, 0x063090312bb2c4efull,
+        0x04f3a68dbc8f03f3ull, 0x07ec3daf94180651ull, 0x065697bfa9acd1daull,
+        0x051212ffbaf0a7e2ull,
+    };
+    static const std::uint64_t pow5_split[47] = {
+        0x1000000000000000ull, 0x1400000000000000ull, 0x1900000000000000ull,
+        0x1f40000000000000ull, 0x1388000000000000ull, 0x186a000000000000ull,
+        0x1e84800000000000ull, 0x1312d00000000000ull, 0x17d7840000000000ull,
+        0x1dcd650000000000ull, 0x12a05f2000000000ull, 0x174876e800000000ull,
+        0x1d1a94a200000000ull, 0x12309ce540000000ull, 0x16bcc41e90000000ull,
+        0x1c6bf52634000000ull, 0x11c37937e0800000ull, 0x16345785d8a00000ull,
+        0x1bc16d674ec80000ull, 0x1158e460913d0000ull, 0x15af1d78b58c4000ull,
+        0x1b1ae4d6e2ef5000ull, 0x10f0cf064dd59200ull, 0x152d02c7e14af680ull,
+        0x1a784379d99db420ull, 0x108b2a2c28029094ull, 0x14adf4b7320334b9ull,
+        0x19d971e4fe8401e7ull, 0x1027e72f1f128130ull, 0x1431e0fae6d7217cull,
+        0x193e5939a08ce9dbull, 0x1f8def8808b02452ull, 0x13b8b5b5056e16b3ull,
+        0x18a6e32246c99c60ull, 0x1ed09bead87c0378ull, 0x13426172c74d822bull,
+        0x1812f9cf7920e2b6ull, 0x1e17b84357691b64ull, 0x12ced32a16a1b11eull,
+        0x178287f49c4a1d66ull, 0x1d6329f1c35ca4bfull, 0x125dfa371a19e6f7ull,
+        0x16f578c4e0a060b5ull, 0x1cb2d6f618c878e3ull, 0x11efc659cf7d4b8dull,
+        0x166bb7f0435c9e71ull, 0x1c06a5ec5433c60dull,
+    };
+    struct f {
+      static int pow5bits(int e) { return (int)(((std::uint32_t)e * 1217359) >> 19) + 1; }
+      static std::uint32_t log10pow2(int e) { return ((std::uint32_t)e * 78913) >> 18; }
+      static std::uint32_t log10pow5(int e) { return ((std::uint32_t)e * 732923) >> 20; }
+      static bool pow5_divides(std::uint32_t v, std::uint32_t p) {
+        std::uint32_t count = 0;
+        for (; v % 5 == 0; v /= 5) ++count;
+        return count >= p;
+      }
+      static std::uint32_t mul_shift(std::uint32_t m, std::uint64_t factor, int shift) {
+        std::uint64_t lo = (std::uint64_t)m * (std::uint32_t)factor;
+        std::uint64_t hi = (std::uint64_t)m * (std::uint32_t)(factor >> 32);
+        return (std::uint32_t)(((lo >> 32) + hi) >> (shift - 32));
+      }
+    };
+
+    std::uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    std::uint32_t mantissa = bits & 0x7fffff, biased = (bits >> 23) & 0xff;
+    int e2 = (biased ? (int)biased : 1) - 127 - 23 - 2;
+    std::uint32_t m2 = biased ? mantissa | 0x800000 : mantissa;
+    bool even = (m2 & 1) == 0;
+
+    // the interval of decimals that round to value, as mm < mv < mp scaled by 4.
+    std::uint32_t mv = 4 * m2, mp = 4 * m2 + 2;
+    std::uint32_t mm_shift = mantissa != 0 || biased <= 1;
+    std::uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+    std::uint32_t vr, vp, vm;
+    int e10;
+    bool vm_zeros = false, vr_zeros = false;
+    std::uint32_t last_removed = 0;
+    if (e2 >= 0) {
+      std::uint32_t q = f::log10pow2(e2);
+      e10 = (int)q;
+      int i = -e2 + (int)q + 59 + f::pow5bits((int)q) - 1;
+      vr = f::mul_shift(mv, pow5_inv_split[q], i);
+      vp = f::mul_shift(mp, pow5_inv_split[q], i);
+      vm = f::mul_shift(mm, pow5_inv_split[q], i);
+      if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+        int l = -e2 + (int)q - 1 + 59 + f::pow5bits((int)q - 1) - 1;
+        last_removed = f::mul_shift(mv, pow5_inv_split[q - 1], l) % 10;
+      }
+      if (q <= 9) {
+        if (mv % 5 == 0) {
+          vr_zeros = f::pow5_divides(mv, q);
+        } else if (even) {
+          vm_zeros = f::pow5_divides(mm, q);
+        } else {
+          vp -= f::pow5_divides(mp, q);
+        }
+      }
+    } else {
+      std::uint32_t q = f::log10pow5(-e2);
+      e10 = (int)q + e2;
+      int i = -e2 - (int)q;
+      int j = (int)q - (f::pow5bits(i) - 61);
+      vr = f::mul_shift(mv, pow5_split[i], j);
+      vp = f::mul_shift(mp, pow5_split[i], j);
+      vm = f::mul_shift(mm, pow5_split[i], j);
+      if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+        j = (int)q - 1 - (f::pow5bits(i + 1) - 61);
+        last_removed = f::mul_shift(mv, pow5_split[i + 1], j) % 10;
+      }
+      if (q <= 1) {
+        vr_zeros = true;
+        if (even) {
+          vm_zeros = mm_shift == 1;
+        } else {
+          --vp;
+        }
+      } else if (q < 31) {
+        vr_zeros = (mv & ((1u << (q - 1)) - 1)) == 0;
+      }
+    }
+
+    // drop digits while the interval still holds a shorter decimal.
+    int removed = 0;
+    if (vm_zeros || vr_zeros) {
+      for (; vp / 10 > vm / 10; ++removed) {
+        vm_zeros &= vm % 10 == 0;
+        vr_zeros &= last_removed == 0;
+        last_removed = vr % 10;
+        vr /= 10; vp /= 10; vm /= 10;
+      }
+      if (vm_zeros) {
+        for (; vm % 10 == 0; ++removed) {
+          vr_zeros &= last_removed == 0;
+          last_removed = vr % 10;
+          vr /= 10; vp /= 10; vm /= 10;
+        }
+      }
+      if (vr_zeros && last_removed == 5 && vr % 2 == 0) last_removed = 4;
+      digits = vr + ((vr == vm && (!even || !vm_zeros)) || last_removed >= 5);
+    } else {
+      for (; vp / 10 > vm / 10; ++removed) {
+        last_removed = vr % 10;
+        vr /= 10; vp /= 10; vm /= 10;
+      }
+      digits = vr + (vr == vm || last_removed >= 5);
+    }
+    exponent = e10 + removed;
+  }
+
+  // shortest text that reads back as the same float, in the layout of std::to_chars:
+  // fixed unless scientific is shorter. At most 15 characters.
+  static char *fmt_float(char *p, float value) {
+    std::uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits >> 31) *p++ = '-';
+    if ((bits & 0x7f800000) == 0x7f800000) return wr(p, bits & 0x7fffff ? "nan" : "inf");
+    if ((bits & 0x7fffffff) == 0) {
+      *p++ = '0';
+      return p;
+    }
+
+    std::uint32_t digits;
+    int exponent;
+    float_digits(value, digits, exponent);
+    char tmp[10];
+    int n = 0;
+    for (; digits; digits /= 10) tmp[9 - n++] = (char)('0' + digits % 10);
+    const char *d = tmp + 10 - n;
+
+    // x is the power of ten of the first digit.
+    int x = exponent + n - 1;
+    int fixed_len = x >= n - 1 ? x + 1 : x >= 0 ? n + 1 : n + 1 - x;
+    int sci_len = n + (n > 1) + 4;
+    if (fixed_len <= sci_len) {
+      if (x < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = -1; i != x; --i) *p++ = '0';
+        for (int i = 0; i != n; ++i) *p++ = d[i];
+      } else if (x >= n - 1) {
+        // an integer, which is printed exactly rather than as the digits padded with zeros.
+        p = fmt_uint(p, (std::uint64_t)(value < 0 ? -value : value));
+      } else {
+        for (int i = 0; i != n; ++i) {
+          *p++ = d[i];
+          if (i == x) *p++ = '.';
+        }
+      }
+    } else {
+      *p++ = d[0];
+      if (n > 1) *p++ = '.';
+      for (int i = 1; i != n; ++i) *p++ = d[i];
+      *p++ = 'e';
+      *p++ = x < 0 ? '-' : '+';
+      int ax = x < 0 ? -x : x;
+      *p++ = (char)('0' + ax / 10);
+      *p++ = (char)('0' + ax % 10);
+    }
+    return p;
+  }
+
+  static char *fmt_uint(char *p, std::uint64_t value) {
+    char tmp[24];
+    char *t = tmp;
+    do {
+      *t++ = (char)('0' + value % 10);
+      value /= 10;
+    } while (value);
+    while (t != tmp) *p++ = *--t;
+    return p;
+  }
+
+  // write a block of bytes. Contiguous destinations use memcpy.
+  template <class Iter>
+  static Iter wrbytes(Iter p, const void *src, size_t n) {
+    const std::uint8_t *s = (const std::uint8_t *)src;
+    for (size_t i = 0; i != n; ++i) *p++ = s[i];
+    return p;
+  }
+
+  static std::uint8_t *wrbytes(std::uint8_t *p, const void *src, size_t n) {
+    if (n) memcpy(p, src, n);
+    return p + n;
+  }
+
+  static std::vector<std::uint8_t>::iterator wrbytes(std::vector<std::uint8_t>::iterator p, const void *src, size_t n) {
+    if (n) memcpy(&*p, src, n);
+    return p + n;
+  }
+
+  static sizer wrbytes(sizer p, const void *, size_t n) {
+    return p += n;
+  }
+
+  // write an array of native scalars in little endian order.
+  template <class Iter>
+  static Iter wrscalars(Iter p, const void *src, size_t count, size_t scalar_size) {
+    if (is_little_endian() || scalar_size == 1) {
+      return wrbytes(p, src, count * scalar_size);
+    }
+    const std::uint8_t *s = (const std::uint8_t *)src;
+    for (size_t i = 0; i != count; ++i, s += scalar_size) {
+      for (size_t j = scalar_size; j != 0; --j) *p++ = s[j-1];
+    }
+    return p;
+  }
+
+  static bool is_little_endian() {
+    const std::uint16_t one = 1;
+    std::uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+  }
+
+  // bytes used by wrtxt and by a chunk with this tag and content size.
+  static size_t txt_size(const char *text) {
+    return (strlen(text) + 4) & ~(size_t)3;
+  }
+
+  static size_t chunk_size(const char *tag, size_t content_size) {
+    return txt_size(tag) + ((content_size + 7) & ~(size_t)3);
   }
 
   template <class Iter>
@@ -91,8 +352,14 @@ struct serial {
   struct chunk {
     Iter len;
     Iter &p;
+  #if defined(GLSLMATH_STATS)
+    char tag[8];
+  #endif
 
     chunk(Iter &p, const char *tag) : p(p) {
+    #if defined(GLSLMATH_STATS)
+      snprintf(this->tag, sizeof(this->tag), "%s", tag);
+    #endif
       p = wrtxt(p, tag);
       len = p;
       p = wr32(p, 0);
@@ -101,25 +368,122 @@ struct serial {
     ~chunk() {
       wr32(len, (int)(p - len));
       p = align4(p, len);
+    #if defined(GLSLMATH_STATS)
+      if (writes_bytes(p)) GLSLMATH_STATS_BYTES(tag, (p - len) + txt_size(tag));
+    #endif
     }
   };
+
+  // false for a sizer, which only measures.
+  template <class Iter>
+  static bool writes_bytes(const Iter &) { return true; }
+  static bool writes_bytes(const sizer &) { return false; }
 };
 
+// attribute format of the scalar type of a vector, for attribute::make and attribute::vertices.
+template <class Scalar> struct scalar_format;
+
+template <> struct scalar_format<float> { enum { size = 4, is_float = 1, is_unsigned = 0, is_normalized = 0 }; };
+template <> struct scalar_format<half> { enum { size = 2, is_float = 1, is_unsigned = 0, is_normalized = 0 }; };
+template <> struct scalar_format<int> { enum { size = 4, is_float = 0, is_unsigned = 0, is_normalized = 0 }; };
+template <> struct scalar_format<unorm8> { enum { size = 1, is_float = 0, is_unsigned = 1, is_normalized = 1 }; };
+template <> struct scalar_format<snorm16> { enum { size = 2, is_float = 0, is_unsigned = 0, is_normalized = 1 }; };
+
 class attribute : public serial {
 public:
+  // attribute stored as V, eg. make<hvec2>("uv") or make<u8vec4>("colour").
+  template <class V>
+  static attribute make(const std::string &name) {
+    typedef scalar_format<typename V::scalar_t> fmt;
+    return attribute(name, V::size(), fmt::size, fmt::is_float != 0, fmt::is_unsigned != 0, fmt::is_normalized != 0);
+  }
+
   attribute(const std::string &name="", size_t num_elems=3, size_t element_size=4, bool is_float=true, bool is_unsigned=false, bool is_normalized=false)
   : name_(name), vector_elems_(num_elems), scalar_size_(element_size), is_float_(is_float), is_unsigned_(is_unsigned), is_normalized_(is_normalized) {
+    if (num_elems < 1 || num_elems > 4) throw(std::range_error("attribute: expected 1..4 elements"));
+    if (is_float ? (element_size != 2 && element_size != 4) : (element_size != 1 && element_size != 2 && element_size != 4)) {
+      throw(std::range_error("attribute: unsupported scalar size"));
+    }
   }
   
   const std::string &name() const { return name_; }
 
-  std::vector<vec4> &data() { return vertices_; }
-  const std::vector<vec4> &data() const { return vertices_; }
+  // raw vertex data in the declared format, vertex_size() bytes per vertex.
+  std::vector<std::uint8_t> &data() { return data_; }
+  const std::vector<std::uint8_t> &data() const { return data_; }
+
+  // typed view of the scalars, vector_elems() per vertex. T must match the declared format.
+  template <class T>
+  T *elements() { check_view<T>(); return reinterpret_cast<T*>(data_.data()); }
+
+  template <class T>
+  const T *elements() const { check_view<T>(); return reinterpret_cast<const T*>(data_.data()); }
+
+  // typed view of the vertices, eg. vertices<vec3>() for "a3f" or vertices<hvec2>() for "a2h".
+  // Throws if V does not match the declared format exactly.
+  template <class V>
+  V *vertices() { check_vertices<V>(); return reinterpret_cast<V*>(data_.data()); }
+
+  template <class V>
+  const V *vertices() const { check_vertices<V>(); return reinterpret_cast<const V*>(data_.data()); }
+
+  // decode count vertices starting at first, as operator[] but in bulk.
+  // Half and float formats convert a block at a time, half with F16C or NEON where available.
+  void get(size_t first, vec4 *dest, size_t count) const {
+    if (is_float_ && scalar_size_ == 4) {
+      unpack(elements<float>() + first * vector_elems_, dest, count);
+    } else if (is_float_) {
+      const std::uint16_t *src = elements<std::uint16_t>() + first * vector_elems_;
+      float tmp[block * 4];
+      for (size_t i = 0; i < count; i += block) {
+        size_t n = std::min(count - i, (size_t)block);
+        float_from_half(src + i * vector_elems_, tmp, n * vector_elems_);
+        unpack(tmp, dest + i, n);
+      }
+    } else {
+      for (size_t i = 0; i != count; ++i) dest[i] = (*this)[first + i];
+    }
+  }
+
+  // encode count vertices starting at first, as set() but in bulk.
+  void set(size_t first, const vec4 *src, size_t count) {
+    if (is_float_ && scalar_size_ == 4) {
+      pack(src, elements<float>() + first * vector_elems_, count);
+    } else if (is_float_) {
+      std::uint16_t *dest = elements<std::uint16_t>() + first * vector_elems_;
+      float tmp[block * 4];
+      for (size_t i = 0; i < count; i += block) {
+        size_t n = std::min(count - i, (size_t)block);
+        pack(src + i, tmp, n);
+        half_from_float(tmp, dest + i * vector_elems_, n * vector_elems_);
+      }
+    } else {
+      for (size_t i = 0; i != count; ++i) set(first + i, src[i]);
+    }
+  }
+
+  // copy of this attribute re-encoded as V, eg. normals.as<i16vec3>() to halve the memory of "a3f" normals.
+  template <class V>
+  attribute as() const {
+    attribute res = make<V>(name_);
+    size_t num_vertices = vertex_count();
+    res.resize(num_vertices);
+    vec4 tmp[block];
+    for (size_t i = 0; i < num_vertices; i += block) {
+      size_t n = std::min(num_vertices - i, (size_t)block);
+      get(i, tmp, n);
+      res.set(i, tmp, n);
+    }
+    return res;
+  }
   
-  vec4 operator[](size_t i) const { return vertices_[i]; }
-  size_t vertex_count() const { return vertices_.size(); }
+  vec4 operator[](size_t i) const { return decode(&data_[i * vertex_size()]); }
+  size_t vertex_count() const { return data_.size() / vertex_size(); }
   
-  void resize(size_t size) { vertices_.resize(size * vertex_size()); }
+  void resize(size_t size) { data_.resize(size * vertex_size()); }
+  void reserve(size_t size) { data_.reserve(size * vertex_size()); }
+
+  void set(size_t i, const vec4 &v) { encode(&data_[i * vertex_size()], v); }
   
   size_t vector_elems() const { return vector_elems_; }
   size_t vertex_size() const { return vector_elems_ * scalar_size_; }
@@ -140,15 +504,97 @@ public:
   }
 
   void push(const vec4 &v) {
-    vertices_.push_back(v);
+    size_t size = data_.size();
+    data_.resize(size + vertex_size());
+    encode(&data_[size], v);
   }
 
   void push(const vec3 &v) {
-    vertices_.push_back(vec4(v, 1));
+    push(vec4(v, 1));
   }
 
   void push(const vec2 &v) {
-    vertices_.push_back(vec4(v, 0, 1));
+    push(vec4(v, 0, 1));
+  }
+
+  // append vertex i of an attribute with the same format without conversion.
+  void push_raw(const attribute &src, size_t i) {
+    size_t vs = vertex_size();
+    const std::uint8_t *p = &src.data_[i * vs];
+    data_.insert(data_.end(), p, p + vs);
+  }
+
+  // load up to eight vertices starting at first into a packet. Missing lanes are zero.
+  void gather(size_t first, vec4x8 &dest) const {
+    float lanes[4][8] = {};
+    size_t count = std::min(vertex_count() - first, (size_t)8);
+    vec4 tmp[8];
+    get(first, tmp, count);
+    for (size_t i = 0; i != count; ++i) {
+      const vec4 &v = tmp[i];
+      lanes[0][i] = v[0];
+      lanes[1][i] = v[1];
+      lanes[2][i] = v[2];
+      lanes[3][i] = v[3];
+    }
+    dest = vec4x8(float8::load(lanes[0]), float8::load(lanes[1]), float8::load(lanes[2]), float8::load(lanes[3]));
+  }
+
+  void gather(size_t first, vec3x8 &dest) const {
+    vec4x8 tmp;
+    gather(first, tmp);
+    dest = tmp.xyz();
+  }
+
+  // store up to eight vertices starting at first from a packet. Lanes past the end are dropped.
+  void scatter(size_t first, const vec4x8 &src) {
+    float lanes[4][8];
+    src.x().store(lanes[0]);
+    src.y().store(lanes[1]);
+    src.z().store(lanes[2]);
+    src.w().store(lanes[3]);
+    size_t count = std::min(vertex_count() - first, (size_t)8);
+    vec4 tmp[8];
+    for (size_t i = 0; i != count; ++i) {
+      tmp[i] = vec4(lanes[0][i], lanes[1][i], lanes[2][i], lanes[3][i]);
+    }
+    set(first, tmp, count);
+  }
+
+  void scatter(size_t first, const vec3x8 &src) {
+    scatter(first, vec4x8(src, float8(1)));
+  }
+
+  // chunk tag for the data, eg. "a3f" for three floats or "a4Bn" for normalized unsigned bytes.
+  std::string format_tag() const {
+    static const char int_types[] = "bsxiBSxI";
+    std::string tag = "a";
+    tag += (char)('0' + vector_elems_);
+    if (is_float_) {
+      tag += scalar_size_ == 2 ? 'h' : 'f';
+    } else {
+      tag += int_types[(is_unsigned_ ? 4 : 0) + scalar_size_ - 1];
+      if (is_normalized_) tag += 'n';
+    }
+    return tag;
+  }
+
+  // inverse of format_tag(), returns false if the tag is not an attribute data tag.
+  static bool parse_format_tag(const char *tag, attribute &params) {
+    static const char int_types[] = "bsxiBSxI";
+    if (tag[0] != 'a' || tag[1] < '1' || tag[1] > '4' || !tag[2]) return false;
+    size_t elems = (size_t)(tag[1] - '0');
+    bool norm = tag[3] == 'n';
+    if (tag[3] && (!norm || tag[4])) return false;
+    if ((tag[2] == 'f' || tag[2] == 'h') && !tag[3]) {
+      params = attribute(params.name(), elems, tag[2] == 'f' ? 4 : 2, true);
+      return true;
+    }
+    const char *t = strchr(int_types, tag[2]);
+    if (!t || *t == 'x') return false;
+    size_t idx = (size_t)(t - int_types);
+    params = attribute(params.name(), elems, (idx & 3) + 1, false, idx >= 4, norm);
+    return true;
   }
 
   template <class Iter>
@@ -160,31 +606,130 @@ public:
         p = wrtxt(p, name_.c_str());
       }
       {
-        chunk<Iter> atf(p, "a3f");
-        union { std::uint8_t u[4]; float f; } u;
-        for (auto v : vertices_) {
-          u.f = v[0];
-          *p++ = u.u[0];
-          *p++ = u.u[1];
-          *p++ = u.u[2];
-          *p++ = u.u[3];
-          u.f = v[1];
-          *p++ = u.u[0];
-          *p++ = u.u[1];
-          *p++ = u.u[2];
-          *p++ = u.u[3];
-          u.f = v[2];
-          *p++ = u.u[0];
-          *p++ = u.u[1];
-          *p++ = u.u[2];
-          *p++ = u.u[3];
-        }
+        chunk<Iter> atf(p, format_tag().c_str());
+        p = wrscalars(p, data_.data(), data_.size() / scalar_size_, scalar_size_);
       }
     }
     return p;
   }
+
+  // size of write_binary() without writing anything.
+  size_t binary_size() const {
+    size_t content = chunk_size("atn", txt_size(name_.c_str())) + chunk_size(format_tag().c_str(), data_.size());
+    return chunk_size("ATR", content);
+  }
   
 private:
+  template <class T>
+  void check_view() const {
+    if (sizeof(T) != scalar_size_) throw(std::range_error("attribute: view type does not match scalar size"));
+  }
+
+  template <class V>
+  void check_vertices() const {
+    typedef scalar_format<typename V::scalar_t> fmt;
+    if (V::size() != vector_elems_ || fmt::size != scalar_size_ || (fmt::is_float != 0) != is_float_ ||
+      (!is_float_ && ((fmt::is_unsigned != 0) != is_unsigned_ || (fmt::is_normalized != 0) != is_normalized_))) {
+      throw(std::range_error("attribute: vertex type does not match format"));
+    }
+  }
+
+  // vertices per block for the bulk conversions.
+  enum { block = 256 };
+
+  // packed floats, vector_elems_ per vertex, to and from vec4 with the operator[] defaults for missing elements.
+  void unpack(const float *src, vec4 *dest, size_t count) const {
+    size_t e = vector_elems_;
+    if (e == 4) {
+      memcpy((void*)dest, src, count * sizeof(vec4));
+      return;
+    }
+    for (size_t i = 0; i != count; ++i, src += e) {
+      dest[i] = vec4(src[0], e > 1 ? src[1] : 0.0f, e > 2 ? src[2] : 0.0f, 1.0f);
+    }
+  }
+
+  void pack(const vec4 *src, float *dest, size_t count) const {
+    size_t e = vector_elems_;
+    if (e == 4) {
+      memcpy(dest, (const void*)src, count * sizeof(vec4));
+      return;
+    }
+    for (size_t i = 0; i != count; ++i, dest += e) {
+      for (size_t j = 0; j != e; ++j) dest[j] = src[i][j];
+    }
+  }
+
+  // scale for normalized integer formats.
+  float norm_scale() const {
+    std::uint32_t bits = (std::uint32_t)scalar_size_ * 8 - (is_unsigned_ ? 0 : 1);
+    return (float)((bits == 32 ? 0xffffffffull : (1ull << bits) - 1));
+  }
+
+  void encode(std::uint8_t *dest, const vec4 &v) const {
+    if (is_float_ && scalar_size_ == 4) {
+      float f[4] = { v[0], v[1], v[2], v[3] };
+      memcpy(dest, f, vector_elems_ * 4);
+      return;
+    }
+    for (size_t i = 0; i != vector_elems_; ++i, dest += scalar_size_) {
+      float value = v[i];
+      if (is_float_) {
+        std::uint16_t h = half_from_float(value);
+        memcpy(dest, &h, 2);
+        continue;
+      }
+      if (is_normalized_) {
+        float lo = is_unsigned_ ? 0.0f : -1.0f;
+        value = (value < lo ? lo : value > 1.0f ? 1.0f : value) * norm_scale();
+      }
+      double r = std::floor((double)value + 0.5);
+      if (is_unsigned_) {
+        std::uint32_t u = r <= 0 ? 0 : r >= 4294967295.0 ? 0xffffffffu : (std::uint32_t)r;
+        if (scalar_size_ == 1) { std::uint8_t x = (std::uint8_t)u; memcpy(dest, &x, 1); }
+        else if (scalar_size_ == 2) { std::uint16_t x = (std::uint16_t)u; memcpy(dest, &x, 2); }
+        else { memcpy(dest, &u, 4); }
+      } else {
+        std::int32_t s = r <= -2147483648.0 ? INT32_MIN : r >= 2147483647.0 ? INT32_MAX : (std::int32_t)r;
+        if (scalar_size_ == 1) { std::int8_t x = (std::int8_t)s; memcpy(dest, &x, 1); }
+        else if (scalar_size_ == 2) { std::int16_t x = (std::int16_t)s; memcpy(dest, &x, 2); }
+        else { memcpy(dest, &s, 4); }
+      }
+    }
+  }
+
+  vec4 decode(const std::uint8_t *src) const {
+    float f[4] = { 0, 0, 0, 1 };
+    if (is_float_ && scalar_size_ == 4) {
+      memcpy(f, src, vector_elems_ * 4);
+      return vec4(f[0], f[1], f[2], f[3]);
+    }
+    for (size_t i = 0; i != vector_elems_; ++i, src += scalar_size_) {
+      if (is_float_) {
+        std::uint16_t h;
+        memcpy(&h, src, 2);
+        f[i] = float_from_half(h);
+        continue;
+      }
+      double value;
+      if (is_unsigned_) {
+        if (scalar_size_ == 1) { std::uint8_t x; memcpy(&x, src, 1); value = x; }
+        else if (scalar_size_ == 2) { std::uint16_t x; memcpy(&x, src, 2); value = x; }
+        else { std::uint32_t x; memcpy(&x, src, 4); value = x; }
+      } else {
+        if (scalar_size_ == 1) { std::int8_t x; memcpy(&x, src, 1); value = x; }
+        else if (scalar_size_ == 2) { std::int16_t x; memcpy(&x, src, 2); value = x; }
+        else { std::int32_t x; memcpy(&x, src, 4); value = x; }
+      }
+      if (is_normalized_) {
+        value /= norm_scale();
+        if (value < -1) value = -1;
+      }
+      f[i] = (float)value;
+    }
+    return vec4(f[0], f[1], f[2], f[3]);
+  }
+
   // name of the mesh.
   std::string name_;
   
@@ -194,7 +739,7 @@ private:
   // number of bytes in the scalar
   size_t scalar_size_;
 
-  // scalar is float 16, 32, 64
+  // scalar is float 16, 32
   bool is_float_;
   
   // integer scalar is unsigned
@@ -203,8 +748,8 @@ private:
   // integer scalar represents a floating point number.
   bool is_normalized_;
 
-  // the data itself.
-  std::vector<vec4> vertices_;
+  // the data itself, packed in the declared format.
+  std::vector<std::uint8_t> data_;
 };
 
 /// single component mesh
@@ -239,6 +784,7 @@ public:
 
   template <class Iter>
   Iter write_binary(Iter p) const {
+    GLSLMATH_STATS_SCOPE("mesh.write_binary");
     {
       chunk<Iter> MSH(p, "MSH");
 
@@ -254,14 +800,16 @@ public:
       {
         if (index_size_ == 2) {
           chunk<Iter> ix2(p, "ix2");
-          for (auto idx : indices_) {
-            p = wr16(p, idx);
+          // narrow through a small buffer so that the bytes go out in blocks.
+          std::uint16_t tmp[1024];
+          for (size_t i = 0; i < indices_.size(); i += 1024) {
+            size_t n = std::min(indices_.size() - i, (size_t)1024);
+            for (size_t j = 0; j != n; ++j) tmp[j] = (std::uint16_t)indices_[i + j];
+            p = wrscalars(p, tmp, n, 2);
           }
         } else {
           chunk<Iter> ix2(p, "ix4");
-          for (auto idx : indices_) {
-            p = wr32(p, idx);
-          }
+          p = wrscalars(p, indices_.data(), indices_.size(), 4);
         }
       }
     }
@@ -269,86 +817,329 @@ public:
     return p;
   }
 
-  // generate normals for this mesh.
-  void generate_normals() {
+  // size of write_binary() without writing anything.
+  size_t binary_size() const {
+    size_t content = chunk_size("msh", txt_size(name_.c_str()));
+    for (auto &a : attrs_) {
+      content += a.binary_size();
+    }
+    content += chunk_size(index_size_ == 2 ? "ix2" : "ix4", indices_.size() * (index_size_ == 2 ? 2 : 4));
+    return chunk_size("MSH", content);
+  }
+
+  // serialize in one pass into a buffer of exactly binary_size() bytes.
+  std::vector<std::uint8_t> to_binary() const {
+    std::vector<std::uint8_t> result(binary_size());
+    write_binary(result.data());
+    return result;
+  }
+
+  // How face normals are weighted when summed at a vertex.
+  enum normal_weighting {
+    area_weighted,  // by the area of the triangle
+    angle_weighted, // by the angle of the triangle at the vertex
+  };
+
+  // Scratch space for compute_normals; keep one to avoid allocation when normals are recomputed.
+  struct normal_scratch {
+    std::vector<vec3> face_normals;
+    std::vector<float> corner_weights;
+    std::vector<index_type> first_corner;
+    std::vector<index_type> corners;
+  };
+
+  // Add a "normal" attribute if there is not one already. num_threads zero is one thread per core.
+  void generate_normals(normal_weighting weighting=area_weighted, size_t num_threads=0) {
     if (find_attribute("normal") != bad_attr) return;
     
     size_t normal_attr = add_attribute("normal");
+    normal_scratch scratch;
+    compute_normals(normal_attr, scratch, weighting, num_threads);
+  }
+
+  // (Re)compute the normal attribute normal_attr from "pos" and the triangles.
+  // threads is a thread count or a thread_pool.
+  // A vertex-to-corner table is built with a counting sort and each vertex then gathers its
+  // own faces in triangle order, so there are no atomics and the result does not depend on the thread count.
+  template <class Threads>
+  void compute_normals(size_t normal_attr, normal_scratch &scratch, normal_weighting weighting, Threads &&threads) {
+    GLSLMATH_STATS_SCOPE("mesh.compute_normals");
+    static const size_t block = 4096;
     size_t pos_attr = find_attribute("pos");
-    std::cout << "normal_attr=" << normal_attr << "\n";
-    std::cout << "normal_attr=" << normal_attr << "\n";
+    const attribute &pos = attrs_[pos_attr];
+    size_t num_vertices = pos.vertex_count();
+    size_t num_faces = indices_.size() / 3;
+    size_t num_corners = num_faces * 3;
+    size_t num_blocks = (num_faces + block - 1) / block;
 
-    attribute &pos = attrs_[pos_attr];
-    
-    std::vector<vec3> normals(pos.vertex_count());
-    std::fill(normals.begin(), normals.end(), vec3(0));
-    size_t icount = indices_.size();
-    for (size_t i = 0; i + 2 < icount; i += 3) {
-      size_t ai = indices_[i];
-      size_t bi = indices_[i+1];
-      size_t ci = indices_[i+2];
-      vec3 a = pos[ai].xyz();
-      vec3 b = pos[bi].xyz();
-      vec3 c = pos[ci].xyz();
-      vec3 normal = cross((b-a), (c-a));
-      //std::cout << a << " " << b << " " << c << " " << normal << "\n";
-      normals[ai] += normal;
-      normals[bi] += normal;
-      normals[ci] += normal;
-    }
+    // face normals, scaled by twice the area.
+    std::vector<vec3> &face_normals = scratch.face_normals;
+    std::vector<float> &corner_weights = scratch.corner_weights;
+    face_normals.resize(num_faces);
+    corner_weights.resize(weighting == angle_weighted ? num_corners : 0);
+    parallel_for(num_blocks, threads, [&](size_t b) {
+      for (size_t f = b * block, e = std::min(f + block, num_faces); f != e; ++f) {
+        vec3 p[3] = { pos[indices_[f*3]].xyz(), pos[indices_[f*3+1]].xyz(), pos[indices_[f*3+2]].xyz() };
+        vec3 normal = cross((p[1]-p[0]), (p[2]-p[0]));
+        if (weighting == angle_weighted) {
+          for (size_t c = 0; c != 3; ++c) {
+            vec3 u = p[(c+1)%3] - p[c];
+            vec3 v = p[(c+2)%3] - p[c];
+            corner_weights[f*3+c] = std::atan2(length(cross(u, v)), dot(u, v));
+          }
+          float len2 = dot(normal, normal);
+          normal = len2 > 0 ? vec3(normal * (1.0f / std::sqrt(len2))) : vec3(0);
+        }
+        face_normals[f] = normal;
+      }
+    });
+
+    // corners sorted by vertex, in triangle order for each vertex.
+    std::vector<index_type> &first_corner = scratch.first_corner;
+    std::vector<index_type> &corners = scratch.corners;
+    first_corner.assign(num_vertices + 1, 0);
+    for (size_t i = 0; i != num_corners; ++i) ++first_corner[indices_[i] + 1];
+    for (size_t v = 0; v != num_vertices; ++v) first_corner[v + 1] += first_corner[v];
+    corners.resize(num_corners);
+    for (size_t i = 0; i != num_corners; ++i) corners[first_corner[indices_[i]]++] = (index_type)i;
+    for (size_t v = num_vertices; v != 0; --v) first_corner[v] = first_corner[v - 1];
+    first_corner[0] = 0;
 
     attribute &normal = attrs_[normal_attr];
-    for (auto &n : normals) {
-      if (dot(n, n) >= 1.0e-6f) {
-        normal.push(normalized(n));
+    normal.resize(num_vertices);
+    parallel_for((num_vertices + block - 1) / block, threads, [&](size_t b) {
+      for (size_t v = b * block, e = std::min(v + block, num_vertices); v != e; ++v) {
+        vec3 n(0);
+        for (size_t c = first_corner[v]; c != first_corner[v + 1]; ++c) {
+          size_t corner = corners[c];
+          if (weighting == angle_weighted) {
+            n += face_normals[corner / 3] * corner_weights[corner];
+          } else {
+            n += face_normals[corner / 3];
+          }
+        }
+        if (dot(n, n) >= 1.0e-6f) {
+          normal.set(v, vec4(normalized(n), 1));
+        } else {
+          normal.set(v, vec4(1, 0, 0, 1));
+        }
+      }
+    });
+  }
+
+  // Merge vertices whose positions fall in the same cell of a grid with spacing tolerance
+  // (zero for bitwise equal positions). With match_attributes the other attributes must also be equal.
+  // The lowest numbered vertex of each group is kept, indices are remapped and every attribute is compacted.
+  // Returns the new vertex count. Vertices are hashed into partitions that are welded in parallel,
+  // so the result does not depend on num_threads (zero for one per core).
+  size_t weld(float tolerance=0, bool match_attributes=false, size_t num_threads=0) {
+    typedef std::uint64_t key_type;
+    static const size_t partition_bits = 6;
+    static const size_t num_partitions = (size_t)1 << partition_bits;
+    static const size_t block = 4096;
+    size_t pos_attr = find_attribute("pos");
+    if (pos_attr == bad_attr) return 0;
+    const attribute &pos = attrs_[pos_attr];
+    size_t num_vertices = pos.vertex_count();
+    size_t num_blocks = (num_vertices + block - 1) / block;
+
+    // grid cell (or float bits) of each position and a hash of it and any attributes to match.
+    std::vector<key_type> keys(num_vertices * 3);
+    std::vector<key_type> hashes(num_vertices);
+    float scale = tolerance > 0 ? 1.0f / tolerance : 0;
+    parallel_for(num_blocks, num_threads, [&](size_t b) {
+      for (size_t v = b * block, e = std::min(v + block, num_vertices); v != e; ++v) {
+        vec4 p = pos[v];
+        key_type h = 0;
+        for (size_t c = 0; c != 3; ++c) {
+          // adding zero turns -0 into +0.
+          float x = scale ? std::floor(p[c] * scale + 0.5f) : p[c] + 0.0f;
+          key_type k;
+          if (scale) {
+            k = (key_type)(std::int64_t)x;
+          } else {
+            std::uint32_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            k = bits;
+          }
+          keys[v * 3 + c] = k;
+          h = hash_mix(h ^ k);
+        }
+        for (size_t a = 0; match_attributes && a != attrs_.size(); ++a) {
+          if (a == pos_attr) continue;
+          const attribute &attr = attrs_[a];
+          const std::uint8_t *d = &attr.data()[v * attr.vertex_size()];
+          for (size_t i = 0; i != attr.vertex_size(); ++i) h = (h ^ d[i]) * 0x100000001b3ull;
+        }
+        hashes[v] = hash_mix(h);
+      }
+    });
+
+    auto same = [&](size_t u, size_t v) {
+      if (keys[u*3] != keys[v*3] || keys[u*3+1] != keys[v*3+1] || keys[u*3+2] != keys[v*3+2]) return false;
+      for (size_t a = 0; match_attributes && a != attrs_.size(); ++a) {
+        if (a == pos_attr) continue;
+        const attribute &attr = attrs_[a];
+        size_t vs = attr.vertex_size();
+        if (std::memcmp(&attr.data()[u * vs], &attr.data()[v * vs], vs)) return false;
+      }
+      return true;
+    };
+
+    // vertices sorted by partition, in vertex order within each.
+    std::vector<index_type> first(num_partitions + 1, 0);
+    for (size_t v = 0; v != num_vertices; ++v) ++first[(hashes[v] >> (64 - partition_bits)) + 1];
+    for (size_t p = 0; p != num_partitions; ++p) first[p + 1] += first[p];
+    std::vector<index_type> sorted(num_vertices);
+    {
+      std::vector<index_type> fill(first.begin(), first.end() - 1);
+      for (size_t v = 0; v != num_vertices; ++v) sorted[fill[hashes[v] >> (64 - partition_bits)]++] = (index_type)v;
+    }
+
+    // each partition has its own open addressed table; the first vertex of each group is its representative.
+    static const index_type empty = ~(index_type)0;
+    std::vector<index_type> remap(num_vertices);
+    parallel_for(num_partitions, num_threads, [&](size_t p) {
+      size_t count = first[p + 1] - first[p];
+      size_t table_size = 16;
+      while (table_size < count * 2) table_size *= 2;
+      std::vector<index_type> table(table_size, empty);
+      for (size_t s = first[p]; s != first[p + 1]; ++s) {
+        index_type v = sorted[s];
+        for (size_t slot = hashes[v] & (table_size - 1); ; slot = (slot + 1) & (table_size - 1)) {
+          index_type u = table[slot];
+          if (u == empty) {
+            table[slot] = v;
+            remap[v] = v;
+            break;
+          }
+          if (hashes[u] == hashes[v] && same(u, v)) {
+            remap[v] = u;
+            break;
+          }
+        }
+      }
+    });
+
+    // number the representatives in vertex order.
+    std::vector<index_type> order;
+    for (size_t v = 0; v != num_vertices; ++v) {
+      if (remap[v] == v) {
+        remap[v] = (index_type)order.size();
+        order.push_back((index_type)v);
       } else {
-        normal.push(vec3(1, 0, 0));
+        remap[v] = remap[remap[v]];
       }
     }
+
+    parallel_for((indices_.size() + block - 1) / block, num_threads, [&](size_t b) {
+      for (size_t i = b * block, e = std::min(i + block, indices_.size()); i != e; ++i) {
+        indices_[i] = remap[indices_[i]];
+      }
+    });
+
+    // compact in place: representatives only ever move down.
+    for (auto &attr : attrs_) {
+      size_t vs = attr.vertex_size();
+      std::uint8_t *d = attr.data().data();
+      for (size_t i = 0; i != order.size(); ++i) {
+        if (order[i] != i) std::memcpy(d + i * vs, d + order[i] * vs, vs);
+      }
+      attr.resize(order.size());
+    }
+    return order.size();
+  }
+
+  // Remove all vertices and indices but keep the attributes and their capacity.
+  void clear() {
+    indices_.clear();
+    for (auto &a : attrs_) {
+      a.data().clear();
+    }
   }
   
-  void write_obj(std::ostream &os) const {
+  // Format this mesh as OBJ text into buf, calling flush(buf) whenever it fills up.
+  // first_vertex is the number of vertices already written to the file, as OBJ indices are global.
+  template <class Flush>
+  void format_obj(std::string &buf, size_t first_vertex, Flush flush) const {
+    static const size_t block = 1 << 20;
     size_t pos_attr = find_attribute("pos");
     size_t uv_attr = find_attribute("uv");
     size_t normal_attr = find_attribute("normal");
 
-    os << "o " << name() << "\n";
+    buf += "o ";
+    buf += name();
+    buf += "\n";
     
     if (pos_attr == bad_attr) return;
 
-    {
-      const attribute &attr = attributes()[pos_attr];
-      if (attr.vertex_size() != 3 || attr.scalar_size() != 4 || !attr.is_float()) throw(std::range_error("write_obj: wrong pos attr"));
+    if (attrs_[pos_attr].vector_elems() != 3) throw(std::range_error("write_obj: wrong pos attr"));
+
+    // one line per vertex for each attribute.
+    const char *prefixes[] = { "v ", "vt ", "vn " };
+    size_t attr_idx[] = { pos_attr, uv_attr, normal_attr };
+    for (size_t a = 0; a != 3; ++a) {
+      if (attr_idx[a] == bad_attr) continue;
+      const attribute &attr = attrs_[attr_idx[a]];
+      size_t elems = a == 1 ? 2 : 3;
       size_t size = attr.vertex_count();
       for (size_t i = 0; i != size; ++i) {
         vec4 v = attr[i];
-        os << "v " << v[0] << " " << v[1] << " " << v[2] << "\n";
+        size_t len = buf.size();
+        buf.resize(len + 64);
+        char *p = &buf[len];
+        char *b = p;
+        for (const char *s = prefixes[a]; *s; ++s) *p++ = *s;
+        for (size_t e = 0; e != elems; ++e) {
+          if (e) *p++ = ' ';
+          p = fmt_float(p, v[e]);
+        }
+        *p++ = '\n';
+        buf.resize(len + (p - b));
+        if (buf.size() >= block) flush(buf);
       }
     }
-    
-    if (uv_attr != bad_attr) {
-    }
-
-    if (normal_attr != bad_attr) {
-    }
 
+    // "f a b c", "f a/a b/b c/c", "f a//a ..." or "f a/a/a ..." depending on the attributes.
+    const char *sep = uv_attr == bad_attr && normal_attr != bad_attr ? "//" : "/";
+    size_t repeats = (uv_attr != bad_attr) + (normal_attr != bad_attr);
     size_t icount = indices_.size();
     for (size_t i = 0; i + 2 < icount; i += 3) {
-      index_type ai = indices_[i];
-      index_type bi = indices_[i+1];
-      index_type ci = indices_[i+2];
-      if (uv_attr == bad_attr && normal_attr == bad_attr) {
-        os << "f " << ai << " " << bi << " " << ci << "\n";
-      } else if (uv_attr != bad_attr && normal_attr == bad_attr) {
-        os << "f " << ai << "/" << ai << " " << bi << "/" << bi << " " << ci << "/" << ci << "\n";
-      } else if (uv_attr == bad_attr && normal_attr != bad_attr) {
-        os << "f " << ai << "//" << ai << " " << bi << "//" << bi << " " << ci << "//" << ci << "\n";
-      } else if (uv_attr != bad_attr && normal_attr != bad_attr) {
-        os << "f " << ai << "/" << ai << "/" << ai << " " << bi << "/" << bi << "/" << bi << " " << ci << "/" << ci << "/" << ci << "\n";
+      size_t len = buf.size();
+      buf.resize(len + 128);
+      char *p = &buf[len];
+      char *b = p;
+      *p++ = 'f';
+      for (size_t t = 0; t != 3; ++t) {
+        std::uint64_t idx = (std::uint64_t)indices_[i + t] + first_vertex + 1;
+        *p++ = ' ';
+        p = fmt_uint(p, idx);
+        for (size_t r = 0; r != repeats; ++r) {
+          for (const char *s = sep; *s; ++s) *p++ = *s;
+          p = fmt_uint(p, idx);
+        }
       }
+      *p++ = '\n';
+      buf.resize(len + (p - b));
+      if (buf.size() >= block) flush(buf);
     }
   }
 
+  // Write this mesh as OBJ text through a large reusable buffer.
+  void write_obj(std::ostream &os, size_t first_vertex=0) const {
+    std::string buf;
+    buf.reserve((1 << 20) + 256);
+    auto flush = [&os](std::string &buf) { os.write(buf.data(), buf.size()); buf.clear(); };
+    format_obj(buf, first_vertex, flush);
+    flush(buf);
+  }
+
+  // number of vertices, ie. the length of the pos attribute.
+  size_t vertex_count() const {
+    size_t pos_attr = find_attribute("pos");
+    return pos_attr == bad_attr ? 0 : attrs_[pos_attr].vertex_count();
+  }
+
   void push_index(index_type i) { indices_.push_back(i); }
 
   std::vector<attribute> &attributes() { return attrs_; }
@@ -356,10 +1147,21 @@ public:
   const std::vector<attribute> &attributes() const { return attrs_; }
   const std::vector<index_type> &indices() const { return indices_; }
   const std::string &name() const { return name_; }
+  size_t index_size() const { return index_size_; }
   attribute &operator[](size_t i) { return attrs_[i]; }
   const attribute &operator[](size_t i) const { return attrs_[i]; }
 
 private:
+  // 64 bit finalizer from MurmurHash3.
+  static std::uint64_t hash_mix(std::uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
   std::string name_;
   std::vector<attribute> attrs_;
   std::vector<index_type> indices_;
@@ -380,65 +1182,77 @@ public:
     submeshes_.push_back(src);
   }
 
-  /// Split the mesh into smaller vertex chunks.  
-  static multi_mesh split(const mesh &src, size_t max_size = 65500, size_t new_index_size=2) {
+  /// Split the mesh into smaller vertex chunks.
+  /// Triangles are assigned to chunks in a single linear pass; the chunks are then
+  /// built in parallel on num_threads threads (zero for one per core).
+  static multi_mesh split(const mesh &src, size_t max_size = 65500, size_t new_index_size=2, size_t num_threads=0) {
+    GLSLMATH_STATS_SCOPE("multi_mesh.split");
     multi_mesh dest;
+    auto &indices = src.indices();
+    size_t num_vertices = src.vertex_count();
     bool is_small = true;
-    for (auto i : src.indices()) {
-      if (i >= max_size) {
-        is_small = false;
-        break;
-      }
+    for (auto i : indices) {
+      if (i >= max_size) is_small = false;
+      num_vertices = std::max(num_vertices, (size_t)i + 1);
     }
 
-    std::cout << "is_small=" << is_small << "\n";
     if (is_small) {
       dest.submeshes_.push_back(src);
-    } else {
-      auto &indices = src.indices();
-      std::vector<index_type> fwd(indices.size());
-      std::vector<index_type> old_vertices;
-      std::vector<index_type> new_indices;
-      std::fill(fwd.begin(), fwd.end(), 0xffffffff);
-      new_indices.reserve(max_size + 2);
-      old_vertices.reserve(max_size + 2);
-      size_t t = 0;
-      int mesh_number = 0;
-      for (size_t i = 0; i != indices.size(); ++i) {
-        size_t idx = indices[i];
-        index_type new_idx = fwd[idx];
-        if (new_idx == 0xffffffff) {
-          new_idx = fwd[idx] = (index_type)old_vertices.size();
-          old_vertices.push_back(idx);
-        }
-        new_indices.push_back(new_idx);
-
-        if (++t == 3 || i == indices.size()-1) {
-          t = 0;
-          if (i == indices.size()-1 || old_vertices.size() >= max_size) {
-            std::cout << "new_indices.size()" << old_vertices.size() << "\n";
-            std::stringstream ns;
-            ns << src.name() << "." << mesh_number++;
-            mesh submesh(ns.str(), new_index_size);
-
-            submesh.indices() = new_indices;
-            
-            for (auto &oldattr : src.attributes()) {
-              size_t newattr_idx = submesh.add_attribute(oldattr);
-              attribute &newattr = submesh[newattr_idx];
-              for (size_t j = 0; j != old_vertices.size(); ++j) {
-                newattr.push(oldattr[old_vertices[j]]);
-              }
-            }
-
-            new_indices.resize(0);
-            old_vertices.resize(0);
-            std::fill(fwd.begin(), fwd.end(), 0xffffffff);
-            dest.submeshes_.push_back(submesh);
-          }
+      GLSLMATH_STATS_COUNT(split_submeshes, 1);
+      return dest;
+    }
+
+    // local index of every index and the source vertex of every local vertex, with the ranges of each chunk.
+    // A vertex's fwd entry belongs to the current chunk only if its generation matches.
+    std::vector<index_type> fwd(num_vertices);
+    std::vector<index_type> generation(num_vertices, 0);
+    std::vector<index_type> new_indices(indices.size());
+    std::vector<index_type> old_vertices;
+    old_vertices.reserve(num_vertices);
+    std::vector<size_t> first_index(1, 0);
+    std::vector<size_t> first_vertex(1, 0);
+    index_type gen = 1;
+    size_t t = 0;
+    for (size_t i = 0; i != indices.size(); ++i) {
+      size_t idx = indices[i];
+      if (generation[idx] != gen) {
+        generation[idx] = gen;
+        fwd[idx] = (index_type)(old_vertices.size() - first_vertex.back());
+        old_vertices.push_back((index_type)idx);
+      }
+      new_indices[i] = fwd[idx];
+
+      if (++t == 3 || i == indices.size()-1) {
+        t = 0;
+        if (i == indices.size()-1 || old_vertices.size() - first_vertex.back() >= max_size) {
+          first_index.push_back(i + 1);
+          first_vertex.push_back(old_vertices.size());
+          ++gen;
         }
       }
     }
+
+    size_t num_chunks = first_index.size() - 1;
+    dest.submeshes_.resize(num_chunks);
+    GLSLMATH_STATS_COUNT(split_submeshes, num_chunks);
+    parallel_for(num_chunks, num_threads, [&](size_t c) {
+      std::stringstream ns;
+      ns << src.name() << "." << c;
+      mesh &submesh = dest.submeshes_[c] = mesh(ns.str(), new_index_size);
+
+      submesh.indices().assign(new_indices.begin() + first_index[c], new_indices.begin() + first_index[c + 1]);
+
+      for (auto &oldattr : src.attributes()) {
+        size_t newattr_idx = submesh.add_attribute(oldattr);
+        attribute &newattr = submesh[newattr_idx];
+        newattr.resize(first_vertex[c + 1] - first_vertex[c]);
+        size_t vs = oldattr.vertex_size();
+        std::uint8_t *d = newattr.data().data();
+        for (size_t j = first_vertex[c]; j != first_vertex[c + 1]; ++j, d += vs) {
+          std::memcpy(d, &oldattr.data()[old_vertices[j] * vs], vs);
+        }
+      }
+    });
     
     return dest;
   }
@@ -454,11 +1268,57 @@ public:
     return p;
   }
 
-  void write_obj(std::ostream &os) const {
+  // size of write_binary() without writing anything.
+  size_t binary_size() const {
+    size_t content = 0;
     for (auto &m : submeshes_) {
-      m.write_obj(os);
+      content += m.binary_size();
+    }
+    return chunk_size("MLT", content);
+  }
+
+  // serialize in one pass into a buffer of exactly binary_size() bytes.
+  std::vector<std::uint8_t> to_binary() const {
+    std::vector<std::uint8_t> result(binary_size());
+    write_binary(result.data());
+    return result;
+  }
+
+  // Write all submeshes to one OBJ file. Submeshes are formatted on num_threads threads
+  // (zero for one per core) and written in order, so the output does not depend on the thread count.
+  void write_obj(std::ostream &os, size_t num_threads=0) const {
+    std::vector<size_t> first_vertex(submeshes_.size() + 1, 0);
+    for (size_t i = 0; i != submeshes_.size(); ++i) {
+      first_vertex[i+1] = first_vertex[i] + submeshes_[i].vertex_count();
+    }
+
+    if (num_threads == 0) num_threads = default_num_threads();
+    num_threads = std::min(num_threads, submeshes_.size());
+
+    if (num_threads <= 1) {
+      for (size_t i = 0; i != submeshes_.size(); ++i) {
+        submeshes_[i].write_obj(os, first_vertex[i]);
+      }
+      return;
+    }
+
+    // format a few submeshes per thread at a time to bound the memory held in text.
+    size_t batch = num_threads * 4;
+    std::vector<std::string> text(batch);
+    for (size_t base = 0; base < submeshes_.size(); base += batch) {
+      size_t count = std::min(batch, submeshes_.size() - base);
+      parallel_for(count, num_threads, [&](size_t i) {
+        text[i].clear();
+        submeshes_[base + i].format_obj(text[i], first_vertex[base + i], [](std::string &) {});
+      });
+      for (size_t i = 0; i != count; ++i) {
+        os.write(text[i].data(), text[i].size());
+      }
     }
   }
+
+  std::vector<mesh> &submeshes() { return submeshes_; }
+  const std::vector<mesh> &submeshes() const { return submeshes_; }
 private:
   std::vector<mesh> submeshes_;
 };
@@ -0,0 +1,284 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_MESH_COMPRESS
+#define INCLUDED_GLSLMATH_MESH_COMPRESS
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "mesh.hpp"
+#include "mesh_reader.hpp"
+
+namespace glslmath {
+
+/// Compact mesh encoding for storage and transfer.
+///
+/// "MSZ" { "msh" name, ATR..., "ixz" indices } where the attributes use two extra formats:
+///   "q3p"  float3 positions as 16 bit fractions of their bounding box: float offset[3], scale[3], u16 xyz per vertex.
+///   "o2n"  float3 normals folded onto an octahedron: s16 xy per vertex.
+/// "ixz" holds u32 index_size, u32 count, then each index i as the zigzag varint of next - i, where next is one
+/// more than the largest index so far. After optimize_vertex_fetch most indices are new (0) or recent (small).
+/// Other attributes are stored as they are. Decoding gives float3 "pos" and "normal" attributes.
+struct mesh_compress : serial {
+  // largest error in a decoded position, per axis, is half of the scale.
+  struct position_quantizer {
+    float offset[3];
+    float scale[3];
+
+    explicit position_quantizer(const attribute &pos) {
+      vec3 lo(0), hi(0);
+      if (pos.vertex_count()) lo = hi = pos[0].xyz();
+      for (size_t v = 1; v < pos.vertex_count(); ++v) {
+        lo = min(lo, pos[v].xyz());
+        hi = max(hi, pos[v].xyz());
+      }
+      for (size_t c = 0; c != 3; ++c) {
+        offset[c] = lo[c];
+        scale[c] = hi[c] > lo[c] ? (hi[c] - lo[c]) / 65535.0f : 1.0f;
+      }
+    }
+
+    std::uint16_t encode(float x, size_t c) const {
+      float q = std::floor((x - offset[c]) / scale[c] + 0.5f);
+      return (std::uint16_t)std::min(std::max(q, 0.0f), 65535.0f);
+    }
+  };
+
+  static void octahedral_encode(const vec3 &n, std::int16_t *dest) {
+    float l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+    float x = l1 > 0 ? n.x() / l1 : 1, y = l1 > 0 ? n.y() / l1 : 0;
+    if (n.z() < 0) {
+      float fx = (1 - std::abs(y)) * (x < 0 ? -1 : 1);
+      float fy = (1 - std::abs(x)) * (y < 0 ? -1 : 1);
+      x = fx;
+      y = fy;
+    }
+    dest[0] = (std::int16_t)std::floor(x * 32767 + 0.5f);
+    dest[1] = (std::int16_t)std::floor(y * 32767 + 0.5f);
+  }
+
+  static vec3 octahedral_decode(const std::int16_t *src) {
+    float x = std::max(src[0] / 32767.0f, -1.0f), y = std::max(src[1] / 32767.0f, -1.0f);
+    float z = 1 - std::abs(x) - std::abs(y);
+    if (z < 0) {
+      float fx = (1 - std::abs(y)) * (x < 0 ? -1 : 1);
+      float fy = (1 - std::abs(x)) * (y < 0 ? -1 : 1);
+      x = fx;
+      y = fy;
+    }
+    return normalized(vec3(x, y, z));
+  }
+
+  static bool is_position(const attribute &a) { return a.name() == "pos" && a.is_float() && a.vector_elems() == 3; }
+  static bool is_normal(const attribute &a) { return a.name() == "normal" && a.is_float() && a.vector_elems() == 3; }
+
+  template <class Iter>
+  static Iter wrvarint(Iter p, std::uint32_t value) {
+    while (value >= 0x80) {
+      *p++ = (std::uint8_t)(value | 0x80);
+      value >>= 7;
+    }
+    *p++ = (std::uint8_t)value;
+    return p;
+  }
+
+  template <class Iter>
+  static Iter write_attribute(Iter p, const attribute &a) {
+    if (!is_position(a) && !is_normal(a)) return a.write_binary(p);
+    chunk<Iter> ATR(p, "ATR");
+    {
+      chunk<Iter> atn(p, "atn");
+      p = wrtxt(p, a.name().c_str());
+    }
+    size_t n = a.vertex_count();
+    std::uint16_t tmp[1024 * 3];
+    if (is_position(a)) {
+      chunk<Iter> q3p(p, "q3p");
+      position_quantizer q(a);
+      p = wrscalars(p, q.offset, 3, 4);
+      p = wrscalars(p, q.scale, 3, 4);
+      for (size_t v = 0; v < n; v += 1024) {
+        size_t count = std::min(n - v, (size_t)1024);
+        std::uint16_t *d = tmp;
+        for (size_t i = 0; i != count; ++i) {
+          vec4 x = a[v + i];
+          for (size_t c = 0; c != 3; ++c) *d++ = q.encode(x[c], c);
+        }
+        p = wrscalars(p, tmp, count * 3, 2);
+      }
+    } else {
+      chunk<Iter> o2n(p, "o2n");
+      for (size_t v = 0; v < n; v += 1024) {
+        size_t count = std::min(n - v, (size_t)1024);
+        std::int16_t *d = (std::int16_t *)tmp;
+        for (size_t i = 0; i != count; ++i, d += 2) octahedral_encode(a[v + i].xyz(), d);
+        p = wrscalars(p, tmp, count * 2, 2);
+      }
+    }
+    return p;
+  }
+
+  template <class Iter>
+  static Iter write_binary(Iter p, const mesh &m) {
+    {
+      chunk<Iter> MSZ(p, "MSZ");
+
+      {
+        chunk<Iter> msh(p, "msh");
+        p = wrtxt(p, m.name().c_str());
+      }
+
+      for (auto &a : m.attributes()) {
+        p = write_attribute(p, a);
+      }
+
+      {
+        chunk<Iter> ixz(p, "ixz");
+        p = wr32(p, m.index_size());
+        p = wr32(p, m.indices().size());
+        std::uint32_t next = 0;
+        for (auto i : m.indices()) {
+          std::int32_t delta = (std::int32_t)(next - i);
+          p = wrvarint(p, ((std::uint32_t)delta << 1) ^ (std::uint32_t)(delta >> 31));
+          if (i >= next) next = i + 1;
+        }
+      }
+    }
+    return p;
+  }
+
+  static size_t binary_size(const mesh &m) {
+    return write_binary(sizer(), m).size();
+  }
+
+  static std::vector<std::uint8_t> to_binary(const mesh &m) {
+    std::vector<std::uint8_t> result(binary_size(m));
+    write_binary(result.data(), m);
+    return result;
+  }
+
+  static std::uint32_t rd32(const std::uint8_t *p) {
+    return (std::uint32_t)p[0] | (std::uint32_t)p[1] << 8 | (std::uint32_t)p[2] << 16 | (std::uint32_t)p[3] << 24;
+  }
+
+  static float rdfloat(const std::uint8_t *p) {
+    std::uint32_t bits = rd32(p);
+    float result;
+    memcpy(&result, &bits, 4);
+    return result;
+  }
+
+  // decode the content of an MSZ chunk.
+  static mesh decode(chunk_reader msz) {
+    mesh result;
+    chunk_reader r = msz.children();
+    while (r.next()) {
+      if (r.is("msh")) {
+        result = mesh(r.text(), result.index_size());
+      } else if (r.is("ATR")) {
+        result.attributes().push_back(decode_attribute(r));
+      } else if (r.is("ixz")) {
+        const std::uint8_t *p = r.content(), *end = p + r.content_size();
+        if (r.content_size() < 8) throw(std::range_error("mesh_compress: truncated indices"));
+        mesh indexed(result.name(), rd32(p));
+        indexed.attributes().swap(result.attributes());
+        result = indexed;
+        size_t count = rd32(p + 4);
+        p += 8;
+        std::vector<mesh::index_type> &indices = result.indices();
+        indices.resize(count);
+        std::uint32_t next = 0;
+        for (size_t i = 0; i != count; ++i) {
+          std::uint32_t value = 0;
+          for (int shift = 0; ; shift += 7) {
+            if (p == end || shift > 28) throw(std::range_error("mesh_compress: bad index stream"));
+            std::uint8_t b = *p++;
+            value |= (std::uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+          }
+          std::uint32_t index = next - ((value >> 1) ^ (0 - (value & 1)));
+          indices[i] = index;
+          if (index >= next) next = index + 1;
+        }
+      }
+    }
+    return result;
+  }
+
+  static attribute decode_attribute(chunk_reader atr) {
+    attribute params;
+    chunk_reader a = atr.children();
+    bool found = false;
+    while (a.next()) {
+      if (a.is("atn")) {
+        params = attribute(a.text());
+      } else if (a.is("q3p")) {
+        if (a.content_size() < 24) throw(std::range_error("mesh_compress: truncated positions"));
+        attribute result(params.name(), 3);
+        const std::uint8_t *p = a.content();
+        float offset[3], scale[3];
+        for (size_t c = 0; c != 3; ++c) {
+          offset[c] = rdfloat(p + c * 4);
+          scale[c] = rdfloat(p + 12 + c * 4);
+        }
+        size_t n = (a.content_size() - 24) / 6;
+        result.resize(n);
+        p += 24;
+        for (size_t v = 0; v != n; ++v, p += 6) {
+          vec3 x;
+          for (size_t c = 0; c != 3; ++c) {
+            x.set_elem(c, offset[c] + (float)(p[c*2] | p[c*2+1] << 8) * scale[c]);
+          }
+          result.set(v, vec4(x, 1));
+        }
+        return result;
+      } else if (a.is("o2n")) {
+        attribute result(params.name(), 3);
+        const std::uint8_t *p = a.content();
+        size_t n = a.content_size() / 4;
+        result.resize(n);
+        for (size_t v = 0; v != n; ++v, p += 4) {
+          std::int16_t xy[2] = { (std::int16_t)(p[0] | p[1] << 8), (std::int16_t)(p[2] | p[3] << 8) };
+          result.set(v, vec4(octahedral_decode(xy), 1));
+        }
+        return result;
+      } else if (attribute::parse_format_tag(a.tag(), params)) {
+        found = true;
+        params.data().resize(a.content_size() / params.scalar_size() * params.scalar_size());
+        const std::uint8_t *p = a.content();
+        std::uint8_t *d = params.data().data();
+        // stored little endian.
+        for (size_t i = 0; i < params.data().size(); i += params.scalar_size()) {
+          for (size_t j = 0; j != params.scalar_size(); ++j) {
+            d[i + (is_little_endian() ? j : params.scalar_size() - 1 - j)] = p[i + j];
+          }
+        }
+      }
+    }
+    if (!found) throw(std::range_error("mesh_compress: attribute without data"));
+    return params;
+  }
+
+  // decode every MSZ chunk in a buffer.
+  static multi_mesh decode(const std::uint8_t *data, size_t size) {
+    multi_mesh result;
+    chunk_reader r(data, size);
+    while (r.next()) {
+      if (r.is("MSZ")) result.submeshes().push_back(decode(r));
+    }
+    return result;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_MESH_OPTIMIZER
+#define INCLUDED_GLSLMATH_MESH_OPTIMIZER
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "mesh.hpp"
+
+namespace glslmath {
+
+/// Post-transform vertex cache statistics for an index list, simulating a FIFO cache.
+struct vertex_cache_stats {
+  size_t triangles;
+  size_t vertices;
+  size_t misses;
+
+  // average cache miss ratio: vertex shader runs per triangle, 0.5 at best and 3 at worst.
+  float acmr() const { return triangles ? (float)misses / triangles : 0; }
+
+  // average transform to vertex ratio: vertex shader runs per vertex, 1 at best.
+  float atvr() const { return vertices ? (float)misses / vertices : 0; }
+};
+
+inline vertex_cache_stats analyze_vertex_cache(const std::vector<mesh::index_type> &indices, size_t num_vertices, size_t cache_size=32) {
+  vertex_cache_stats res = { indices.size() / 3, num_vertices, 0 };
+  // a vertex is in the cache if it was loaded within the last cache_size misses.
+  std::vector<size_t> loaded(num_vertices, 0);
+  size_t time = cache_size + 1;
+  for (size_t i = 0; i != res.triangles * 3; ++i) {
+    size_t v = indices[i];
+    if (time - loaded[v] > cache_size) {
+      loaded[v] = time++;
+      ++res.misses;
+    }
+  }
+  return res;
+}
+
+/// Reorder triangles for the post-transform vertex cache using Tipsify
+/// (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007).
+/// Runs in linear time; cache_size should be a little less than the hardware cache.
+inline void optimize_vertex_cache(std::vector<mesh::index_type> &indices, size_t num_vertices, size_t cache_size=16) {
+  typedef mesh::index_type index_type;
+  size_t num_faces = indices.size() / 3;
+
+  // triangles using each vertex, with the live (unemitted) count.
+  std::vector<index_type> first(num_vertices + 1, 0);
+  for (size_t i = 0; i != num_faces * 3; ++i) ++first[indices[i] + 1];
+  for (size_t v = 0; v != num_vertices; ++v) first[v + 1] += first[v];
+  std::vector<index_type> faces(num_faces * 3);
+  std::vector<index_type> fill(first.begin(), first.end() - 1);
+  for (size_t i = 0; i != num_faces * 3; ++i) faces[fill[indices[i]]++] = (index_type)(i / 3);
+  std::vector<index_type> live(num_vertices);
+  for (size_t v = 0; v != num_vertices; ++v) live[v] = first[v + 1] - first[v];
+
+  std::vector<size_t> cached(num_vertices, 0);
+  std::vector<std::uint8_t> emitted(num_faces, 0);
+  std::vector<index_type> dead_ends;
+  std::vector<index_type> candidates;
+  std::vector<index_type> result;
+  result.reserve(num_faces * 3);
+  size_t time = cache_size + 1;
+  size_t cursor = 0;
+
+  for (long fan = num_vertices ? 0 : -1; fan >= 0; ) {
+    // emit every remaining triangle around the fanning vertex.
+    candidates.clear();
+    for (size_t t = first[fan]; t != first[fan + 1]; ++t) {
+      size_t f = faces[t];
+      if (emitted[f]) continue;
+      for (size_t c = 0; c != 3; ++c) {
+        index_type v = indices[f * 3 + c];
+        result.push_back(v);
+        dead_ends.push_back(v);
+        candidates.push_back(v);
+        --live[v];
+        if (time - cached[v] > cache_size) cached[v] = time++;
+      }
+      emitted[f] = 1;
+    }
+
+    // next fan: the candidate that stays in the cache longest and still has triangles left.
+    long best = -1;
+    size_t best_priority = 0;
+    for (index_type v : candidates) {
+      if (!live[v]) continue;
+      size_t priority = 0;
+      if (time - cached[v] + 2 * live[v] <= cache_size) priority = time - cached[v];
+      if (best == -1 || priority > best_priority) {
+        best = v;
+        best_priority = priority;
+      }
+    }
+
+    // otherwise a recent vertex with triangles left, or the next one in input order.
+    while (best == -1 && !dead_ends.empty()) {
+      index_type v = dead_ends.back();
+      dead_ends.pop_back();
+      if (live[v]) best = v;
+    }
+    while (best == -1 && cursor != num_vertices) {
+      if (live[cursor]) best = (long)cursor;
+      ++cursor;
+    }
+    fan = best;
+  }
+
+  std::copy(result.begin(), result.end(), indices.begin());
+}
+
+/// Renumber vertices in the order the triangles first use them so that vertex fetch reads memory in order.
+/// Every attribute is permuted; unreferenced vertices move to the end.
+inline void optimize_vertex_fetch(mesh &msh) {
+  typedef mesh::index_type index_type;
+  static const index_type unused = ~(index_type)0;
+  size_t num_vertices = msh.vertex_count();
+  std::vector<mesh::index_type> &indices = msh.indices();
+
+  std::vector<index_type> remap(num_vertices, unused);
+  std::vector<index_type> order;
+  order.reserve(num_vertices);
+  for (auto &i : indices) {
+    if (remap[i] == unused) {
+      remap[i] = (index_type)order.size();
+      order.push_back(i);
+    }
+    i = remap[i];
+  }
+  for (size_t v = 0; v != num_vertices; ++v) {
+    if (remap[v] == unused) order.push_back((index_type)v);
+  }
+
+  for (auto &attr : msh.attributes()) {
+    attribute fetched;
+    fetched.copy_params(attr);
+    fetched.reserve(order.size());
+    for (index_type v : order) fetched.push_raw(attr, v);
+    attr = std::move(fetched);
+  }
+}
+
+/// Tipsify the triangles, then reorder the vertices, reporting the cache behaviour before and after.
+inline void optimize_mesh(mesh &msh, vertex_cache_stats *before=nullptr, vertex_cache_stats *after=nullptr, size_t cache_size=16) {
+  size_t num_vertices = msh.vertex_count();
+  if (before) *before = analyze_vertex_cache(msh.indices(), num_vertices, cache_size);
+  optimize_vertex_cache(msh.indices(), num_vertices, cache_size);
+  optimize_vertex_fetch(msh);
+  if (after) *after = analyze_vertex_cache(msh.indices(), num_vertices, cache_size);
+}
+
+}
+
+#endif
@@ -0,0 +1,328 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_MESH_READER
+#define INCLUDED_GLSLMATH_MESH_READER
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+  #define GLSLMATH_MMAP 1
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace glslmath {
+
+/// Read only view of a whole file, memory mapped where the platform allows.
+class mapped_file {
+public:
+  mapped_file() : data_(nullptr), size_(0) {
+  }
+
+  explicit mapped_file(const std::string &path) : data_(nullptr), size_(0) {
+  #if defined(GLSLMATH_MMAP)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw(std::runtime_error("mapped_file: can't open " + path));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw(std::runtime_error("mapped_file: can't stat " + path));
+    }
+    size_ = (size_t)st.st_size;
+    if (size_) {
+      void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw(std::runtime_error("mapped_file: can't map " + path));
+      }
+      data_ = (const std::uint8_t *)addr;
+    }
+    ::close(fd);
+  #else
+    std::ifstream is(path, std::ios::binary);
+    if (!is) throw(std::runtime_error("mapped_file: can't open " + path));
+    buffer_.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  #endif
+  }
+
+  mapped_file(mapped_file &&rhs) : data_(rhs.data_), size_(rhs.size_) {
+  #if !defined(GLSLMATH_MMAP)
+    buffer_.swap(rhs.buffer_);
+  #endif
+    rhs.data_ = nullptr;
+    rhs.size_ = 0;
+  }
+
+  mapped_file &operator=(mapped_file &&rhs) {
+    if (this != &rhs) {
+      unmap();
+      data_ = rhs.data_;
+      size_ = rhs.size_;
+    #if !defined(GLSLMATH_MMAP)
+      buffer_.swap(rhs.buffer_);
+    #endif
+      rhs.data_ = nullptr;
+      rhs.size_ = 0;
+    }
+    return *this;
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  ~mapped_file() {
+    unmap();
+  }
+
+  const std::uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+private:
+  void unmap() {
+  #if defined(GLSLMATH_MMAP)
+    if (data_) munmap((void *)data_, size_);
+  #else
+    buffer_.clear();
+  #endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const std::uint8_t *data_;
+  size_t size_;
+#if !defined(GLSLMATH_MMAP)
+  std::vector<std::uint8_t> buffer_;
+#endif
+};
+
+/// Walk the chunks written by serial::chunk within a range of bytes.
+class chunk_reader {
+public:
+  chunk_reader(const std::uint8_t *begin, size_t size)
+  : p_(begin), end_(begin + size), tag_(""), content_(nullptr), content_size_(0) {
+  }
+
+  // move to the next chunk. returns false at the end of the range.
+  bool next() {
+    if (p_ == end_) return false;
+    const std::uint8_t *tag = p_;
+    const std::uint8_t *nul = (const std::uint8_t *)memchr(tag, 0, (size_t)(end_ - tag));
+    if (!nul) throw(std::range_error("chunk_reader: unterminated tag"));
+    const std::uint8_t *len = tag + ((nul - tag + 4) & ~3);
+    if (end_ - len < 4) throw(std::range_error("chunk_reader: truncated chunk"));
+    size_t length = (size_t)len[0] | (size_t)len[1] << 8 | (size_t)len[2] << 16 | (size_t)len[3] << 24;
+    if (length < 4 || length > (size_t)(end_ - len)) throw(std::range_error("chunk_reader: bad chunk length"));
+    tag_ = (const char *)tag;
+    content_ = len + 4;
+    content_size_ = length - 4;
+    size_t next = (length + 3) & ~(size_t)3;
+    p_ = next > (size_t)(end_ - len) ? end_ : len + next;
+    return true;
+  }
+
+  bool is(const char *tag) const { return !strcmp(tag_, tag); }
+  const char *tag() const { return tag_; }
+  const std::uint8_t *content() const { return content_; }
+  size_t content_size() const { return content_size_; }
+
+  // chunks nested inside this one.
+  chunk_reader children() const { return chunk_reader(content_, content_size_); }
+
+  // text written by serial::wrtxt at the start of the content.
+  std::string text() const {
+    const void *nul = memchr(content_, 0, content_size_);
+    return std::string((const char *)content_, nul ? (const char *)nul : (const char *)content_ + content_size_);
+  }
+private:
+  const std::uint8_t *p_;
+  const std::uint8_t *end_;
+  const char *tag_;
+  const std::uint8_t *content_;
+  size_t content_size_;
+};
+
+/// An attribute whose data lives in someone else's buffer.
+class attribute_view {
+public:
+  attribute_view() : data_(nullptr), vertex_count_(0) {
+  }
+
+  attribute_view(const attribute &params, const std::uint8_t *data, size_t vertex_count)
+  : params_(params), data_(data), vertex_count_(vertex_count) {
+  }
+
+  const std::string &name() const { return params_.name(); }
+  size_t vector_elems() const { return params_.vector_elems(); }
+  size_t vertex_size() const { return params_.vertex_size(); }
+  size_t scalar_size() const { return params_.scalar_size(); }
+  bool is_float() const { return params_.is_float(); }
+  bool is_normalized() const { return params_.is_normalized(); }
+  bool is_unsigned() const { return params_.is_unsigned(); }
+
+  size_t vertex_count() const { return vertex_count_; }
+  const std::uint8_t *data() const { return data_; }
+
+  // typed view of the scalars, vector_elems() per vertex. T must match the declared format.
+  template <class T>
+  const T *elements() const {
+    if (sizeof(T) != scalar_size()) throw(std::range_error("attribute_view: view type does not match scalar size"));
+    return reinterpret_cast<const T*>(data_);
+  }
+
+  // copy into an attribute that owns its data.
+  attribute to_attribute() const {
+    attribute result;
+    result.copy_params(params_);
+    result.data().assign(data_, data_ + vertex_count_ * vertex_size());
+    return result;
+  }
+private:
+  attribute params_;
+  const std::uint8_t *data_;
+  size_t vertex_count_;
+};
+
+/// A mesh whose attributes and indices point into a serialized buffer.
+class mesh_view {
+public:
+  mesh_view() : index_size_(4), indices_(nullptr), index_count_(0) {
+  }
+
+  // parse the content of an MSH chunk.
+  explicit mesh_view(chunk_reader msh) : index_size_(4), indices_(nullptr), index_count_(0) {
+    chunk_reader r = msh.children();
+    while (r.next()) {
+      if (r.is("msh")) {
+        name_ = r.text();
+      } else if (r.is("ATR")) {
+        attribute params;
+        const std::uint8_t *data = nullptr;
+        size_t size = 0;
+        bool found = false;
+        chunk_reader a = r.children();
+        while (a.next()) {
+          if (a.is("atn")) {
+            params = attribute(a.text());
+          } else if (attribute::parse_format_tag(a.tag(), params)) {
+            data = a.content();
+            size = a.content_size();
+            found = true;
+          }
+        }
+        if (!found) throw(std::range_error("mesh_view: attribute without data"));
+        attrs_.emplace_back(params, data, size / params.vertex_size());
+      } else if (r.is("ix2") || r.is("ix4")) {
+        index_size_ = r.is("ix2") ? 2 : 4;
+        indices_ = r.content();
+        index_count_ = r.content_size() / index_size_;
+      }
+    }
+  }
+
+  const std::string &name() const { return name_; }
+  const std::vector<attribute_view> &attributes() const { return attrs_; }
+  const attribute_view &operator[](size_t i) const { return attrs_[i]; }
+
+  size_t find_attribute(const std::string &name) const {
+    for (size_t i = 0; i != attrs_.size(); ++i) {
+      if (attrs_[i].name() == name) return i;
+    }
+    return mesh::bad_attr;
+  }
+
+  size_t index_size() const { return index_size_; }
+  size_t index_count() const { return index_count_; }
+  const std::uint16_t *indices16() const { return index_size_ == 2 ? reinterpret_cast<const std::uint16_t*>(indices_) : nullptr; }
+  const std::uint32_t *indices32() const { return index_size_ == 4 ? reinterpret_cast<const std::uint32_t*>(indices_) : nullptr; }
+
+  mesh::index_type index(size_t i) const {
+    return index_size_ == 2 ? indices16()[i] : indices32()[i];
+  }
+
+  // copy into a mesh that owns its data.
+  mesh to_mesh() const {
+    mesh result(name_, index_size_);
+    for (auto &a : attrs_) {
+      result.attributes().push_back(a.to_attribute());
+    }
+    std::vector<mesh::index_type> &indices = result.indices();
+    indices.resize(index_count_);
+    for (size_t i = 0; i != index_count_; ++i) {
+      indices[i] = index(i);
+    }
+    return result;
+  }
+private:
+  std::string name_;
+  std::vector<attribute_view> attrs_;
+  size_t index_size_;
+  const std::uint8_t *indices_;
+  size_t index_count_;
+};
+
+/// Views of every mesh in a buffer written by multi_mesh::write_binary or mesh::write_binary.
+class multi_mesh_view {
+public:
+  multi_mesh_view() {
+  }
+
+  // The buffer must outlive the view. Views point straight into it and need a little endian host.
+  multi_mesh_view(const std::uint8_t *data, size_t size) {
+    if (!serial::is_little_endian()) throw(std::range_error("multi_mesh_view: needs a little endian host"));
+    chunk_reader r(data, size);
+    while (r.next()) {
+      if (r.is("MLT")) {
+        chunk_reader m = r.children();
+        while (m.next()) {
+          if (m.is("MSH")) submeshes_.emplace_back(m);
+        }
+      } else if (r.is("MSH")) {
+        submeshes_.emplace_back(r);
+      }
+    }
+  }
+
+  const std::vector<mesh_view> &submeshes() const { return submeshes_; }
+
+  multi_mesh to_multi_mesh() const {
+    multi_mesh result;
+    for (auto &m : submeshes_) {
+      result.submeshes().push_back(m.to_mesh());
+    }
+    return result;
+  }
+private:
+  std::vector<mesh_view> submeshes_;
+};
+
+/// Memory mapped mesh file. The views stay valid for the lifetime of this object.
+class mesh_file {
+public:
+  explicit mesh_file(const std::string &path) : file_(path), view_(file_.data(), file_.size()) {
+  }
+
+  const multi_mesh_view &view() const { return view_; }
+  const std::vector<mesh_view> &submeshes() const { return view_.submeshes(); }
+private:
+  mapped_file file_;
+  multi_mesh_view view_;
+};
+
+}
+
+#endif
@@ -0,0 +1,349 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_MESH_SIMPLIFY
+#define INCLUDED_GLSLMATH_MESH_SIMPLIFY
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "mesh.hpp"
+
+namespace glslmath {
+
+/// Parameters for simplify().
+struct simplify_options {
+  // stop when there are this many triangles or fewer.
+  size_t target_triangles;
+
+  // do not make collapses whose RMS distance from the original surface exceeds this.
+  float max_error;
+
+  // relative weight of differences in the other float attributes (normals, uv, colours).
+  float attribute_weight;
+
+  // weight of the planes that hold open borders in place.
+  float border_weight;
+
+  simplify_options(size_t target_triangles=0, float max_error=1e30f)
+  : target_triangles(target_triangles), max_error(max_error), attribute_weight(0.01f), border_weight(10.0f) {
+  }
+};
+
+/// Reduce the triangle count of a mesh by quadric error metric edge collapse
+/// (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997).
+/// Vertices collapse onto one of their neighbours, so every attribute of the surviving vertices is kept exactly.
+/// The result has only the vertices still in use, in their original order.
+class mesh_simplifier {
+public:
+  typedef mesh::index_type index_type;
+
+  mesh simplify(const mesh &src, const simplify_options &options) {
+    size_t pos_attr = src.find_attribute("pos");
+    if (pos_attr == mesh::bad_attr) throw(std::range_error("mesh_simplifier: mesh has no pos attribute"));
+    const attribute &pos = src[pos_attr];
+    size_t num_vertices = pos.vertex_count();
+
+    positions_.resize(num_vertices);
+    for (size_t v = 0; v != num_vertices; ++v) positions_[v] = pos[v].xyz();
+    indices_ = src.indices();
+    indices_.resize(indices_.size() / 3 * 3);
+    size_t num_faces = indices_.size() / 3;
+    live_faces_ = num_faces;
+    face_live_.assign(num_faces, 1);
+
+    // the other float attributes take part in the collapse cost.
+    attrs_.clear();
+    for (size_t a = 0; a != src.attributes().size(); ++a) {
+      if (a != pos_attr && src[a].is_float()) attrs_.push_back(&src[a]);
+    }
+    attribute_weight_ = options.attribute_weight;
+
+    build_adjacency(num_vertices);
+    build_quadrics(num_vertices, options.border_weight);
+
+    heap_ = heap_type();
+    version_.assign(num_vertices, 0);
+    vertex_live_.assign(num_vertices, 1);
+    for (size_t i = 0; i != edges_.size(); ++i) push_edge(edges_[i].a, edges_[i].b);
+
+    float max_cost = options.max_error * options.max_error;
+    while (live_faces_ > options.target_triangles && !heap_.empty()) {
+      candidate c = heap_.top();
+      heap_.pop();
+      if (!vertex_live_[c.from] || !vertex_live_[c.to]) continue;
+      if (version_[c.from] != c.from_version || version_[c.to] != c.to_version) continue;
+      if (c.cost > max_cost) break;
+      if (flips(c.from, c.to)) continue;
+      collapse(c.from, c.to);
+    }
+
+    return compact(src);
+  }
+
+private:
+  // symmetric 4x4 plane quadric with the total weight of its planes.
+  struct quadric {
+    double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+    double weight;
+
+    quadric() : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0), weight(0) {
+    }
+
+    // the plane n.p + d = 0 with |n| = 1 weighted by w.
+    void add_plane(const vec3 &n, float d, float w) {
+      double x = n.x(), y = n.y(), z = n.z(), e = d;
+      a00 += w*x*x; a01 += w*x*y; a02 += w*x*z; a03 += w*x*e;
+      a11 += w*y*y; a12 += w*y*z; a13 += w*y*e;
+      a22 += w*z*z; a23 += w*z*e;
+      a33 += w*e*e;
+      weight += w;
+    }
+
+    void operator+=(const quadric &q) {
+      a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+      a11 += q.a11; a12 += q.a12; a13 += q.a13;
+      a22 += q.a22; a23 += q.a23;
+      a33 += q.a33;
+      weight += q.weight;
+    }
+
+    // weighted mean squared distance of p from the planes.
+    double error(const vec3 &p) const {
+      double x = p.x(), y = p.y(), z = p.z();
+      double e = x*(a00*x + 2*(a01*y + a02*z + a03)) + y*(a11*y + 2*(a12*z + a13)) + z*(a22*z + 2*a23) + a33;
+      return weight > 0 ? std::max(e, 0.0) / weight : 0;
+    }
+  };
+
+  struct edge {
+    index_type a, b;
+    bool operator<(const edge &rhs) const { return a != rhs.a ? a < rhs.a : b < rhs.b; }
+    bool operator==(const edge &rhs) const { return a == rhs.a && b == rhs.b; }
+  };
+
+  // collapse from into to, valid while both versions are unchanged.
+  struct candidate {
+    float cost;
+    index_type from, to;
+    std::uint32_t from_version, to_version;
+
+    // lowest cost first, ties broken by vertex so the result is deterministic.
+    bool operator<(const candidate &rhs) const {
+      if (cost != rhs.cost) return cost > rhs.cost;
+      if (from != rhs.from) return from > rhs.from;
+      return to > rhs.to;
+    }
+  };
+
+  typedef std::priority_queue<candidate> heap_type;
+
+  vec3 face_normal(size_t f) const {
+    const index_type *t = &indices_[f * 3];
+    return cross(positions_[t[1]] - positions_[t[0]], positions_[t[2]] - positions_[t[0]]);
+  }
+
+  void build_adjacency(size_t num_vertices) {
+    faces_.assign(num_vertices, std::vector<index_type>());
+    edges_.clear();
+    for (size_t f = 0; f != indices_.size() / 3; ++f) {
+      for (size_t c = 0; c != 3; ++c) {
+        index_type a = indices_[f * 3 + c], b = indices_[f * 3 + (c + 1) % 3];
+        faces_[a].push_back((index_type)f);
+        if (a != b) {
+          edge e = { std::min(a, b), std::max(a, b) };
+          edges_.push_back(e);
+        }
+      }
+    }
+    std::sort(edges_.begin(), edges_.end());
+  }
+
+  // plane quadrics of the faces around each vertex, and perpendicular planes along open borders.
+  void build_quadrics(size_t num_vertices, float border_weight) {
+    quadrics_.assign(num_vertices, quadric());
+    for (size_t f = 0; f != indices_.size() / 3; ++f) {
+      const index_type *t = &indices_[f * 3];
+      vec3 n = face_normal(f);
+      float len = length(n);
+      if (len == 0) continue;
+      n = n * (1.0f / len);
+      float d = -dot(n, positions_[t[0]]);
+      for (size_t c = 0; c != 3; ++c) quadrics_[t[c]].add_plane(n, d, len * 0.5f);
+
+      for (size_t c = 0; c != 3; ++c) {
+        index_type a = t[c], b = t[(c + 1) % 3];
+        edge e = { std::min(a, b), std::max(a, b) };
+        auto range = std::equal_range(edges_.begin(), edges_.end(), e);
+        if (range.second - range.first != 1) continue;
+        vec3 along = positions_[b] - positions_[a];
+        float elen = length(along);
+        if (elen == 0) continue;
+        vec3 side = normalized(cross(along, n));
+        float sd = -dot(side, positions_[a]);
+        quadrics_[a].add_plane(side, sd, border_weight * elen * elen);
+        quadrics_[b].add_plane(side, sd, border_weight * elen * elen);
+      }
+    }
+    edges_.erase(std::unique(edges_.begin(), edges_.end()), edges_.end());
+  }
+
+  float attribute_error(index_type a, index_type b) const {
+    float e = 0;
+    for (auto attr : attrs_) {
+      vec4 d = (*attr)[a] - (*attr)[b];
+      e += dot(d, d);
+    }
+    return e * attribute_weight_;
+  }
+
+  // queue the cheaper direction of collapsing an edge.
+  void push_edge(index_type a, index_type b) {
+    quadric q = quadrics_[a];
+    q += quadrics_[b];
+    float extra = attrs_.empty() ? 0 : attribute_error(a, b);
+    float to_b = (float)q.error(positions_[b]) + extra;
+    float to_a = (float)q.error(positions_[a]) + extra;
+    candidate c;
+    if (to_b <= to_a) {
+      c.cost = to_b; c.from = a; c.to = b;
+    } else {
+      c.cost = to_a; c.from = b; c.to = a;
+    }
+    c.from_version = version_[c.from];
+    c.to_version = version_[c.to];
+    heap_.push(c);
+  }
+
+  // true if moving from onto to would turn over any remaining face.
+  bool flips(index_type from, index_type to) const {
+    for (auto f : faces_[from]) {
+      if (!face_live_[f]) continue;
+      const index_type *t = &indices_[f * 3];
+      if (t[0] == to || t[1] == to || t[2] == to) continue;
+      vec3 p[3];
+      for (size_t c = 0; c != 3; ++c) p[c] = positions_[t[c] == from ? to : t[c]];
+      vec3 before = face_normal(f);
+      vec3 after = cross(p[1] - p[0], p[2] - p[0]);
+      if (dot(before, after) <= 0.2f * length(before) * length(after)) return true;
+    }
+    return false;
+  }
+
+  void collapse(index_type from, index_type to) {
+    for (auto f : faces_[from]) {
+      if (!face_live_[f]) continue;
+      index_type *t = &indices_[f * 3];
+      if (t[0] == to || t[1] == to || t[2] == to) {
+        face_live_[f] = 0;
+        --live_faces_;
+      } else {
+        for (size_t c = 0; c != 3; ++c) if (t[c] == from) t[c] = to;
+        faces_[to].push_back(f);
+      }
+    }
+    faces_[from].clear();
+    vertex_live_[from] = 0;
+    quadrics_[to] += quadrics_[from];
+    ++version_[to];
+
+    // new costs for the edges around the merged vertex.
+    neighbours_.clear();
+    std::vector<index_type> &live = faces_[to];
+    size_t n = 0;
+    for (size_t i = 0; i != live.size(); ++i) {
+      index_type f = live[i];
+      if (!face_live_[f]) continue;
+      live[n++] = f;
+      for (size_t c = 0; c != 3; ++c) {
+        if (indices_[f * 3 + c] != to) neighbours_.push_back(indices_[f * 3 + c]);
+      }
+    }
+    live.resize(n);
+    std::sort(neighbours_.begin(), neighbours_.end());
+    neighbours_.erase(std::unique(neighbours_.begin(), neighbours_.end()), neighbours_.end());
+    for (auto v : neighbours_) push_edge(v, to);
+  }
+
+  mesh compact(const mesh &src) {
+    static const index_type unused = ~(index_type)0;
+    mesh dest(src.name(), src.index_size());
+    remap_.assign(positions_.size(), unused);
+    for (size_t f = 0; f != face_live_.size(); ++f) {
+      if (!face_live_[f]) continue;
+      for (size_t c = 0; c != 3; ++c) remap_[indices_[f * 3 + c]] = 0;
+    }
+    index_type count = 0;
+    for (auto &r : remap_) {
+      if (r != unused) r = count++;
+    }
+    for (auto &oldattr : src.attributes()) {
+      attribute &newattr = dest[dest.add_attribute(oldattr)];
+      newattr.reserve(count);
+      for (size_t v = 0; v != remap_.size(); ++v) {
+        if (remap_[v] != unused) newattr.push_raw(oldattr, v);
+      }
+    }
+    dest.indices().reserve(live_faces_ * 3);
+    for (size_t f = 0; f != face_live_.size(); ++f) {
+      if (!face_live_[f]) continue;
+      for (size_t c = 0; c != 3; ++c) dest.push_index(remap_[indices_[f * 3 + c]]);
+    }
+    return dest;
+  }
+
+  std::vector<vec3> positions_;
+  std::vector<index_type> indices_;
+  std::vector<std::uint8_t> face_live_;
+  std::vector<std::uint8_t> vertex_live_;
+  std::vector<std::uint32_t> version_;
+  std::vector<std::vector<index_type> > faces_;
+  std::vector<edge> edges_;
+  std::vector<quadric> quadrics_;
+  std::vector<const attribute *> attrs_;
+  std::vector<index_type> neighbours_;
+  std::vector<index_type> remap_;
+  heap_type heap_;
+  size_t live_faces_;
+  float attribute_weight_;
+};
+
+/// Simplify a mesh to at most target_triangles triangles, or until the error bound is reached.
+inline mesh simplify(const mesh &src, const simplify_options &options) {
+  mesh_simplifier simplifier;
+  return simplifier.simplify(src, options);
+}
+
+/// A chain of levels of detail: submesh 0 is src and each following level has about
+/// reduction times the triangles of the one before. Levels stop early if the error bound is reached.
+inline multi_mesh generate_lods(const mesh &src, size_t num_levels, float reduction=0.5f, float max_error=1e30f) {
+  multi_mesh dest(src);
+  mesh_simplifier simplifier;
+  for (size_t level = 1; level < num_levels; ++level) {
+    const mesh &prev = dest.submeshes().back();
+    simplify_options options((size_t)(prev.indices().size() / 3 * reduction), max_error);
+    mesh next = simplifier.simplify(prev, options);
+    if (next.indices().size() == prev.indices().size()) break;
+    std::stringstream ns;
+    ns << src.name() << ".lod" << level;
+    mesh named(ns.str(), next.index_size());
+    named.indices().swap(next.indices());
+    named.attributes().swap(next.attributes());
+    dest.submeshes().push_back(std::move(named));
+  }
+  return dest;
+}
+
+}
+
+#endif
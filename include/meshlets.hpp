@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_MESHLETS
+#define INCLUDED_GLSLMATH_MESHLETS
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+
+namespace glslmath {
+
+/// A mesh cut into small clusters for mesh shaders and GPU culling.
+/// Each meshlet references up to max_vertices vertices of the mesh through the vertices() table
+/// and has up to max_triangles triangles of 8-bit indices into its own part of that table.
+///
+/// Binary layout: "MSL" { "msl" name, attributes..., "mlh" headers, "mlv" u32 vertices, "mlp" u8 triangles }
+class meshlet_mesh : public serial {
+public:
+  /// One cluster. All fields are four bytes so the headers can be written as an array of scalars.
+  struct meshlet {
+    std::uint32_t vertex_offset;   // first entry in vertices()
+    std::uint32_t triangle_offset; // first byte in triangles()
+    std::uint32_t vertex_count;
+    std::uint32_t triangle_count;
+
+    // bounding sphere.
+    float center[3];
+    float radius;
+
+    // normal cone: the meshlet faces away from a camera at c if
+    // dot(normalized(apex - c), axis) >= cutoff.
+    float cone_apex[3];
+    float cone_axis[3];
+    float cone_cutoff;
+  };
+
+  static const size_t header_words = sizeof(meshlet) / 4;
+
+  meshlet_mesh() {
+  }
+
+  /// Split the triangles of src into meshlets in index order; run optimize_vertex_cache first for tighter clusters.
+  explicit meshlet_mesh(const mesh &src, size_t max_vertices=64, size_t max_triangles=124)
+  : name_(src.name()), attrs_(src.attributes()) {
+    if (max_vertices < 3 || max_vertices > 256) throw(std::range_error("meshlet_mesh: max_vertices must be 3..256"));
+    if (max_triangles < 1) throw(std::range_error("meshlet_mesh: max_triangles must be at least one"));
+    size_t pos_attr = src.find_attribute("pos");
+    if (pos_attr == mesh::bad_attr) throw(std::range_error("meshlet_mesh: mesh has no pos attribute"));
+    const attribute &pos = src[pos_attr];
+    const std::vector<mesh::index_type> &indices = src.indices();
+    size_t num_faces = indices.size() / 3;
+
+    // local index of each vertex, valid while its generation matches the current meshlet.
+    size_t num_vertices = pos.vertex_count();
+    for (auto i : indices) num_vertices = std::max(num_vertices, (size_t)i + 1);
+    std::vector<std::uint8_t> local(num_vertices);
+    std::vector<std::uint32_t> generation(num_vertices, 0);
+    std::uint32_t gen = 1;
+
+    meshlet m = meshlet();
+    for (size_t f = 0; f != num_faces; ++f) {
+      const mesh::index_type *tri = &indices[f * 3];
+      size_t new_vertices = 0;
+      for (size_t c = 0; c != 3; ++c) {
+        new_vertices += generation[tri[c]] != gen && (c < 1 || tri[c] != tri[0]) && (c < 2 || tri[c] != tri[1]);
+      }
+      if (m.vertex_count + new_vertices > max_vertices || m.triangle_count == max_triangles) {
+        finish(m, pos);
+        m = meshlet();
+        m.vertex_offset = (std::uint32_t)vertices_.size();
+        m.triangle_offset = (std::uint32_t)triangles_.size();
+        ++gen;
+      }
+      for (size_t c = 0; c != 3; ++c) {
+        mesh::index_type v = tri[c];
+        if (generation[v] != gen) {
+          generation[v] = gen;
+          local[v] = (std::uint8_t)m.vertex_count++;
+          vertices_.push_back(v);
+        }
+        triangles_.push_back(local[v]);
+      }
+      ++m.triangle_count;
+    }
+    if (m.triangle_count) finish(m, pos);
+  }
+
+  const std::string &name() const { return name_; }
+  const std::vector<attribute> &attributes() const { return attrs_; }
+  const std::vector<meshlet> &meshlets() const { return meshlets_; }
+  const std::vector<std::uint32_t> &vertices() const { return vertices_; }
+  const std::vector<std::uint8_t> &triangles() const { return triangles_; }
+
+  // vertex of the mesh at corner c of triangle t of meshlet m.
+  std::uint32_t vertex(const meshlet &m, size_t t, size_t c) const {
+    return vertices_[m.vertex_offset + triangles_[m.triangle_offset + t * 3 + c]];
+  }
+
+  template <class Iter>
+  Iter write_binary(Iter p) const {
+    {
+      chunk<Iter> MSL(p, "MSL");
+
+      {
+        chunk<Iter> msl(p, "msl");
+        p = wrtxt(p, name_.c_str());
+      }
+
+      for (auto &a : attrs_) {
+        p = a.write_binary(p);
+      }
+
+      {
+        chunk<Iter> mlh(p, "mlh");
+        p = wrscalars(p, meshlets_.data(), meshlets_.size() * header_words, 4);
+      }
+
+      {
+        chunk<Iter> mlv(p, "mlv");
+        p = wrscalars(p, vertices_.data(), vertices_.size(), 4);
+      }
+
+      {
+        chunk<Iter> mlp(p, "mlp");
+        p = wrbytes(p, triangles_.data(), triangles_.size());
+      }
+    }
+
+    return p;
+  }
+
+  // size of write_binary() without writing anything.
+  size_t binary_size() const {
+    size_t content = chunk_size("msl", txt_size(name_.c_str()));
+    for (auto &a : attrs_) {
+      content += a.binary_size();
+    }
+    content += chunk_size("mlh", meshlets_.size() * sizeof(meshlet));
+    content += chunk_size("mlv", vertices_.size() * 4);
+    content += chunk_size("mlp", triangles_.size());
+    return chunk_size("MSL", content);
+  }
+
+  // serialize in one pass into a buffer of exactly binary_size() bytes.
+  std::vector<std::uint8_t> to_binary() const {
+    std::vector<std::uint8_t> result(binary_size());
+    write_binary(result.data());
+    return result;
+  }
+
+private:
+  // compute the bounds of a completed meshlet and add it.
+  void finish(meshlet &m, const attribute &pos) {
+    // sphere about the centre of the box.
+    vec3 lo(pos[vertices_[m.vertex_offset]].xyz()), hi = lo;
+    for (size_t i = 0; i != m.vertex_count; ++i) {
+      vec3 p = pos[vertices_[m.vertex_offset + i]].xyz();
+      lo = min(lo, p);
+      hi = max(hi, p);
+    }
+    vec3 center = (lo + hi) * 0.5f;
+    float radius = 0;
+    for (size_t i = 0; i != m.vertex_count; ++i) {
+      vec3 d = pos[vertices_[m.vertex_offset + i]].xyz() - center;
+      radius = std::max(radius, dot(d, d));
+    }
+    radius = std::sqrt(radius);
+
+    // cone about the mean of the unit triangle normals.
+    std::vector<vec3> &normals = normals_;
+    normals.clear();
+    vec3 axis(0);
+    for (size_t t = 0; t != m.triangle_count; ++t) {
+      vec3 a = pos[vertex(m, t, 0)].xyz(), b = pos[vertex(m, t, 1)].xyz(), c = pos[vertex(m, t, 2)].xyz();
+      vec3 n = cross(b - a, c - a);
+      float len2 = dot(n, n);
+      normals.push_back(len2 > 0 ? vec3(n * (1.0f / std::sqrt(len2))) : vec3(0));
+      axis += normals.back();
+    }
+    float axis_len2 = dot(axis, axis);
+    axis = axis_len2 > 0 ? vec3(axis * (1.0f / std::sqrt(axis_len2))) : vec3(1, 0, 0);
+
+    float min_dot = 1;
+    for (auto &n : normals) {
+      if (dot(n, n) > 0) min_dot = std::min(min_dot, dot(n, axis));
+    }
+
+    // move the apex back along the axis until it is behind every triangle plane.
+    float max_t = 0;
+    if (min_dot > 0) {
+      for (size_t t = 0; t != m.triangle_count; ++t) {
+        const vec3 &n = normals[t];
+        if (dot(n, n) == 0) continue;
+        float dc = dot(center - vec3(pos[vertex(m, t, 0)].xyz()), n);
+        max_t = std::max(max_t, dc / dot(axis, n));
+      }
+    }
+    vec3 apex = center - axis * max_t;
+
+    for (size_t c = 0; c != 3; ++c) {
+      m.center[c] = center[c];
+      m.cone_apex[c] = apex[c];
+      m.cone_axis[c] = axis[c];
+    }
+    m.radius = radius;
+    // a spread of 90 degrees or more can never be back facing as a whole.
+    m.cone_cutoff = min_dot > 0 ? std::sqrt(1 - min_dot * min_dot) : 1;
+    meshlets_.push_back(m);
+  }
+
+  std::string name_;
+  std::vector<attribute> attrs_;
+  std::vector<meshlet> meshlets_;
+  std::vector<std::uint32_t> vertices_;
+  std::vector<std::uint8_t> triangles_;
+  std::vector<vec3> normals_;
+};
+
+}
+
+#endif
@@ -0,0 +1,333 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_PARALLEL
+#define INCLUDED_GLSLMATH_PARALLEL
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace glslmath {
+
+/// number of threads to use when the caller asks for zero.
+inline size_t default_num_threads() {
+  return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/// Call fn(i) for every i in [0, count) on up to num_threads threads (zero for one per core).
+/// Items are handed out in order from a shared counter; the calling thread also does work.
+template <class F>
+void parallel_for(size_t count, size_t num_threads, F fn) {
+  if (num_threads == 0) num_threads = default_num_threads();
+  num_threads = std::min(num_threads, count);
+  if (num_threads <= 1) {
+    for (size_t i = 0; i != count; ++i) fn(i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < count; ) fn(i);
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < num_threads; ++t) threads.emplace_back(worker);
+  worker();
+  for (auto &t : threads) t.join();
+}
+
+/// A fixed set of worker threads for repeated parallel loops.
+/// run() does not allocate, so a pool can be kept for steady state work such as remeshing.
+class thread_pool {
+public:
+  // num_threads includes the calling thread, zero for one per core.
+  explicit thread_pool(size_t num_threads=0)
+  : task_(nullptr), context_(nullptr), count_(0), next_(0), busy_(0), generation_(0), quit_(false) {
+    if (num_threads == 0) num_threads = default_num_threads();
+    for (size_t t = 1; t < num_threads; ++t) {
+      threads_.emplace_back([this]() { worker(); });
+    }
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    start_.notify_all();
+    for (auto &t : threads_) t.join();
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  size_t size() const { return threads_.size() + 1; }
+
+  // Call fn(i) for every i in [0, count) and wait for them all to finish.
+  template <class F>
+  void run(size_t count, F &fn) {
+    if (threads_.empty() || count <= 1) {
+      for (size_t i = 0; i != count; ++i) fn(i);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = [](void *context, size_t i) { (*(F *)context)(i); };
+      context_ = (void *)&fn;
+      count_ = count;
+      next_ = 0;
+      busy_ = threads_.size();
+      ++generation_;
+    }
+    start_.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return busy_ == 0; });
+  }
+
+private:
+  void work() {
+    for (size_t i; (i = next_++) < count_; ) task_(context_, i);
+  }
+
+  void worker() {
+    unsigned seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&]() { return quit_ || generation_ != seen; });
+        if (quit_) return;
+        seen = generation_;
+      }
+      work();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --busy_;
+      }
+      done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  void (*task_)(void *, size_t);
+  void *context_;
+  size_t count_;
+  std::atomic<size_t> next_;
+  size_t busy_;
+  unsigned generation_;
+  bool quit_;
+};
+
+/// A fifo of at most capacity items between a producer and a consumer stage.
+/// push() waits while the queue is full and pop() while it is empty, so a fast producer
+/// cannot run ahead of its consumer by more than capacity items.
+template <class T>
+class bounded_queue {
+public:
+  explicit bounded_queue(size_t capacity) : capacity_(std::max(capacity, (size_t)1)), closed_(false) {
+  }
+
+  bounded_queue(const bounded_queue &) = delete;
+  bounded_queue &operator=(const bounded_queue &) = delete;
+
+  size_t capacity() const { return capacity_; }
+
+  void push(T value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() { return items_.size() < capacity_; });
+    items_.push_back(std::move(value));
+    lock.unlock();
+    not_empty_.notify_one();
+  }
+
+  // Wait for an item. Returns false once the queue is closed and empty.
+  bool pop(T &value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+    if (items_.empty()) return false;
+    value = std::move(items_.front());
+    items_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  bool try_pop(T &value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (items_.empty()) return false;
+    value = std::move(items_.front());
+    items_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // No more pushes; pop() returns false when the remaining items are gone.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    not_empty_.notify_all();
+  }
+
+private:
+  size_t capacity_;
+  bool closed_;
+  std::deque<T> items_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+};
+
+/// Worker threads for tasks that spawn more tasks, such as the stages of a pipeline.
+/// Each thread has its own deque: it runs its newest task first, which keeps the data of a task that
+/// it has just spawned in its cache, and when it has none it steals the oldest task of another thread.
+/// Threads outside the pool share one deque and run tasks too while they wait().
+class task_pool {
+public:
+  // num_threads includes the calling thread, zero for one per core.
+  explicit task_pool(size_t num_threads=0) : queued_(0), pending_(0), quit_(false) {
+    if (num_threads == 0) num_threads = default_num_threads();
+    for (size_t q = 0; q != num_threads; ++q) queues_.emplace_back(new task_queue());
+    for (size_t t = 1; t < num_threads; ++t) {
+      threads_.emplace_back([this, t]() { worker(t); });
+    }
+  }
+
+  ~task_pool() {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    wake_.notify_all();
+    for (auto &t : threads_) t.join();
+  }
+
+  task_pool(const task_pool &) = delete;
+  task_pool &operator=(const task_pool &) = delete;
+
+  size_t size() const { return queues_.size(); }
+
+  // Queue fn() to run on some thread of the pool. May be called from inside a task.
+  template <class F>
+  void spawn(F fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++pending_;
+      ++queued_;
+    }
+    task_queue &q = *queues_[this_queue()];
+    {
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.tasks.emplace_back(std::move(fn));
+    }
+    wake_.notify_one();
+  }
+
+  // Run one queued task on this thread if there is one.
+  bool run_one() {
+    std::function<void()> task;
+    if (!take(task)) return false;
+    task();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--pending_ == 0) wake_.notify_all();
+    return true;
+  }
+
+  // Run tasks until every spawned task, including those spawned by tasks, has finished.
+  void wait() {
+    for (;;) {
+      if (run_one()) continue;
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (pending_ == 0) return;
+      wake_.wait(lock, [this]() { return pending_ == 0 || queued_ != 0; });
+    }
+  }
+
+private:
+  struct task_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // the deque of the calling thread: its own in a worker, the shared one otherwise.
+  size_t this_queue() const {
+    return current_pool() == this ? current_queue() : 0;
+  }
+
+  static const task_pool *&current_pool() {
+    static thread_local const task_pool *pool = nullptr;
+    return pool;
+  }
+
+  static size_t &current_queue() {
+    static thread_local size_t queue = 0;
+    return queue;
+  }
+
+  // newest task of our own deque, else the oldest of the others in turn.
+  bool take(std::function<void()> &task) {
+    size_t own = this_queue(), n = queues_.size();
+    for (size_t i = 0; i != n; ++i) {
+      task_queue &q = *queues_[i == 0 ? own : (own + i) % n];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty()) continue;
+      if (i == 0) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+      --queued_;
+      return true;
+    }
+    return false;
+  }
+
+  void worker(size_t queue) {
+    current_pool() = this;
+    current_queue() = queue;
+    for (;;) {
+      if (run_one()) continue;
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return quit_ || queued_ != 0; });
+      if (quit_) return;
+    }
+  }
+
+  std::vector<std::unique_ptr<task_queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_;
+  size_t pending_;
+  bool quit_;
+};
+
+/// parallel_for on the threads of a pool.
+template <class F>
+void parallel_for(size_t count, thread_pool &pool, F fn) {
+  pool.run(count, fn);
+}
+
+}
+
+#endif
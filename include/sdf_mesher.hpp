@@ -0,0 +1,242 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_SDF_MESHER
+#define INCLUDED_GLSLMATH_SDF_MESHER
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "math.hpp"
+#include "mesh.hpp"
+#include "marching_cubes.hpp"
+#include "parallel.hpp"
+
+namespace glslmath {
+
+/// Marching cubes of a signed distance function, sampling it only near the surface.
+///
+/// The lattice is covered by blocks of 32 cubes that are split coarse to fine. The function is
+/// called at the centre of each block and a block whose value is further from zero than the block
+/// can change (lipschitz times the half diagonal) cannot contain the surface, so it is filled with
+/// a bound of the right sign instead of being sampled. Blocks of 4 cubes that remain are sampled at
+/// every lattice point, each point once however many cubes share it.
+///
+/// The function takes the same positions as the mesh, (x0 + i) * grid_spacing, and like mc_values is
+/// positive inside. If it keeps to the lipschitz bound the mesh is the same as marching_cubes over the
+/// function sampled at every lattice point. With num_threads != 1 it is called from several threads.
+class sdf_mesher {
+public:
+  explicit sdf_mesher(size_t num_threads=1)
+  : lipschitz_(1), gradient_normals_(false), x0_(0), y0_(0), z0_(0), xdim_(0), ydim_(0), zdim_(0), grid_spacing_(1), evaluations_(0) {
+    set_num_threads(num_threads);
+  }
+
+  void set_num_threads(size_t num_threads) {
+    if (num_threads == 0) num_threads = default_num_threads();
+    pool_.reset(num_threads > 1 ? new thread_pool(num_threads) : nullptr);
+    lanes_.resize(num_threads);
+    mc_.set_num_threads(num_threads);
+  }
+
+  // Largest |f(a) - f(b)| / |a - b|; 1 for a true distance, more for a bound that overshoots.
+  void set_lipschitz(float lipschitz) {
+    lipschitz_ = lipschitz;
+  }
+
+  // As marching_cubes::set_gradient_normals. The points around each sampled block are also sampled
+  // so that the gradient at every vertex is taken from the function.
+  void set_gradient_normals(bool enable) {
+    gradient_normals_ = enable;
+    mc_.set_gradient_normals(enable);
+  }
+
+  // Mesh a function float(vec3) over the lattice of marching_cubes::generate.
+  template <class F>
+  void generate(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, F sdf) {
+    generate_batched(x0, y0, z0, xdim, ydim, zdim, grid_spacing, [&sdf](const vec3 *p, float *v, size_t n) {
+      for (size_t i = 0; i != n; ++i) v[i] = sdf(p[i]);
+    });
+  }
+
+  // Mesh a function void(const vec3 *positions, float *values, size_t n) that evaluates many points at once.
+  template <class F>
+  void generate_batched(int x0, int y0, int z0, int xdim, int ydim, int zdim, float grid_spacing, F sdf) {
+    GLSLMATH_STATS_SCOPE("sdf_mesher.generate");
+    x0_ = x0; y0_ = y0; z0_ = z0;
+    xdim_ = xdim; ydim_ = ydim; zdim_ = zdim;
+    grid_spacing_ = grid_spacing;
+    size_t num_points = xdim > 0 && ydim > 0 && zdim > 0 ? (size_t)xdim * ydim * zdim : 0;
+    values_.resize(num_points);
+    state_.assign(num_points, unknown);
+
+    // z slabs of blocks share a layer of points with the next slab, so do the even ones then the odd ones.
+    int slabs = xdim < 2 || ydim < 2 || zdim < 2 ? 0 : (zdim - 2) / root_cubes + 1;
+    for (auto &ln : lanes_) ln.evaluations = 0;
+    for (int parity = 0; parity != 2; ++parity) {
+      size_t count = (size_t)(slabs + 1 - parity) / 2;
+      size_t num_lanes = std::max(std::min(lanes_.size(), count), (size_t)1);
+      auto fn = [&](size_t l) {
+        for (size_t s = l; s < count; s += num_lanes) sample_slab(lanes_[l], (int)s * 2 + parity, sdf);
+      };
+      if (pool_) {
+        parallel_for(num_lanes, *pool_, fn);
+      } else {
+        for (size_t l = 0; l != num_lanes; ++l) fn(l);
+      }
+    }
+    evaluations_ = 0;
+    for (auto &ln : lanes_) evaluations_ += ln.evaluations;
+
+    mc_.generate(x0, y0, z0, xdim, ydim, zdim, grid_spacing, values_.data(), nullptr);
+  }
+
+  const mesh &get_mesh() const { return mc_.get_mesh(); }
+
+  // The lattice from the last generate(): function values where sampled, bounds of the same sign elsewhere.
+  const std::vector<float> &values() const { return values_; }
+
+  // Calls of the function made by the last generate(), in points.
+  size_t evaluations() const { return evaluations_; }
+
+private:
+  enum { root_cubes = 32, leaf_cubes = 4 };
+  enum { unknown, bounded, pending, sampled };
+
+  struct block {
+    int i, j, k, size;
+  };
+
+  // Scratch for one worker: the blocks of the current level and a batch of points to evaluate.
+  struct lane {
+    lane() : evaluations(0) {}
+    std::vector<block> blocks, next, leaves;
+    std::vector<vec3> points;
+    std::vector<float> results;
+    std::vector<size_t> where;
+    size_t evaluations;
+  };
+
+  vec3 position(float i, float j, float k) const {
+    return vec3(x0_ + i, y0_ + j, z0_ + k) * grid_spacing_;
+  }
+
+  template <class F>
+  void evaluate(lane &ln, F &sdf) {
+    ln.results.resize(ln.points.size());
+    if (!ln.points.empty()) sdf(ln.points.data(), ln.results.data(), ln.points.size());
+    ln.evaluations += ln.points.size();
+    GLSLMATH_STATS_COUNT(sdf_evaluations, ln.points.size());
+  }
+
+  template <class F>
+  void sample_slab(lane &ln, int slab, F &sdf) {
+    ln.blocks.clear();
+    for (int j = 0; j < ydim_ - 1; j += root_cubes) {
+      for (int i = 0; i < xdim_ - 1; i += root_cubes) ln.blocks.push_back(block{ i, j, slab * root_cubes, root_cubes });
+    }
+
+    // test the centre of each block, keeping those near the surface and splitting them until they are leaves.
+    ln.leaves.clear();
+    while (!ln.blocks.empty()) {
+      ln.points.clear();
+      for (auto &b : ln.blocks) {
+        float h = b.size * 0.5f;
+        ln.points.push_back(position(b.i + h, b.j + h, b.k + h));
+      }
+      evaluate(ln, sdf);
+
+      ln.next.clear();
+      for (size_t n = 0; n != ln.blocks.size(); ++n) {
+        const block &b = ln.blocks[n];
+        float d = ln.results[n];
+        int h = b.size / 2;
+        if (b.i + h < xdim_ && b.j + h < ydim_ && b.k + h < zdim_) {
+          size_t idx = index(b.i + h, b.j + h, b.k + h);
+          values_[idx] = d;
+          state_[idx] = sampled;
+        }
+        if (std::abs(d) > lipschitz_ * grid_spacing_ * b.size * 0.8660254f) {
+          fill(b, ln.points[n], d);
+        } else if (b.size == leaf_cubes) {
+          ln.leaves.push_back(b);
+        } else {
+          for (int c = 0; c != 8; ++c) {
+            block child{ b.i + (c & 1) * h, b.j + (c >> 1 & 1) * h, b.k + (c >> 2) * h, h };
+            if (child.i < xdim_ - 1 && child.j < ydim_ - 1 && child.k < zdim_ - 1) ln.next.push_back(child);
+          }
+        }
+      }
+      ln.blocks.swap(ln.next);
+    }
+
+    // sample every point of the leaves, and one more layer around them for gradient normals.
+    int pad = gradient_normals_ ? 1 : 0;
+    ln.points.clear();
+    ln.where.clear();
+    for (auto &b : ln.leaves) {
+      int i0 = std::max(b.i - pad, 0), i1 = std::min(b.i + b.size + pad, xdim_ - 1);
+      int j0 = std::max(b.j - pad, 0), j1 = std::min(b.j + b.size + pad, ydim_ - 1);
+      int k0 = std::max(b.k - pad, 0), k1 = std::min(b.k + b.size + pad, zdim_ - 1);
+      for (int k = k0; k <= k1; ++k) {
+        for (int j = j0; j <= j1; ++j) {
+          for (int i = i0; i <= i1; ++i) {
+            size_t idx = index(i, j, k);
+            if (state_[idx] >= pending) continue;
+            state_[idx] = pending;
+            ln.points.push_back(position((float)i, (float)j, (float)k));
+            ln.where.push_back(idx);
+          }
+        }
+      }
+    }
+    evaluate(ln, sdf);
+    for (size_t n = 0; n != ln.where.size(); ++n) {
+      values_[ln.where[n]] = ln.results[n];
+      state_[ln.where[n]] = sampled;
+    }
+  }
+
+  // Points of a block with no surface get the value closest to zero that the function could have there.
+  void fill(const block &b, vec3 centre, float d) {
+    int i1 = std::min(b.i + b.size, xdim_ - 1), j1 = std::min(b.j + b.size, ydim_ - 1), k1 = std::min(b.k + b.size, zdim_ - 1);
+    float slope = d < 0 ? lipschitz_ : -lipschitz_;
+    for (int k = b.k; k <= k1; ++k) {
+      for (int j = b.j; j <= j1; ++j) {
+        for (int i = b.i; i <= i1; ++i) {
+          size_t idx = index(i, j, k);
+          if (state_[idx] != unknown) continue;
+          values_[idx] = d + slope * length(position((float)i, (float)j, (float)k) - centre);
+          state_[idx] = bounded;
+        }
+      }
+    }
+  }
+
+  size_t index(int i, int j, int k) const {
+    return ((size_t)k * ydim_ + j) * xdim_ + i;
+  }
+
+  float lipschitz_;
+  bool gradient_normals_;
+  int x0_, y0_, z0_;
+  int xdim_, ydim_, zdim_;
+  float grid_spacing_;
+  size_t evaluations_;
+  std::vector<float> values_;
+  std::vector<std::uint8_t> state_;
+  marching_cubes mc_;
+  std::unique_ptr<thread_pool> pool_;
+  std::vector<lane> lanes_;
+};
+
+}
+
+#endif
@@ -0,0 +1,220 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_STATS
+#define INCLUDED_GLSLMATH_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace glslmath {
+
+/// Counters, bytes per chunk tag and stage wall times from the meshing and serialization code.
+///
+/// The hooks in the library are only compiled with GLSLMATH_STATS defined, otherwise the
+/// GLSLMATH_STATS_* macros are empty and cost nothing. When compiled in they add once per call,
+/// slab or chunk, never per cell: counters are relaxed atomics and stages and bytes take a lock.
+///
+/// Query the totals directly or write them as JSON; with set_tracing(true) each stage is also kept
+/// as an event for write_chrome_trace(), which chrome://tracing and Perfetto load.
+class mesh_stats {
+public:
+  enum counter {
+    cells_visited,    // cubes classified by marching cubes, outside skipped bricks
+    active_cells,     // cubes that the surface passes through
+    vertices,         // vertices emitted by marching cubes
+    triangles,        // triangles emitted by marching cubes
+    split_submeshes,  // submeshes made by multi_mesh::split
+    sdf_evaluations,  // points evaluated by sdf_mesher
+    num_counters
+  };
+
+  struct stage {
+    stage() : calls(0), nanoseconds(0) {}
+    std::uint64_t calls;
+    std::uint64_t nanoseconds;
+  };
+
+  struct event {
+    const char *name;
+    unsigned thread;
+    std::uint64_t start;
+    std::uint64_t duration;
+  };
+
+  mesh_stats() : tracing_(false) {
+    reset();
+  }
+
+  mesh_stats(const mesh_stats &) = delete;
+  mesh_stats &operator=(const mesh_stats &) = delete;
+
+  // The stats that the library hooks add to.
+  static mesh_stats &global() {
+    static mesh_stats stats;
+    return stats;
+  }
+
+  static const char *counter_name(counter c) {
+    static const char *names[] = { "cells_visited", "active_cells", "vertices", "triangles", "split_submeshes", "sdf_evaluations" };
+    return names[c];
+  }
+
+  // nanoseconds on a steady clock since the first call.
+  static std::uint64_t now() {
+    typedef std::chrono::steady_clock clock;
+    static const clock::time_point epoch = clock::now();
+    return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - epoch).count();
+  }
+
+  // small number for the calling thread, in order of first use.
+  static unsigned thread_index() {
+    static std::atomic<unsigned> next(0);
+    static thread_local unsigned index = next++;
+    return index;
+  }
+
+  void add(counter c, std::uint64_t n) {
+    counters_[c].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  void add_bytes(const char *tag, std::uint64_t n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_[tag] += n;
+  }
+
+  void add_stage(const char *name, std::uint64_t start, std::uint64_t duration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stage &s = stages_[name];
+    ++s.calls;
+    s.nanoseconds += duration;
+    if (tracing_) events_.push_back(event{ name, thread_index(), start, duration });
+  }
+
+  // keep an event for each stage from now on, for write_chrome_trace().
+  void set_tracing(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tracing_ = enable;
+  }
+
+  void reset() {
+    for (auto &c : counters_) c.store(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_.clear();
+    stages_.clear();
+    events_.clear();
+  }
+
+  std::uint64_t get(counter c) const {
+    return counters_[c].load(std::memory_order_relaxed);
+  }
+
+  // bytes written in chunks of each tag, including the tag and length; nested chunks count in both.
+  std::map<std::string, std::uint64_t> bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+  std::map<std::string, stage> stages() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stages_;
+  }
+
+  std::vector<event> events() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return events_;
+  }
+
+  // {"counters": {...}, "bytes": {tag: bytes}, "stages": {name: {"calls": n, "ms": t}}}
+  void write_json(std::ostream &os) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    os << "{\"counters\": {";
+    for (int c = 0; c != num_counters; ++c) {
+      os << (c ? ", " : "") << "\"" << counter_name((counter)c) << "\": " << counters_[c].load(std::memory_order_relaxed);
+    }
+    os << "}, \"bytes\": {";
+    const char *sep = "";
+    for (auto &b : bytes_) {
+      os << sep << "\"" << b.first << "\": " << b.second;
+      sep = ", ";
+    }
+    os << "}, \"stages\": {";
+    sep = "";
+    for (auto &s : stages_) {
+      char ms[32];
+      snprintf(ms, sizeof(ms), "%.6g", s.second.nanoseconds * 1e-6);
+      os << sep << "\"" << s.first << "\": {\"calls\": " << s.second.calls << ", \"ms\": " << ms << "}";
+      sep = ", ";
+    }
+    os << "}}\n";
+  }
+
+  // The trace events in the Chrome trace event format, one complete ("X") event per stage call.
+  void write_chrome_trace(std::ostream &os) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    os << "{\"traceEvents\": [";
+    const char *sep = "\n";
+    for (auto &e : events_) {
+      char times[64];
+      snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f", e.start * 1e-3, e.duration * 1e-3);
+      os << sep << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", " << times << ", \"pid\": 1, \"tid\": " << e.thread << "}";
+      sep = ",\n";
+    }
+    os << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  }
+
+private:
+  std::atomic<std::uint64_t> counters_[num_counters];
+  mutable std::mutex mutex_;
+  std::map<std::string, std::uint64_t> bytes_;
+  std::map<std::string, stage> stages_;
+  std::vector<event> events_;
+  bool tracing_;
+};
+
+/// Adds the wall time of its lifetime to a stage of mesh_stats::global(). name must be a literal.
+class stats_scope {
+public:
+  explicit stats_scope(const char *name) : name_(name), start_(mesh_stats::now()) {
+  }
+
+  ~stats_scope() {
+    mesh_stats::global().add_stage(name_, start_, mesh_stats::now() - start_);
+  }
+
+  stats_scope(const stats_scope &) = delete;
+  stats_scope &operator=(const stats_scope &) = delete;
+
+private:
+  const char *name_;
+  std::uint64_t start_;
+};
+
+}
+
+#define GLSLMATH_STATS_CAT2(A, B) A##B
+#define GLSLMATH_STATS_CAT(A, B) GLSLMATH_STATS_CAT2(A, B)
+
+#if defined(GLSLMATH_STATS)
+  #define GLSLMATH_STATS_COUNT(COUNTER, N) glslmath::mesh_stats::global().add(glslmath::mesh_stats::COUNTER, (std::uint64_t)(N))
+  #define GLSLMATH_STATS_BYTES(TAG, N) glslmath::mesh_stats::global().add_bytes(TAG, (std::uint64_t)(N))
+  #define GLSLMATH_STATS_SCOPE(NAME) glslmath::stats_scope GLSLMATH_STATS_CAT(glslmath_stats_scope_, __LINE__)(NAME)
+#else
+  #define GLSLMATH_STATS_COUNT(COUNTER, N) ((void)sizeof(N))
+  #define GLSLMATH_STATS_BYTES(TAG, N) ((void)sizeof(N))
+  #define GLSLMATH_STATS_SCOPE(NAME) ((void)0)
+#endif
+
+#endif
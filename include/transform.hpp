@@ -0,0 +1,147 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GLSL-style math library
+//
+// (C) Andy Thomason 2016 (MIT License)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_GLSLMATH_TRANSFORM
+#define INCLUDED_GLSLMATH_TRANSFORM
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "math.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+
+namespace glslmath {
+
+/// Bulk transforms of vertex data, eight vertices per float8 packet.
+///
+/// The raw kernels work on packed float3 arrays such as the data of an "a3f" attribute.
+/// The attribute versions split the work into blocks of 4096 vertices for parallel_for
+/// and fall back to gather/scatter for other formats.
+
+/// Inverse transpose of the upper 3x3 of m; keeps normals perpendicular under non-uniform scale.
+inline mat3 normal_matrix(const mat4 &m) {
+  return transpose(inverse(mat3(m[0].xyz(), m[1].xyz(), m[2].xyz())));
+}
+
+// dest[i] = m * vec4(src[i], w), optionally normalized. The bottom row of m is ignored.
+inline void transform_float3(const mat4 &m, const float *src, float *dest, size_t count, float w, bool normalize) {
+  float8 c[3][3];
+  for (size_t col = 0; col != 3; ++col) {
+    for (size_t row = 0; row != 3; ++row) c[col][row] = float8(m[col][row]);
+  }
+  float8 t[3] = { float8(m[3][0] * w), float8(m[3][1] * w), float8(m[3][2] * w) };
+
+  float lanes[3][8];
+  for (size_t i = 0; i < count; i += 8) {
+    size_t n = std::min(count - i, (size_t)8);
+    if (n != 8) memset(lanes, 0, sizeof(lanes));
+    const float *s = src + i * 3;
+    for (size_t j = 0; j != n; ++j) {
+      lanes[0][j] = s[j * 3 + 0];
+      lanes[1][j] = s[j * 3 + 1];
+      lanes[2][j] = s[j * 3 + 2];
+    }
+    float8 x = float8::load(lanes[0]), y = float8::load(lanes[1]), z = float8::load(lanes[2]);
+    float8 r[3];
+    for (size_t row = 0; row != 3; ++row) {
+      r[row] = c[0][row] * x + c[1][row] * y + c[2][row] * z + t[row];
+    }
+    if (normalize) {
+      // zero vectors stay zero.
+      float8 rlen = float8(1) / sqrt(max(r[0] * r[0] + r[1] * r[1] + r[2] * r[2], float8(1.0e-30f)));
+      for (size_t row = 0; row != 3; ++row) r[row] *= rlen;
+    }
+    r[0].store(lanes[0]);
+    r[1].store(lanes[1]);
+    r[2].store(lanes[2]);
+    float *d = dest + i * 3;
+    for (size_t j = 0; j != n; ++j) {
+      d[j * 3 + 0] = lanes[0][j];
+      d[j * 3 + 1] = lanes[1][j];
+      d[j * 3 + 2] = lanes[2][j];
+    }
+  }
+}
+
+/// dest[i] = (m * vec4(src[i], 1)).xyz() for count packed float3 points. src and dest may be the same array.
+inline void transform_points(const mat4 &m, const float *src, float *dest, size_t count) {
+  transform_float3(m, src, dest, count, 1.0f, false);
+}
+
+/// Normals by the normal matrix of m, renormalized unless normalize is false. src and dest may be the same array.
+inline void transform_normals(const mat4 &m, const float *src, float *dest, size_t count, bool normalize=true) {
+  mat3 n = normal_matrix(m);
+  transform_float3(mat4(vec4(n[0], 0), vec4(n[1], 0), vec4(n[2], 0), vec4(0, 0, 0, 1)), src, dest, count, 0.0f, normalize);
+}
+
+// transform an attribute in place; m already holds the normal matrix for normals.
+template <class Threads>
+void transform_attribute(attribute &attr, const mat4 &m, bool is_normal, bool normalize, Threads &&threads) {
+  const size_t block = 4096;
+  size_t num_vertices = attr.vertex_count();
+  size_t num_blocks = (num_vertices + block - 1) / block;
+
+  if (attr.is_float() && attr.scalar_size() == 4 && attr.vector_elems() == 3) {
+    float *p = attr.elements<float>();
+    parallel_for(num_blocks, threads, [&](size_t b) {
+      float *s = p + b * block * 3;
+      transform_float3(m, s, s, std::min(block, num_vertices - b * block), is_normal ? 0.0f : 1.0f, normalize);
+    });
+    return;
+  }
+
+  // other formats decode to vec4 with w = 1 for missing elements; four element positions
+  // get the full homogeneous transform and four element normals, such as tangents, keep w.
+  parallel_for(num_blocks, threads, [&](size_t b) {
+    for (size_t i = b * block, e = std::min(i + block, num_vertices); i < e; i += 8) {
+      vec4x8 v;
+      attr.gather(i, v);
+      vec4x8 r = m * (is_normal ? vec4x8(v.xyz(), float8(0)) : v);
+      if (is_normal) {
+        vec3x8 xyz = r.xyz();
+        if (normalize) xyz = xyz * (float8(1) / sqrt(max(dot(xyz, xyz), float8(1.0e-30f))));
+        r = vec4x8(xyz, v.w());
+      }
+      attr.scatter(i, r);
+    }
+  });
+}
+
+/// Transform the positions in an attribute in place, splitting large arrays across threads (zero for one per core).
+template <class Threads>
+void transform_points(attribute &attr, const mat4 &m, Threads &&threads) {
+  transform_attribute(attr, m, false, false, threads);
+}
+
+inline void transform_points(attribute &attr, const mat4 &m) {
+  transform_points(attr, m, (size_t)0);
+}
+
+/// Transform the normals in an attribute in place by the normal matrix of m.
+template <class Threads>
+void transform_normals(attribute &attr, const mat4 &m, bool normalize, Threads &&threads) {
+  mat3 n = normal_matrix(m);
+  transform_attribute(attr, mat4(vec4(n[0], 0), vec4(n[1], 0), vec4(n[2], 0), vec4(0, 0, 0, 1)), true, normalize, threads);
+}
+
+inline void transform_normals(attribute &attr, const mat4 &m, bool normalize=true) {
+  transform_normals(attr, m, normalize, (size_t)0);
+}
+
+/// Transform the "pos" and "normal" attributes of a mesh, eg. to bake an instance.
+inline void transform_mesh(mesh &msh, const mat4 &m, size_t num_threads=0) {
+  size_t pos = msh.find_attribute("pos");
+  if (pos != mesh::bad_attr) transform_points(msh[pos], m, num_threads);
+  size_t normal = msh.find_attribute("normal");
+  if (normal != mesh::bad_attr) transform_normals(msh[normal], m, true, num_threads);
+}
+
+}
+
+#endif
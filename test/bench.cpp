@@ -0,0 +1,279 @@
+
+// Microbenchmarks. Prints one JSON object per line:
+//   {"name": ..., "size": ..., "ns_per_op": ..., "items_per_s": ..., "bytes_per_s": ...}
+// so that runs from different commits can be compared with a script.
+//
+// usage: bench [max_dim] [num_threads]   max_dim defaults to 256, 512 needs about 1GB.
+// Built with -DGLSLMATH_STATS the library's mesh_stats totals follow as one more JSON line.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../include/math.hpp"
+#include "../include/mesh.hpp"
+#include "../include/marching_cubes.hpp"
+#include "../include/transform.hpp"
+#include "../include/bvh.hpp"
+#include "../include/brick_mesher.hpp"
+#include "../include/lod_mesher.hpp"
+#include "../include/sdf_mesher.hpp"
+#include "../include/bake_pipeline.hpp"
+#include "../include/stats.hpp"
+
+using namespace glslmath;
+
+// seconds for one call of fn, repeated until at least min_time has passed.
+template <class F>
+static double time_it(F fn, double min_time=0.2) {
+    typedef std::chrono::steady_clock clock;
+    fn();
+    size_t reps = 0;
+    auto start = clock::now();
+    double elapsed = 0;
+    do {
+        fn();
+        ++reps;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < min_time);
+    return elapsed / reps;
+}
+
+// ops, items and bytes are per call of the timed function.
+static void report(const char *name, size_t size, double seconds, double ops, double items, double bytes) {
+    printf("{\"name\": \"%s\", \"size\": %zu, \"ns_per_op\": %.4g, \"items_per_s\": %.4g, \"bytes_per_s\": %.4g}\n",
+        name, size, seconds * 1e9 / ops, items / seconds, bytes / seconds);
+    fflush(stdout);
+}
+
+// keeps results alive without the compiler seeing through them.
+static volatile float sink;
+
+enum sdf_kind { sphere_sdf, noise_sdf };
+
+static std::vector<float> make_values(int dim, sdf_kind kind) {
+    std::vector<float> values((size_t)dim * dim * dim);
+    float r = dim * 0.4f;
+    for (int k = 0; k != dim; ++k) {
+        for (int j = 0; j != dim; ++j) {
+            for (int i = 0; i != dim; ++i) {
+                vec3 p(i - dim * 0.5f, j - dim * 0.5f, k - dim * 0.5f);
+                float v = r - std::sqrt(dot(p, p));
+                if (kind == noise_sdf) {
+                    vec3 q = p * (12.0f / dim);
+                    v += dim * 0.05f * (std::sin(q.x() * 1.7f + std::sin(q.y())) * std::cos(q.z() * 1.3f) + std::sin(q.y() * 2.3f + q.z()));
+                }
+                values[((size_t)k * dim + j) * dim + i] = v;
+            }
+        }
+    }
+    return values;
+}
+
+static void bench_math() {
+    const size_t n = 4096;
+    std::vector<vec4> a(n), b(n);
+    std::vector<vec3> c(n);
+    for (size_t i = 0; i != n; ++i) {
+        a[i] = vec4(i * 0.5f, 1.0f, i * 0.25f, 1.0f);
+        b[i] = vec4(1.0f, i * 0.125f, 2.0f, 0.5f);
+        c[i] = vec3(i * 0.5f, 1.0f, 2.0f);
+    }
+
+    double t = time_it([&]() {
+        vec4 acc(0);
+        for (size_t i = 0; i != n; ++i) acc = acc + a[i] * b[i];
+        sink = acc.x();
+    });
+    report("vec4_mul_add", n, t, n, n, n * 32.0);
+
+    t = time_it([&]() {
+        float acc = 0;
+        for (size_t i = 0; i != n; ++i) acc += dot(a[i], b[i]);
+        sink = acc;
+    });
+    report("vec4_dot", n, t, n, n, n * 32.0);
+
+    t = time_it([&]() {
+        float acc = 0;
+        for (size_t i = 0; i != n; ++i) acc += normalized(c[i]).x();
+        sink = acc;
+    });
+    report("vec3_normalized", n, t, n, n, n * 12.0);
+
+    // a permutation so that repeated products neither grow nor shrink.
+    mat4 m(vec4(0, 1, 0, 0), vec4(0, 0, 1, 0), vec4(0, 0, 0, 1), vec4(1, 0, 0, 0));
+    t = time_it([&]() {
+        vec4 acc(0);
+        for (size_t i = 0; i != n; ++i) acc = acc + m * a[i];
+        sink = acc.x();
+    });
+    report("mat4_mul_vec4", n, t, n, n, n * 16.0);
+
+    std::vector<vec4x8> packets(n / 8);
+    for (size_t i = 0; i != packets.size(); ++i) packets[i] = vec4x8(float8((float)i), float8(1), float8(2), float8(1));
+    t = time_it([&]() {
+        vec4x8 acc(float8(0), float8(0), float8(0), float8(0));
+        for (size_t i = 0; i != packets.size(); ++i) acc = acc + m * packets[i];
+        sink = acc.lane(0).x();
+    });
+    report("mat4_mul_vec4x8", n, t, n, n, n * 16.0);
+
+    std::vector<mat4> ms(256, m);
+    t = time_it([&]() {
+        mat4 acc = m;
+        for (size_t i = 0; i != ms.size(); ++i) acc = ms[i] * acc;
+        sink = acc[0].x();
+    });
+    report("mat4_mul_mat4", ms.size(), t, (double)ms.size(), (double)ms.size(), ms.size() * 64.0);
+
+    t = time_it([&]() {
+        mat4 acc = m;
+        for (size_t i = 0; i != ms.size(); ++i) acc = inverse(acc);
+        sink = acc[0].x();
+    });
+    report("mat4_inverse", ms.size(), t, (double)ms.size(), (double)ms.size(), ms.size() * 64.0);
+
+    affine3x4 a34(m);
+    std::vector<affine3x4> as(256, a34);
+    t = time_it([&]() {
+        affine3x4 acc = a34;
+        for (size_t i = 0; i != as.size(); ++i) acc = as[i] * acc;
+        sink = acc.translation().x();
+    });
+    report("affine3x4_mul", as.size(), t, (double)as.size(), (double)as.size(), as.size() * 48.0);
+
+    std::vector<hvec4> h(n);
+    t = time_it([&]() {
+        convert(a.data(), h.data(), n);
+        convert(h.data(), b.data(), n);
+        sink = b[n - 1].x();
+    });
+    report("half_round_trip", n, t, n, n, n * 48.0);
+}
+
+static void bench_mesh(int max_dim, size_t num_threads) {
+    for (int dim = 64; dim <= max_dim; dim *= 2) {
+        for (int kind = sphere_sdf; kind <= noise_sdf; ++kind) {
+            std::vector<float> values = make_values(dim, (sdf_kind)kind);
+            size_t cells = (size_t)dim * dim * dim;
+            std::string prefix = kind == sphere_sdf ? "sphere" : "noise";
+
+            marching_cubes mc(num_threads);
+            double t = time_it([&]() {
+                mc.generate(0, 0, 0, dim, dim, dim, 1.0f, values.data(), nullptr);
+            });
+            const mesh &msh = mc.get_mesh();
+            size_t triangles = msh.indices().size() / 3;
+            report((prefix + "_marching_cubes").c_str(), dim, t, 1, (double)triangles, cells * 4.0);
+
+            // the rest only need one sdf.
+            if (kind != sphere_sdf) continue;
+
+            mesh::normal_scratch scratch;
+            mesh with_normals = msh;
+            t = time_it([&]() {
+                with_normals.compute_normals(1, scratch, mesh::area_weighted, num_threads);
+            });
+            report("generate_normals", dim, t, 1, (double)triangles, msh.indices().size() * 4.0);
+
+            // regenerating the chunks around a small edit on the surface.
+            brick_mesher chunked(num_threads);
+            chunked.reset(0, 0, 0, dim, dim, dim, 1.0f, values.data(), nullptr);
+            int edit = (int)(dim * 0.9f);
+            t = time_it([&]() {
+                chunked.update(ivec3(edit - 2, dim / 2 - 2, dim / 2 - 2), ivec3(edit + 2, dim / 2 + 2, dim / 2 + 2));
+            });
+            report("brick_mesher_update", dim, t, 1, 1, 0);
+
+            // full resolution near one pole, coarsening towards the other.
+            lod_mesher lods(num_threads);
+            t = time_it([&]() {
+                lods.generate(0, 0, 0, dim, dim, dim, 1.0f, values.data(), vec3(dim * 0.5f, dim * 0.5f, dim * 0.9f));
+            });
+            size_t lod_triangles = 0;
+            for (auto &c : lods.chunks()) lod_triangles += c.msh.indices().size() / 3;
+            report("lod_mesher", dim, t, 1, (double)lod_triangles, cells * 4.0);
+
+            // the same sphere from its distance function, sampled only near the surface.
+            sdf_mesher lazy(num_threads);
+            float r = dim * 0.4f;
+            t = time_it([&]() {
+                lazy.generate(0, 0, 0, dim, dim, dim, 1.0f, [&](vec3 p) {
+                    vec3 q = p - vec3(dim * 0.5f);
+                    return r - std::sqrt(dot(q, q));
+                });
+            });
+            report("sdf_mesher", dim, t, 1, (double)lazy.evaluations(), cells * 4.0);
+
+            // generate, split and serialize overlapped over chunks.
+            bake_pipeline baker(num_threads);
+            std::vector<std::uint8_t> baked;
+            t = time_it([&]() {
+                baked = baker.bake(0, 0, 0, dim, dim, dim, 1.0f, values.data(), nullptr);
+            });
+            report("bake_pipeline", dim, t, 1, (double)triangles, (double)baked.size());
+
+            mat4 xform(vec4(0, 1, 0, 0), vec4(0, 0, 1, 0), vec4(1, 0, 0, 0), vec4(1, 2, 3, 1));
+            mesh moved = msh;
+            size_t vertices = msh.vertex_count();
+            t = time_it([&]() {
+                transform_mesh(moved, xform, num_threads);
+            });
+            report("transform_mesh", dim, t, (double)vertices, (double)vertices, vertices * 48.0);
+
+            mesh_bvh tree;
+            t = time_it([&]() {
+                tree.build(msh, 4, num_threads);
+            });
+            report("bvh_build", dim, t, 1, (double)triangles, msh.indices().size() * 4.0);
+
+            // rays from the centre of the sphere in a spiral of directions.
+            const size_t num_rays = 4096;
+            t = time_it([&]() {
+                float acc = 0;
+                for (size_t r = 0; r != num_rays; ++r) {
+                    float z = 1 - (r + 0.5f) * (2.0f / num_rays), s = std::sqrt(1 - z * z);
+                    mesh_bvh::ray_hit hit;
+                    tree.intersect(vec3(dim * 0.5f), vec3(s * std::cos(r * 2.4f), s * std::sin(r * 2.4f), z), 1e30f, hit);
+                    acc += hit.t;
+                }
+                sink = acc;
+            });
+            report("bvh_ray", dim, t, num_rays, num_rays, 0);
+
+            t = time_it([&]() {
+                multi_mesh split = multi_mesh::split(msh, 65500, 2, num_threads);
+                sink = (float)split.submeshes().size();
+            });
+            report("multi_mesh_split", dim, t, 1, (double)triangles, msh.indices().size() * 4.0);
+
+            std::vector<std::uint8_t> binary;
+            t = time_it([&]() {
+                binary = msh.to_binary();
+            });
+            report("write_binary", dim, t, 1, (double)triangles, (double)binary.size());
+
+            std::string obj;
+            t = time_it([&]() {
+                std::ostringstream os;
+                msh.write_obj(os);
+                obj = os.str();
+            });
+            report("write_obj", dim, t, 1, (double)triangles, (double)obj.size());
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int max_dim = argc > 1 ? atoi(argv[1]) : 256;
+    size_t num_threads = argc > 2 ? (size_t)atoi(argv[2]) : 0;
+    bench_math();
+    bench_mesh(max_dim, num_threads);
+#if defined(GLSLMATH_STATS)
+    mesh_stats::global().write_json(std::cout);
+#endif
+}
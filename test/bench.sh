@@ -0,0 +1 @@
+g++ -std=c++11 -fmax-errors=4 -O3 -pthread bench.cpp -o bench
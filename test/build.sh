@@ -1,2 +1 @@
-
-g++ -std=c++11 -fmax-errors=4 -O3 test.cpp -o test
+g++ -std=c++11 -fmax-errors=4 -O3 -pthread test.cpp link.cpp -o test
@@ -0,0 +1,24 @@
+// A second translation unit that includes every header. It is linked into the tests so that a
+// definition in a header that is not inline fails the build with a multiple definition error.
+
+#include "../include/math.hpp"
+#include "../include/mesh.hpp"
+#include "../include/mesh_reader.hpp"
+#include "../include/marching_cubes.hpp"
+#include "../include/mesh_optimizer.hpp"
+#include "../include/meshlets.hpp"
+#include "../include/mesh_simplify.hpp"
+#include "../include/mesh_compress.hpp"
+#include "../include/transform.hpp"
+#include "../include/bvh.hpp"
+#include "../include/brick_mesher.hpp"
+#include "../include/lod_mesher.hpp"
+#include "../include/sdf_mesher.hpp"
+#include "../include/bake_pipeline.hpp"
+#include "../include/stats.hpp"
+
+using namespace glslmath;
+
+vec3 link_check(const mat3 &m, const mat4 &n, vec3 a, vec3 b) {
+  return transpose(m) * m * cross(a, b) + (transpose(n) * n * vec4(a, 1.0f)).xyz();
+}
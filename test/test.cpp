@@ -1,10 +1,40 @@
 
 #include <iostream>
+#include <map>
+#include <tuple>
 
 #include "../include/math.hpp"
+#include "../include/mesh.hpp"
+#include "../include/mesh_reader.hpp"
+#include "../include/marching_cubes.hpp"
+#include "../include/mesh_optimizer.hpp"
+#include "../include/meshlets.hpp"
+#include "../include/mesh_simplify.hpp"
+#include "../include/mesh_compress.hpp"
+#include "../include/transform.hpp"
+#include "../include/bvh.hpp"
+#include "../include/brick_mesher.hpp"
+#include "../include/lod_mesher.hpp"
+#include "../include/sdf_mesher.hpp"
+#include "../include/bake_pipeline.hpp"
+#include "../include/stats.hpp"
 
 #define CHECK(X) if (!(X)) { std::cout << #X << "\n"; return 1; }
 
+// signed distance to a sphere sampled on a dim^3 lattice, positive inside.
+static std::vector<float> sphere_values(int dim, float radius) {
+    std::vector<float> values(dim * dim * dim);
+    for (int k = 0; k != dim; ++k) {
+        for (int j = 0; j != dim; ++j) {
+            for (int i = 0; i != dim; ++i) {
+                glslmath::vec3 p(i - dim * 0.5f + 0.3f, j - dim * 0.5f + 0.1f, k - dim * 0.5f + 0.2f);
+                values[(k * dim + j) * dim + i] = radius - std::sqrt(dot(p, p));
+            }
+        }
+    }
+    return values;
+}
+
 int main() {
     using namespace glslmath;
     {
@@ -25,6 +55,727 @@ int main() {
         CHECK(c == mat2(1 * 10 + 3 * 20, 2 * 10 + 4 * 20, 1 * 30 + 3 * 40, 2 * 30 + 4 * 40));
         std::cout << c << "\n";
     }
+    {
+        vec4 a(1, 2, 3, 4);
+        vec4 b(8, 6, 4, 2);
+        CHECK(a + b == vec4(9, 8, 7, 6));
+        CHECK(b - a == vec4(7, 4, 1, -2));
+        CHECK(a * b == vec4(8, 12, 12, 8));
+        CHECK(b / a == vec4(8, 3, 4.0f / 3, 0.5f));
+        CHECK(a * 2.0f == vec4(2, 4, 6, 8));
+        CHECK(min(a, b) == vec4(1, 2, 3, 2));
+        CHECK(max(a, b) == vec4(8, 6, 4, 4));
+        CHECK(dot(a, b) == 40);
+        CHECK(normalized(vec4(0, 3, 0, 4)) == vec4(0, 0.6f, 0, 0.8f));
+    }
+    {
+        mat4 a(vec4(1, 2, 3, 4), vec4(5, 6, 7, 8), vec4(9, 10, 11, 12), vec4(13, 14, 15, 16));
+        mat4 i(vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 0, 1, 0), vec4(0, 0, 0, 1));
+        mat4 c = a * a;
+        CHECK(a * i == a);
+        CHECK(i * a == a);
+        CHECK(c[0] == vec4(90, 100, 110, 120));
+        CHECK(c[3] == vec4(426, 484, 542, 600));
+
+        // matrix times vector agrees with the matrix product on a single column.
+        vec4 v(1, -1, 2, 0.5f);
+        CHECK(a * v == (a * mat4(v, vec4(0), vec4(0), vec4(0)))[0]);
+        CHECK(a * v == vec4(1 - 5 + 18 + 6.5f, 2 - 6 + 20 + 7, 3 - 7 + 22 + 7.5f, 4 - 8 + 24 + 8));
+        CHECK(mat4(1.0f) == i);
+    }
+    {
+        // small vector and matrix operations fold at compile time where constexpr allows loops (C++14).
+    #if defined(__cpp_constexpr) && __cpp_constexpr >= 201304
+        constexpr mat3 rot(vec3(0, 1, 0), vec3(-1, 0, 0), vec3(0, 0, 1));
+        constexpr vec3 p = rot * vec3(1, 2, 3);
+        static_assert(p.x() == -2 && p.y() == 1 && p.z() == 3, "mat3 * vec3");
+        constexpr vec3 n = cross(vec3(1, 0, 0), vec3(0, 1, 0));
+        static_assert(n.z() == 1, "cross");
+        constexpr mat3 twice = rot * rot;
+        static_assert(twice[0].x() == -1 && twice[1].y() == -1 && twice[2].z() == 1, "mat3 * mat3");
+        static_assert(mat2(2.0f)[1].y() == 2 && mat2(2.0f)[0].y() == 0, "diagonal mat2");
+    #else
+        mat3 rot(vec3(0, 1, 0), vec3(-1, 0, 0), vec3(0, 0, 1));
+        vec3 p(-2, 1, 3);
+    #endif
+        CHECK(rot * vec3(1, 2, 3) == p);
+        CHECK(mat3(1.0f) * rot == rot);
+    }
+    {
+        // inverses within rounding of the identity.
+        auto near_identity = [](const mat4 &m) {
+            float err = 0;
+            for (size_t c = 0; c != 4; ++c) {
+                for (size_t r = 0; r != 4; ++r) err = std::max(err, std::abs(m[c][r] - (c == r ? 1.0f : 0.0f)));
+            }
+            return err < 1.0e-5f;
+        };
+        mat4 a(vec4(2, 1, 0, 0.5f), vec4(-1, 3, 1, 0), vec4(0.5f, 0, 4, 1), vec4(1, 2, 3, 1));
+        CHECK(transpose(a)[1] == vec4(1, 3, 0, 2));
+        CHECK(transpose(transpose(a)) == a);
+        CHECK(std::abs(determinant(a) - 2.25f) < 1.0e-4f);
+        CHECK(near_identity(inverse(a) * a));
+        CHECK(near_identity(a * inverse(a)));
+
+        mat3 b(vec3(1, 2, 0), vec3(0, 1, 3), vec3(2, 0, 1));
+        CHECK(determinant(b) == 13);
+        mat3 bb = inverse(b) * b;
+        CHECK(near_identity(mat4(vec4(bb[0], 0), vec4(bb[1], 0), vec4(bb[2], 0), vec4(0, 0, 0, 1))));
+        CHECK(determinant(mat2(1, 2, 3, 4)) == -2);
+        CHECK(inverse(mat2(1, 2, 3, 4)) * mat2(1, 2, 3, 4) == mat2(1, 0, 0, 1));
+
+        // affine transforms agree with the equivalent mat4.
+        affine3x4 t(b, vec3(1, -2, 3));
+        affine3x4 u(mat3(vec3(0, 1, 0), vec3(-1, 0, 0), vec3(0, 0, 1)), vec3(5, 0, 0));
+        mat4 tu = t.to_mat4() * u.to_mat4();
+        CHECK((t * u).to_mat4() == tu);
+        CHECK(t.transform_point(vec3(1, 1, 1)) == (t.to_mat4() * vec4(1, 1, 1, 1)).xyz());
+        CHECK(near_identity(inverse(t).to_mat4() * t.to_mat4()));
+        CHECK(near_identity(affine_inverse(t.to_mat4()) * t.to_mat4()));
+        CHECK(rigid_inverse(u).to_mat4() == inverse(u.to_mat4()));
+        CHECK(affine3x4(tu).translation() == (t * u).translation());
+    }
+    {
+        vec3x8 a(float8(1), float8(2), float8(3));
+        vec3x8 b(float8(4), float8(5), float8(6));
+        vec3x8 c = a * b + a;
+        CHECK(c.lane(5) == vec3(5, 12, 21));
+        CHECK(dot(a, b)[7] == 32);
+        CHECK(vec3x8(min(a, b)).lane(0) == vec3(1, 2, 3));
+        CHECK(vec3x8(normalized(vec3x8(float8(0), float8(3), float8(4)))).lane(2) == vec3(0, 0.6f, 0.8f));
+
+        mat4 m(vec4(2, 0, 0, 0), vec4(0, 2, 0, 0), vec4(0, 0, 2, 0), vec4(1, 2, 3, 1));
+        attribute pos("pos");
+        for (int i = 0; i != 10; ++i) pos.push(vec3((float)i, 0, 0));
+        for (size_t i = 0; i < pos.vertex_count(); i += 8) {
+            vec4x8 p;
+            pos.gather(i, p);
+            pos.scatter(i, m * p);
+        }
+        CHECK(pos[0] == vec4(1, 2, 3, 1));
+        CHECK(pos[9] == vec4(19, 2, 3, 1));
+    }
+    {
+        CHECK(float_from_half(half_from_float(1.5f)) == 1.5f);
+        CHECK(float_from_half(half_from_float(-65504.0f)) == -65504.0f);
+        CHECK(float_from_half(half_from_float(7.0e-8f)) == float_from_half(1));
+        CHECK(half_from_float(1.0e6f) == 0x7c00);
+
+        attribute pos("pos");
+        attribute normal("normal", 3, 2, false, false, true);
+        attribute colour("colour", 4, 1, false, true, true);
+        attribute uv("uv", 2, 2, true);
+        pos.push(vec3(1, 2, 3));
+        normal.push(vec3(0, -1, 0.5f));
+        colour.push(vec4(1, 0, 0.5f, 2));
+        uv.push(vec2(0.25f, 0.75f));
+        CHECK(pos.vertex_size() + normal.vertex_size() == 18);
+        CHECK(pos.data().size() == 12 && normal.data().size() == 6 && colour.data().size() == 4);
+        CHECK(pos[0] == vec4(1, 2, 3, 1));
+        CHECK(normal.elements<std::int16_t>()[1] == -32767);
+        CHECK(std::abs(normal[0][2] - 0.5f) < 1.0e-4f);
+        CHECK(colour.elements<std::uint8_t>()[2] == 128 && colour.elements<std::uint8_t>()[3] == 255);
+        CHECK(uv[0] == vec4(0.25f, 0.75f, 0, 1));
+        CHECK(pos.format_tag() == "a3f" && normal.format_tag() == "a3sn" && colour.format_tag() == "a4Bn" && uv.format_tag() == "a2h");
+
+        sizer s;
+        CHECK(normal.write_binary(s).size() == 44);
+        std::vector<std::uint8_t> bytes(44);
+        CHECK(normal.write_binary(bytes.data()) == bytes.data() + 44);
+        CHECK(memcmp(bytes.data() + 24, "a3sn", 5) == 0);
+    }
+    {
+        // bulk half conversion matches the scalar version for every half and a spread of floats.
+        std::vector<std::uint16_t> h(65536), h2(65536);
+        std::vector<float> f(65536);
+        for (size_t i = 0; i != h.size(); ++i) h[i] = (std::uint16_t)i;
+        float_from_half(h.data(), f.data(), f.size());
+        bool agree = true;
+        for (size_t i = 0; i != h.size(); ++i) {
+            float g = float_from_half(h[i]);
+            agree = agree && (memcmp(&g, &f[i], 4) == 0 || (g != g && f[i] != f[i]));
+            f[i] = std::ldexp((float)(i * 2654435761u % 65536) - 32768, (int)(i % 48) - 40);
+        }
+        half_from_float(f.data(), h2.data(), f.size());
+        for (size_t i = 0; i != f.size(); ++i) agree = agree && h2[i] == half_from_float(f[i]);
+        CHECK(agree);
+
+        hvec3 a(vec3(1, -2, 0.1f));
+        CHECK(sizeof(a) == 6 && a.to_vec3() == vec3(1, -2, float_from_half(half_from_float(0.1f))));
+        CHECK(a.y().bits() == half_from_float(-2.0f));
+        CHECK(u8vec4(vec4(1, 0, 0.5f, 2)).z().bits() == 128 && u8vec4(vec4(1, 0, 0.5f, 2)).to_vec4() == vec4(1, 0, 128 / 255.0f, 1));
+        CHECK(i16vec3(0, -1, 0.5f).y().bits() == -32767 && i16vec3(vec3(0, -1, 1)).to_vec3() == vec3(0, -1, 1));
+        hvec4 b[3] = { hvec4(1, 2, 3, 4), hvec4(0.5f, 0, -1, 1), hvec4(8, 7, 6, 5) };
+        vec4 c[3];
+        convert(b, c, 3);
+        CHECK(c[2] == vec4(8, 7, 6, 5));
+
+        // compact attributes decode as the equivalent format flags.
+        attribute uv = attribute::make<hvec2>("uv");
+        attribute colour = attribute::make<u8vec4>("colour");
+        CHECK(uv.format_tag() == "a2h" && colour.format_tag() == "a4Bn" && attribute::make<i16vec3>("normal").format_tag() == "a3sn");
+        uv.push(vec2(0.25f, 0.75f));
+        CHECK(uv.vertices<hvec2>()[0].to_vec2() == vec2(0.25f, 0.75f));
+        colour.resize(1);
+        colour.vertices<u8vec4>()[0] = u8vec4(1, 0, 0.5f, 2);
+        CHECK(colour.elements<std::uint8_t>()[2] == 128 && colour[0] == vec4(1, 0, 128 / 255.0f, 1));
+        bool threw = false;
+        try { uv.vertices<vec2>(); } catch (std::range_error &) { threw = true; }
+        CHECK(threw);
+
+        attribute normal("normal");
+        for (int i = 0; i != 300; ++i) normal.push(normalized(vec3((float)i, 1, -2)));
+        attribute small = normal.as<i16vec3>(), half_normal = normal.as<hvec3>();
+        CHECK(small.data().size() == normal.data().size() / 2 && half_normal.format_tag() == "a3h");
+        std::vector<vec4> v(300);
+        half_normal.get(0, v.data(), v.size());
+        bool close = true;
+        for (size_t i = 0; i != v.size(); ++i) {
+            close = close && v[i] == half_normal[i] && length(v[i].xyz() - normal[i].xyz()) < 1e-3f && length(small[i].xyz() - normal[i].xyz()) < 1e-4f;
+        }
+        CHECK(close);
+        half_normal.set(1, v.data() + 250, 50);
+        CHECK(half_normal[50] == v[299] && half_normal.as<vec3>().vertices<vec3>()[1] == v[250].xyz());
+    }
+    {
+        // bulk transforms agree with one vector at a time, including the partial last packet.
+        mat4 m(vec4(2, 0, 0, 0), vec4(0, 1, 1, 0), vec4(0, 0, 3, 0), vec4(1, 2, 3, 1));
+        attribute pos("pos"), normal("normal"), half_pos("pos", 3, 2);
+        for (int i = 0; i != 21; ++i) {
+            pos.push(vec3((float)i, 1, -2));
+            half_pos.push(vec3((float)i, 1, -2));
+            normal.push(vec3(0, i & 1 ? 1.0f : 0, i & 1 ? 0 : 1.0f));
+        }
+        normal.set(20, vec4(0));
+        attribute moved = pos;
+        transform_points(moved, m);
+        transform_points(half_pos, m, (size_t)1);
+        bool same = true;
+        for (size_t i = 0; i != pos.vertex_count(); ++i) {
+            same = same && moved[i] == m * pos[i] && half_pos[i] == m * pos[i];
+        }
+        CHECK(same);
+
+        // normals stay perpendicular to transformed tangents, here the x axis.
+        thread_pool pool(2);
+        transform_normals(normal, m, true, pool);
+        vec3 tangent = (m * vec4(1, 0, 0, 0)).xyz();
+        CHECK(std::abs(dot(normal[1].xyz(), tangent)) < 1e-6f && std::abs(length(normal[1].xyz()) - 1) < 1e-6f);
+        CHECK(std::abs(dot(normal[2].xyz(), tangent)) < 1e-6f && normal[20] == vec4(0, 0, 0, 1));
+    }
+    {
+        mesh m("quad", 2);
+        size_t pos = m.add_attribute("pos");
+        size_t uv = m.add_attribute("uv", 2, 2, true);
+        for (int i = 0; i != 4; ++i) {
+            m[pos].push(vec3((float)(i & 1), (float)(i >> 1), 0));
+            m[uv].push(vec2((float)(i & 1), (float)(i >> 1)));
+        }
+        m.push_index(0); m.push_index(1); m.push_index(2);
+        m.push_index(2); m.push_index(1); m.push_index(3);
+
+        multi_mesh mm(m);
+        sizer s;
+        CHECK(mm.write_binary(s).size() == mm.binary_size());
+        std::vector<std::uint8_t> bytes = mm.to_binary();
+        // a non-contiguous iterator takes the byte at a time path.
+        std::vector<std::uint8_t> rev(bytes.size());
+        mm.write_binary(rev.rbegin());
+        std::reverse(rev.begin(), rev.end());
+        CHECK(rev == bytes);
+        CHECK(memcmp(&bytes[bytes.size() - 20], "ix2", 4) == 0);
+
+        multi_mesh_view view(bytes.data(), bytes.size());
+        CHECK(view.submeshes().size() == 1);
+        const mesh_view &mv = view.submeshes()[0];
+        CHECK(mv.name() == "quad" && mv.index_size() == 2 && mv.index_count() == 6);
+        CHECK(mv.index(5) == 3);
+        CHECK(mv.attributes().size() == 2);
+        CHECK(mv[mv.find_attribute("pos")].elements<float>() == (const float *)(bytes.data() + 60));
+        CHECK(mv[1].is_float() && mv[1].scalar_size() == 2 && mv[1].vertex_count() == 4);
+        CHECK(multi_mesh(mv.to_mesh()).to_binary() == bytes);
+
+        const char *path = "test_mesh.bin";
+        {
+            std::ofstream os(path, std::ios::binary);
+            os.write((const char *)bytes.data(), bytes.size());
+        }
+        {
+            mesh_file file(path);
+            CHECK(file.submeshes().size() == 1);
+            CHECK(file.view().to_multi_mesh().to_binary() == bytes);
+        }
+        remove(path);
+
+        std::stringstream obj;
+        m.write_obj(obj);
+        CHECK(obj.str().find("v 1 1 0\nvt 0 0\n") != std::string::npos);
+        CHECK(obj.str().find("f 3/3 2/2 4/4\n") != std::string::npos);
+
+        multi_mesh two;
+        two.submeshes().push_back(m);
+        two.submeshes().push_back(m);
+        std::stringstream serial_obj, parallel_obj;
+        two.write_obj(serial_obj, 1);
+        two.write_obj(parallel_obj, 2);
+        CHECK(serial_obj.str() == parallel_obj.str());
+        CHECK(serial_obj.str().find("f 7/7 6/6 8/8\n") != std::string::npos);
+
+        char tmp[32];
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 0.1f)) == "0.1");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 1.8000001f)) == "1.8000001");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, -0.0f)) == "-0");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 100.0f)) == "100");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 0.001f)) == "0.001");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 1e20f)) == "1e+20");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, -1.5e-7f)) == "-1.5e-07");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 16777216.0f)) == "16777216");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 1.17549435e-38f)) == "1.1754944e-38");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 1e-45f)) == "1e-45");
+        CHECK(std::string(tmp, serial::fmt_float(tmp, 3.40282347e38f)) == "3.4028235e+38");
+        for (std::uint32_t bits = 1; bits < 0x7f800000; bits += 0x10001) {
+            float v;
+            memcpy(&v, &bits, sizeof(v));
+            *serial::fmt_float(tmp, v) = 0;
+            CHECK(strtof(tmp, nullptr) == v);
+        }
+    }
+    {
+        std::vector<float> values = sphere_values(20, 7);
+        marching_cubes serial_mc(0, 0, 0, 20, 20, 20, 0.5f, values.data(), nullptr);
+        marching_cubes parallel_mc(0, 0, 0, 20, 20, 20, 0.5f, values.data(), nullptr, 3);
+        CHECK(serial_mc.get_mesh().indices().size() > 0);
+        CHECK(serial_mc.get_mesh().to_binary() == parallel_mc.get_mesh().to_binary());
+
+        mesh streamed;
+        mesh_sink sink(streamed);
+        marching_cubes_stream<mesh_sink> stream(sink, 0, 0, 0, 20, 20, 0.5f);
+        stream.run([&](int k) { return k < 20 ? values.data() + k * 20 * 20 : nullptr; });
+        streamed.generate_normals();
+        CHECK(stream.vertex_count() == serial_mc.get_mesh()[0].vertex_count());
+        CHECK(streamed.to_binary() == serial_mc.get_mesh().to_binary());
+    }
+    {
+        // a small sphere in a large volume leaves most bricks empty.
+        std::vector<float> values = sphere_values(45, 5);
+        mc_brick_index bricks(45, 45, 45, values.data());
+        CHECK(bricks.xbricks() == 6);
+        CHECK(bricks.active_count() > 0 && bricks.active_count() < 6 * 6 * 6 / 4);
+        CHECK(!bricks.active(0, 0, 0) && bricks.max_value(0, 0, 0) < 0);
+
+        marching_cubes mc(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr, 2);
+        mesh streamed;
+        mesh_sink sink(streamed);
+        marching_cubes_stream<mesh_sink> stream(sink, 0, 0, 0, 45, 45, 1.0f);
+        stream.run([&](int k) { return k < 45 ? values.data() + k * 45 * 45 : nullptr; });
+        streamed.generate_normals();
+        CHECK(streamed.to_binary() == mc.get_mesh().to_binary());
+
+        // reusing a mesher for different volumes matches fresh ones.
+        std::vector<float> small = sphere_values(20, 7);
+        marching_cubes reused(3);
+        reused.generate(0, 0, 0, 20, 20, 20, 0.5f, small.data(), nullptr);
+        reused.generate(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr);
+        CHECK(reused.get_mesh().to_binary() == mc.get_mesh().to_binary());
+        reused.generate(0, 0, 0, 20, 20, 20, 0.5f, small.data(), nullptr);
+        CHECK(reused.get_mesh().to_binary() == marching_cubes(0, 0, 0, 20, 20, 20, 0.5f, small.data(), nullptr).get_mesh().to_binary());
+
+        // gradient normals agree with face normals and colours are interpolated.
+        std::vector<vec4> colours(small.size(), vec4(0.25f, 0.5f, 1, 1));
+        reused.set_gradient_normals(true);
+        reused.generate(0, 0, 0, 20, 20, 20, 0.5f, small.data(), colours.data());
+        marching_cubes flat(0, 0, 0, 20, 20, 20, 0.5f, small.data(), nullptr);
+        const mesh &fresh = flat.get_mesh();
+        const mesh &smooth = reused.get_mesh();
+        CHECK(smooth.attributes().size() == 3 && smooth[2].name() == "colour");
+        CHECK(smooth[0].vertex_count() == fresh[0].vertex_count() && smooth.indices() == fresh.indices());
+        float worst = 1;
+        for (size_t i = 0; i != smooth[1].vertex_count(); ++i) {
+            worst = std::min(worst, dot(vec3(smooth[1][i].xyz()), vec3(fresh[1][i].xyz())));
+        }
+        CHECK(worst > 0.9f);
+        CHECK(smooth[2][7] == vec4(0.25f, 0.5f, 1, 1));
+
+        // normals do not depend on the thread count; angle weighting does not move them far.
+        mesh one = fresh, many = fresh, angles = fresh;
+        mesh::normal_scratch scratch;
+        one.compute_normals(1, scratch, mesh::area_weighted, 1);
+        many.compute_normals(1, scratch, mesh::area_weighted, 4);
+        angles.compute_normals(1, scratch, mesh::angle_weighted, 3);
+        CHECK(one.to_binary() == fresh.to_binary() && many.to_binary() == fresh.to_binary());
+        CHECK(angles.to_binary() != fresh.to_binary());
+        for (size_t i = 0; i != angles[1].vertex_count(); ++i) {
+            worst = std::min(worst, dot(vec3(angles[1][i].xyz()), vec3(fresh[1][i].xyz())));
+        }
+        CHECK(worst > 0.9f);
+    }
+    {
+        // chunked meshing has the triangles of the whole lattice, and an edit regenerates only nearby chunks.
+        std::vector<float> values = sphere_values(45, 12);
+        marching_cubes whole(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr);
+        brick_mesher chunked(2, 1);
+        chunked.set_gradient_normals(true);
+        chunked.reset(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr);
+        CHECK(chunked.xchunks() == 6 && chunked.chunk_count() == 216);
+        multi_mesh parts = chunked.to_multi_mesh();
+        size_t triangles = 0;
+        for (auto &m : parts.submeshes()) triangles += m.indices().size() / 3;
+        CHECK(triangles == whole.get_mesh().indices().size() / 3 && parts.submeshes().size() < 216);
+        CHECK(chunked.to_binary() == parts.to_binary());
+
+        std::vector<std::vector<std::uint8_t>> before(chunked.chunk_count());
+        for (size_t c = 0; c != before.size(); ++c) before[c] = chunked.chunk_binary(c);
+        for (int k = 20; k != 25; ++k) {
+            for (int j = 20; j != 25; ++j) {
+                for (int i = 32; i != 37; ++i) values[(k * 45 + j) * 45 + i] += 2;
+            }
+        }
+        // the normals setting only changes at the next reset, so update keeps gradient normals.
+        chunked.set_gradient_normals(false);
+        std::vector<size_t> changed = chunked.update(ivec3(32, 20, 20), ivec3(37, 25, 25));
+        CHECK(changed.size() == 12);
+
+        // every chunk matches meshing the edited lattice from scratch; the others kept their bytes.
+        brick_mesher fresh(1, 1);
+        fresh.set_gradient_normals(true);
+        fresh.reset(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr);
+        bool same = true;
+        size_t differ = 0;
+        for (size_t c = 0; c != chunked.chunk_count(); ++c) {
+            bool was_changed = std::find(changed.begin(), changed.end(), c) != changed.end();
+            same = same && chunked.chunk_binary(c) == fresh.chunk_binary(c) && (was_changed || chunked.chunk_binary(c) == before[c]);
+            differ += chunked.chunk_binary(c) != before[c];
+        }
+        CHECK(same && differ > 0);
+    }
+    {
+        // lod chunks coarsen away from the focus and transition cells close the cracks between them.
+        std::vector<float> values = sphere_values(65, 24);
+        marching_cubes whole(0, 0, 0, 65, 65, 65, 1.0f, values.data(), nullptr);
+        lod_mesher lods(2, 8);
+        lods.generate(0, 0, 0, 65, 65, 65, 1.0f, values.data(), vec3(32, 32, 60), 3, 0.3f);
+        int per_lod[4] = {};
+        size_t triangles = 0, transitions = 0;
+        std::map<std::tuple<float, float, float>, int> ids;
+        std::map<std::pair<int, int>, int> edges;
+        for (auto &c : lods.chunks()) {
+            per_lod[c.lod]++;
+            triangles += c.msh.indices().size() / 3;
+            transitions += c.transition_indices;
+            if (c.msh.indices().empty()) continue;
+            const attribute &pos = c.msh[c.msh.find_attribute("pos")];
+            std::vector<int> id(pos.vertex_count());
+            for (size_t i = 0; i != id.size(); ++i) {
+                vec4 p = pos[i];
+                id[i] = ids.insert(std::make_pair(std::make_tuple(p.x(), p.y(), p.z()), (int)ids.size())).first->second;
+            }
+            auto &ix = c.msh.indices();
+            for (size_t t = 0; t != ix.size(); t += 3) {
+                int a = id[ix[t]], b = id[ix[t + 1]], d = id[ix[t + 2]];
+                if (a == b || b == d || d == a) continue;
+                edges[std::make_pair(a, b)]++;
+                edges[std::make_pair(b, d)]++;
+                edges[std::make_pair(d, a)]++;
+            }
+        }
+        CHECK(per_lod[0] > 0 && per_lod[1] > 0 && per_lod[2] > 0 && transitions > 0);
+        CHECK(triangles < whole.get_mesh().indices().size() / 3);
+
+        // watertight and consistently wound: every edge is used once in each direction.
+        bool closed = true;
+        for (auto &e : edges) {
+            auto rev = edges.find(std::make_pair(e.first.second, e.first.first));
+            closed = closed && e.second == 1 && rev != edges.end() && rev->second == 1;
+        }
+        CHECK(closed);
+
+        lod_mesher serial_lods(1, 8);
+        serial_lods.generate(0, 0, 0, 65, 65, 65, 1.0f, values.data(), vec3(32, 32, 60), 3, 0.3f);
+        CHECK(serial_lods.to_multi_mesh().to_binary() == lods.to_multi_mesh().to_binary());
+    }
+    {
+        // meshing a distance function directly matches the sampled lattice with a fraction of the calls.
+        auto sphere = [](vec3 p) {
+            vec3 q(p.x() - 32.5f + 0.3f, p.y() - 32.5f + 0.1f, p.z() - 32.5f + 0.2f);
+            return 24 - std::sqrt(dot(q, q));
+        };
+        // sample the same function at the same positions so that the values round the same way.
+        std::vector<float> values(65 * 65 * 65);
+        for (int k = 0; k != 65; ++k) {
+            for (int j = 0; j != 65; ++j) {
+                for (int i = 0; i != 65; ++i) values[(k * 65 + j) * 65 + i] = sphere(vec3((float)i, (float)j, (float)k) * 1.0f);
+            }
+        }
+        marching_cubes whole(0, 0, 0, 65, 65, 65, 1.0f, values.data(), nullptr);
+        sdf_mesher lazy;
+        lazy.generate(0, 0, 0, 65, 65, 65, 1.0f, sphere);
+        CHECK(lazy.get_mesh().to_binary() == whole.get_mesh().to_binary());
+        CHECK(lazy.evaluations() * 3 < values.size());
+
+        sdf_mesher batched(2);
+        batched.generate_batched(0, 0, 0, 65, 65, 65, 1.0f, [&](const vec3 *p, float *v, size_t n) {
+            for (size_t i = 0; i != n; ++i) v[i] = sphere(p[i]);
+        });
+        CHECK(batched.get_mesh().to_binary() == whole.get_mesh().to_binary() && batched.evaluations() == lazy.evaluations());
+
+        whole.set_gradient_normals(true);
+        whole.generate(0, 0, 0, 65, 65, 65, 1.0f, values.data(), nullptr);
+        lazy.set_gradient_normals(true);
+        lazy.generate(0, 0, 0, 65, 65, 65, 1.0f, sphere);
+        CHECK(lazy.get_mesh().to_binary() == whole.get_mesh().to_binary());
+    }
+    {
+        // tasks spawned from tasks all run, and a bounded queue hands items over in order.
+        task_pool pool(3);
+        std::atomic<int> sum(0);
+        for (int i = 0; i != 100; ++i) {
+            pool.spawn([&pool, &sum, i]() {
+                pool.spawn([&sum, i]() { sum += i; });
+            });
+        }
+        pool.wait();
+        CHECK(sum == 4950);
+
+        bounded_queue<int> queue(4);
+        std::thread producer([&queue]() {
+            for (int i = 0; i != 100; ++i) queue.push(i);
+            queue.close();
+        });
+        int expected = 0;
+        bool in_order = true;
+        for (int v; queue.pop(v); ++expected) in_order = in_order && v == expected;
+        producer.join();
+        CHECK(in_order && expected == 100);
+    }
+    {
+        // the pipelined bake has the split chunks of brick_mesher in order, whatever the thread count.
+        std::vector<float> values = sphere_values(45, 18);
+        brick_mesher chunked(1, 2);
+        chunked.reset(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr);
+        multi_mesh expected;
+        for (size_t c = 0; c != chunked.chunk_count(); ++c) {
+            if (chunked.chunk_empty(c)) continue;
+            multi_mesh parts = multi_mesh::split(chunked.chunk_mesh(c), 300, 2, 1);
+            for (auto &m : parts.submeshes()) expected.submeshes().push_back(m);
+        }
+        CHECK(expected.submeshes().size() > chunked.chunk_count() / 2);
+
+        bake_pipeline serial_bake(1, 2, 2);
+        serial_bake.set_max_submesh(300);
+        CHECK(serial_bake.bake(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr) == expected.to_binary());
+
+        bake_pipeline pipelined(4, 2, 3);
+        pipelined.set_max_submesh(300);
+        std::vector<size_t> order;
+        pipelined.run(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr, [&](size_t c, const multi_mesh &, const std::vector<std::uint8_t> &) {
+            order.push_back(c);
+        });
+        CHECK(std::is_sorted(order.begin(), order.end()) && pipelined.peak_in_flight() <= 3);
+        CHECK(pipelined.bake(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr) == expected.to_binary());
+
+        // with gradient normals both take them from the whole lattice, so they agree on chunk faces too.
+        chunked.set_gradient_normals(true);
+        chunked.reset(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr);
+        multi_mesh expected_gradient;
+        for (size_t c = 0; c != chunked.chunk_count(); ++c) {
+            if (chunked.chunk_empty(c)) continue;
+            multi_mesh parts = multi_mesh::split(chunked.chunk_mesh(c), 300, 2, 1);
+            for (auto &m : parts.submeshes()) expected_gradient.submeshes().push_back(m);
+        }
+        pipelined.set_gradient_normals(true);
+        CHECK(pipelined.bake(0, 0, 0, 45, 45, 45, 1.0f, values.data(), nullptr) == expected_gradient.to_binary());
+    }
+    {
+        // stats are queryable and export as JSON and a Chrome trace.
+        mesh_stats stats;
+        stats.set_tracing(true);
+        stats.add(mesh_stats::triangles, 5);
+        stats.add(mesh_stats::triangles, 7);
+        stats.add_bytes("MSH", 100);
+        stats.add_stage("bake", 1000, 2500);
+        stats.add_stage("bake", 5000, 500);
+        CHECK(stats.get(mesh_stats::triangles) == 12 && stats.bytes()["MSH"] == 100);
+        CHECK(stats.stages()["bake"].calls == 2 && stats.stages()["bake"].nanoseconds == 3000 && stats.events().size() == 2);
+        std::ostringstream json, trace;
+        stats.write_json(json);
+        stats.write_chrome_trace(trace);
+        CHECK(json.str().find("\"triangles\": 12") != std::string::npos && json.str().find("\"bake\": {\"calls\": 2, \"ms\": 0.003}") != std::string::npos);
+        CHECK(trace.str().find("{\"name\": \"bake\", \"ph\": \"X\", \"ts\": 5.000, \"dur\": 0.500") != std::string::npos);
+        stats.reset();
+        CHECK(stats.get(mesh_stats::triangles) == 0 && stats.stages().empty());
+
+    #if defined(GLSLMATH_STATS)
+        // with the hooks compiled in, the counters follow the meshes made.
+        mesh_stats &global = mesh_stats::global();
+        global.reset();
+        std::vector<float> values = sphere_values(20, 7);
+        marching_cubes mc(0, 0, 0, 20, 20, 20, 1.0f, values.data(), nullptr);
+        std::vector<std::uint8_t> bytes = multi_mesh::split(mc.get_mesh(), 300).to_binary();
+        CHECK(global.get(mesh_stats::vertices) == mc.get_mesh().vertex_count());
+        CHECK(global.get(mesh_stats::triangles) == mc.get_mesh().indices().size() / 3);
+        CHECK(global.get(mesh_stats::active_cells) > 0 && global.get(mesh_stats::active_cells) < global.get(mesh_stats::cells_visited));
+        CHECK(global.get(mesh_stats::split_submeshes) > 1 && global.bytes()["MLT"] == bytes.size());
+        CHECK(global.stages()["marching_cubes.generate"].calls == 1 && global.stages()["multi_mesh.split"].calls == 1);
+    #endif
+    }
+    {
+        // reordering for the vertex cache keeps the same triangles.
+        std::vector<float> values = sphere_values(20, 7);
+        marching_cubes mc(0, 0, 0, 20, 20, 20, 0.5f, values.data(), nullptr);
+        mesh optimized = mc.get_mesh();
+        vertex_cache_stats before, after;
+        optimize_mesh(optimized, &before, &after);
+        CHECK(after.triangles == before.triangles && after.acmr() < before.acmr() && after.acmr() < 0.8f);
+        CHECK(after.atvr() >= 1);
+
+        auto triangles = [](const mesh &m) {
+            std::vector<std::string> res;
+            for (size_t i = 0; i != m.indices().size(); i += 3) {
+                std::ostringstream os;
+                for (size_t c = 0; c != 3; ++c) os << m[0][m.indices()[i+c]] << m[1][m.indices()[i+c]];
+                res.push_back(os.str());
+            }
+            std::sort(res.begin(), res.end());
+            return res;
+        };
+        CHECK(triangles(optimized) == triangles(mc.get_mesh()));
+        CHECK(optimized.indices()[0] == 0 && optimized[0].vertex_count() == mc.get_mesh()[0].vertex_count());
+
+        // two copies of the mesh side by side weld back to one.
+        const mesh &src = mc.get_mesh();
+        mesh doubled = src;
+        size_t n = src.vertex_count();
+        for (size_t a = 0; a != src.attributes().size(); ++a) {
+            for (size_t v = 0; v != n; ++v) doubled[a].push_raw(src[a], v);
+        }
+        for (size_t i = 0; i != src.indices().size(); ++i) doubled.push_index((mesh::index_type)(src.indices()[i] + n));
+        mesh exact = doubled;
+        CHECK(exact.weld(0, false, 3) == n);
+        CHECK(triangles(exact) == triangles(doubled) && exact.indices().size() == 2 * src.indices().size());
+        doubled[1].set(n + src.indices()[0], vec4(0, 0, 1, 1));
+        CHECK(doubled.weld(0, true, 1) == n + 1);
+        CHECK(doubled.indices()[src.indices().size()] == n);
+
+        // splitting into chunks of about 200 vertices, on any number of threads.
+        multi_mesh chunks = multi_mesh::split(src, 200, 2, 1);
+        CHECK(chunks.to_binary() == multi_mesh::split(src, 200, 2, 4).to_binary());
+        size_t total = 0;
+        for (auto &m : chunks.submeshes()) {
+            CHECK(m.vertex_count() < 203 && m.index_size() == 2);
+            total += m.indices().size();
+        }
+        CHECK(chunks.submeshes().size() > 2 && total == src.indices().size());
+
+        // meshlets cover the triangles in order within the limits and their bounds.
+        meshlet_mesh clusters(optimized, 64, 124);
+        std::vector<mesh::index_type> rebuilt;
+        bool bounded = true;
+        for (auto &m : clusters.meshlets()) {
+            bounded = bounded && m.vertex_count <= 64 && m.triangle_count <= 124;
+            vec3 center(m.center[0], m.center[1], m.center[2]);
+            vec3 axis(m.cone_axis[0], m.cone_axis[1], m.cone_axis[2]);
+            for (size_t t = 0; t != m.triangle_count; ++t) {
+                vec3 p[3];
+                for (size_t c = 0; c != 3; ++c) {
+                    rebuilt.push_back(clusters.vertex(m, t, c));
+                    p[c] = optimized[0][rebuilt.back()].xyz();
+                    bounded = bounded && length(p[c] - center) <= m.radius * 1.0001f;
+                }
+                vec3 n = normalized(cross(p[1] - p[0], p[2] - p[0]));
+                bounded = bounded && (m.cone_cutoff == 1 || dot(n, axis) >= std::sqrt(1 - m.cone_cutoff * m.cone_cutoff) - 1e-4f);
+            }
+        }
+        CHECK(bounded && rebuilt == optimized.indices());
+        CHECK(clusters.meshlets().size() >= optimized.indices().size() / 3 / 124);
+        std::vector<uint8_t> msl = clusters.to_binary();
+        CHECK(msl.size() == clusters.binary_size() && std::string((char*)msl.data()) == "MSL");
+
+        // simplification keeps the sphere closed and facing outwards.
+        std::vector<float> big = sphere_values(40, 15);
+        marching_cubes fine(0, 0, 0, 40, 40, 40, 1.0f, big.data(), nullptr);
+        multi_mesh lods = generate_lods(fine.get_mesh(), 4, 0.25f);
+        CHECK(lods.submeshes().size() == 4 && lods.submeshes()[3].name() == "mesh.lod3");
+        bool outwards = true;
+        for (size_t l = 1; l != 4; ++l) {
+            const mesh &lod = lods.submeshes()[l];
+            CHECK(lod.indices().size() <= lods.submeshes()[l-1].indices().size() / 4 + 3);
+            for (size_t i = 0; i != lod.indices().size(); i += 3) {
+                vec3 a = lod[0][lod.indices()[i]].xyz(), b = lod[0][lod.indices()[i+1]].xyz(), c = lod[0][lod.indices()[i+2]].xyz();
+                outwards = outwards && dot(cross(b - a, c - a), a - vec3(20)) > 0;
+            }
+        }
+        CHECK(outwards && lods.submeshes()[3].indices().size() > 60);
+        // trees with parallel subtrees match the single threaded build; rays from the centre hit at the radius.
+        CHECK(fine.get_mesh().indices().size() / 3 > 8192);
+        mesh_bvh big_tree(fine.get_mesh(), 4, 1);
+        thread_pool bvh_pool(3);
+        mesh_bvh pooled;
+        pooled.build(fine.get_mesh(), 4, bvh_pool);
+        CHECK(pooled.nodes().size() == big_tree.nodes().size() && pooled.triangles() == big_tree.triangles());
+        CHECK(memcmp(pooled.nodes().data(), big_tree.nodes().data(), big_tree.nodes().size() * sizeof(mesh_bvh::node)) == 0);
+        bool at_radius = true;
+        for (int r = 0; r != 20; ++r) {
+            mesh_bvh::ray_hit hit;
+            vec3 dir = normalized(vec3(std::sin(r * 1.3f), std::cos(r * 0.7f), std::sin(r * 2.1f + 1)));
+            at_radius = at_radius && big_tree.intersect(vec3(19.7f, 19.9f, 19.8f), dir, 100, hit) && std::abs(hit.t - 15) < 0.2f;
+        }
+        CHECK(at_radius);
+        simplify_options lossless(0, 0);
+        CHECK(simplify(fine.get_mesh(), lossless).indices() == fine.get_mesh().indices());
+
+        // compressed meshes decode to within the quantization error.
+        std::vector<uint8_t> packed = mesh_compress::to_binary(optimized);
+        CHECK(packed.size() == mesh_compress::binary_size(optimized) && packed.size() * 5 < optimized.binary_size() * 2);
+        multi_mesh unpacked = mesh_compress::decode(packed.data(), packed.size());
+        CHECK(unpacked.submeshes().size() == 1);
+        const mesh &decoded = unpacked.submeshes()[0];
+        CHECK(decoded.indices() == optimized.indices() && decoded.index_size() == optimized.index_size());
+        CHECK(decoded[0].name() == "pos" && decoded[0].vertex_count() == optimized[0].vertex_count());
+        float pos_error = 0, normal_error = 1;
+        for (size_t i = 0; i != decoded[0].vertex_count(); ++i) {
+            pos_error = std::max(pos_error, length(decoded[0][i] - optimized[0][i]));
+            normal_error = std::min(normal_error, dot(decoded[1][i], optimized[1][i]) - 1);
+        }
+        CHECK(pos_error < 1e-3f && normal_error > -1e-4f);
+
+        // bounds and bvh queries agree with scanning every triangle.
+        aabb box = compute_bounds(optimized);
+        bounding_sphere ball = compute_bounding_sphere(optimized);
+        CHECK(!box.empty() && length(box.center() - vec3(4.9f)) < 0.25f && std::abs(box.extent().x() - 7) < 0.25f);
+        CHECK(std::abs(ball.radius - 3.5f) < 0.25f && compute_bounds(multi_mesh(optimized))[0].hi == box.hi);
+        mesh_bvh tree(optimized, 4, 1);
+        CHECK(sizeof(mesh_bvh::node) == 32 && tree.nodes().size() > 1 && tree.bounds().lo == box.lo);
+        CHECK(mesh_bvh(optimized, 4, 3).nodes().size() == tree.nodes().size());
+        const std::vector<mesh::index_type> &oi = optimized.indices();
+        bool agree = true;
+        for (int r = 0; r != 40; ++r) {
+            vec3 origin(r * 0.35f, 15 - r * 0.15f, (r * 37 % 11) * 1.5f);
+            vec3 dir = vec3(4.5f + (r % 5) * 0.2f, 5 - (r % 3) * 0.2f, 4.8f) - origin;
+            // nearest hit by brute force, and the closest point.
+            float best_t = 1e30f, best_d2 = 1e30f;
+            for (size_t i = 0; i != oi.size(); i += 3) {
+                vec3 a = optimized[0][oi[i]].xyz(), b = optimized[0][oi[i+1]].xyz(), c = optimized[0][oi[i+2]].xyz();
+                vec3 e1 = b - a, e2 = c - a, pv = cross(dir, e2), tv = origin - a, qv = cross(tv, e1);
+                float det = dot(e1, pv), u = dot(tv, pv) / det, v = dot(dir, qv) / det, t = dot(e2, qv) / det;
+                if (det != 0 && u >= 0 && v >= 0 && u + v <= 1 && t >= 0) best_t = std::min(best_t, t);
+                for (int k = 0; k <= 20; ++k) {
+                    for (int l = 0; k + l <= 20; ++l) {
+                        vec3 d = a + e1 * (k / 20.0f) + e2 * (l / 20.0f) - origin;
+                        best_d2 = std::min(best_d2, dot(d, d));
+                    }
+                }
+            }
+            mesh_bvh::ray_hit hit;
+            mesh_bvh::closest_hit near;
+            agree = agree && tree.intersect(origin, dir, 1e30f, hit) && std::abs(hit.t - best_t) < 1e-4f;
+            agree = agree && tree.closest_point(origin, 100, near) && near.distance2 <= best_d2 + 1e-4f && near.distance2 > best_d2 * 0.9f - 0.1f;
+        }
+        CHECK(agree);
+
+        // snapping to a coarse grid merges nearby positions.
+        mesh coarse = mc.get_mesh();
+        CHECK(coarse.weld(2.0f) < n / 4);
+    }
     std::cout << "All tests passed\n";
 }
 